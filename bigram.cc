@@ -0,0 +1,34 @@
+#include <algorithm>
+#include "bigram.hh"
+
+void Bigram_Counter::count(const uint8_t *data, size_t size, Bigram_Counts &counts) {
+  size_t i = 0;
+
+  counts.fill(0);
+  if(size < 2) return;
+  if(size < split_min) {
+    for(; i + 1 < size; ++i) ++counts[data[i] << 8 | data[i + 1]];
+    return;
+  }
+  sub.assign(3 * BIGRAM_BINS, 0);
+  uint32_t *c1 = &sub[0];
+  uint32_t *c2 = &sub[BIGRAM_BINS];
+  uint32_t *c3 = &sub[2 * BIGRAM_BINS];
+  for(; i + 4 < size; i += 4) {
+    ++counts[data[i] << 8 | data[i + 1]];
+    ++c1[data[i + 1] << 8 | data[i + 2]];
+    ++c2[data[i + 2] << 8 | data[i + 3]];
+    ++c3[data[i + 3] << 8 | data[i + 4]];
+  }
+  for(; i + 1 < size; ++i) ++counts[data[i] << 8 | data[i + 1]];
+  for(size_t j = 0; j < BIGRAM_BINS; ++j) counts[j] += c1[j] + c2[j] + c3[j];
+}
+
+void bigram_histogram(Bigram_Counter &counter, const uint8_t *data, size_t size, Bigram_Histogram &histo) {
+  Bigram_Counts counts;
+
+  counter.count(data, size, counts);
+  uint32_t maxc = *std::max_element(counts.begin(), counts.end());
+  if(maxc == 0) maxc = 1;
+  for(size_t i = 0; i < BIGRAM_BINS; ++i) histo[i] = static_cast<double>(counts[i]) / maxc;
+}
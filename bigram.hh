@@ -0,0 +1,63 @@
+#ifndef __BIGRAM_HH_2017__
+#define __BIGRAM_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <vector>
+
+/*
+ * Bigram histograms are calculated directly from the file data instead
+ * of being stored in the bigram_counts table. The bigram (fst, snd) is
+ * counted in bin fst * 256 + snd, all size - 1 bigrams of the data are
+ * counted just like calc_bigram_counts() in sid_db.py did.
+ */
+
+#define BIGRAM_BINS 65536
+/*! \brief Minimum data size for which the counting is split
+ *
+ * Taken from bigram/counts_split of sid_bench against the unsplit
+ * count: below this the clearing and merging of the sub-histograms
+ * costs more than the store-to-load conflicts on repeated bigrams,
+ * even for data made of runs only. Without long runs the unsplit loop
+ * is faster at every size, so in practice only the large files padded
+ * with runs are split.
+ */
+#define BIGRAM_SPLIT_MIN 49152
+
+typedef std::array<uint32_t, BIGRAM_BINS> Bigram_Counts;
+typedef std::array<double, BIGRAM_BINS> Bigram_Histogram;
+
+/*! \brief Count the bigrams of data
+ *
+ * Runs of equal bytes, which are very common in SID files, increment
+ * the same bin over and over, each increment having to wait for the
+ * previous one. Larger inputs are therefore counted into four
+ * interleaved sub-histograms which are summed at the end. The counter
+ * keeps the sub-histograms, so it should be reused.
+ */
+class Bigram_Counter {
+  std::vector<uint32_t> sub;
+  size_t split_min;
+
+public:
+  /*! \param split_min minimum data size for the split counting */
+  explicit Bigram_Counter(size_t split_min = BIGRAM_SPLIT_MIN) : split_min(split_min) {}
+  /*! \brief Count the bigrams
+   *
+   * \param data file data
+   * \param size size of the data in bytes
+   * \param counts result, overwritten
+   */
+  void count(const uint8_t *data, size_t size, Bigram_Counts &counts);
+};
+
+/*! \brief Bigram histogram normalised to a maximum of one
+ *
+ * \param counter counter to use
+ * \param data file data
+ * \param size size of the data in bytes
+ * \param histo result, all zero if there is no bigram
+ */
+void bigram_histogram(Bigram_Counter &counter, const uint8_t *data, size_t size, Bigram_Histogram &histo);
+
+#endif
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <thread>
+#include "bigram_pairs.hh"
+#include "pipeline.hh"
+
+/*! \brief A block of rows with the distances to all later columns
+ *
+ * distances[k * (count - start) + j - start] is the distance of row
+ * begin + k to column j.
+ */
+struct Row_Block {
+  size_t begin;
+  size_t end;
+  size_t start;
+  std::vector<double> distances;
+};
+
+double sparse_norm2(const Sparse_Histogram &histo) {
+  double sum = 0;
+
+  for(size_t i = 0; i < histo.size; ++i) sum += static_cast<double>(histo.values[i]) * histo.values[i];
+  return sum;
+}
+
+/*! \brief Calculate the distances of a block of rows
+ *
+ * The products of two floats are exact in double, so the dot products
+ * are as precise as a direct summation of the differences.
+ */
+static void calculate_block(const std::vector<Sparse_Histogram> &histos, const std::vector<double> &norms, Row_Block &block) {
+  static thread_local std::vector<float> dense;
+  const size_t count = histos.size();
+  const size_t width = count - block.start;
+  double acc[BIGRAM_PAIRS_ROWS];
+
+  dense.resize(BIGRAM_BINS * BIGRAM_PAIRS_ROWS);
+  for(size_t k = 0; block.begin + k < block.end; ++k) {
+    const Sparse_Histogram &row(histos[block.begin + k]);
+    for(size_t t = 0; t < row.size; ++t) dense[row.bins[t] * BIGRAM_PAIRS_ROWS + k] = row.values[t];
+  }
+  block.distances.assign((block.end - block.begin) * width, 0.0);
+  for(size_t j = block.start; j < count; ++j) {
+    const Sparse_Histogram &col(histos[j]);
+    std::fill(acc, acc + BIGRAM_PAIRS_ROWS, 0.0);
+    for(size_t t = 0; t < col.size; ++t) {
+      const double v = col.values[t];
+      const float *d = &dense[col.bins[t] * BIGRAM_PAIRS_ROWS];
+      for(size_t k = 0; k < BIGRAM_PAIRS_ROWS; ++k) acc[k] += v * d[k];
+    }
+    for(size_t k = 0; block.begin + k < block.end; ++k) {
+      double dist2 = norms[block.begin + k] + norms[j] - 2 * acc[k];
+      block.distances[k * width + j - block.start] = std::sqrt(std::max(dist2, 0.0));
+    }
+  }
+  //Only the touched bins are cleared.
+  for(size_t k = 0; block.begin + k < block.end; ++k) {
+    const Sparse_Histogram &row(histos[block.begin + k]);
+    for(size_t t = 0; t < row.size; ++t) dense[row.bins[t] * BIGRAM_PAIRS_ROWS + k] = 0;
+  }
+}
+
+unsigned long bigram_all_pairs(const std::vector<Sparse_Histogram> &histos, const std::vector<size_t> &first, unsigned int threads, const Bigram_Pairs_Emit &emit) {
+  const size_t count = histos.size();
+  std::vector<double> norms;
+  std::map<size_t, Row_Block> waiting;
+  size_t next = 0;
+  unsigned long emitted = 0;
+
+  if(threads == 0) threads = std::thread::hardware_concurrency();
+  if(threads == 0) threads = 1;
+  for(auto &histo : histos) norms.push_back(sparse_norm2(histo));
+  Pipeline_Config config = { threads, 2 * threads, 1 };
+  run_pipeline<Row_Block, Row_Block>(config,
+    [&](const std::function<bool(Row_Block &&)> &emit_block) {
+      for(size_t begin = 0; begin < count; begin += BIGRAM_PAIRS_ROWS) {
+	Row_Block block = { begin, std::min(begin + BIGRAM_PAIRS_ROWS, count), count, std::vector<double>() };
+	for(size_t i = block.begin; i < block.end; ++i) {
+	  block.start = std::min(block.start, std::max(i + 1, first.empty() ? 0 : first[i]));
+	}
+	if(!emit_block(std::move(block))) return;
+      }
+    },
+    [&](const Row_Block &job) {
+      Row_Block block(job);
+      calculate_block(histos, norms, block);
+      return block;
+    },
+    [&](std::vector<Row_Block> &batch) {
+      //The blocks arrive in any order but are emitted in row order.
+      for(auto &block : batch) waiting[block.begin] = std::move(block);
+      for(auto pos = waiting.find(next); pos != waiting.end(); pos = waiting.find(next)) {
+	const Row_Block &block(pos->second);
+	const size_t width = count - block.start;
+	for(size_t i = block.begin; i < block.end; ++i) {
+	  size_t jbegin = std::max(i + 1, first.empty() ? 0 : first[i]);
+	  for(size_t j = std::max(jbegin, block.start); j < count; ++j) {
+	    emit(i, j, block.distances[(i - block.begin) * width + j - block.start]);
+	    ++emitted;
+	  }
+	}
+	next = block.end;
+	waiting.erase(pos);
+      }
+    });
+  return emitted;
+}
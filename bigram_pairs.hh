@@ -0,0 +1,44 @@
+#ifndef __BIGRAM_PAIRS_HH_2017__
+#define __BIGRAM_PAIRS_HH_2017__
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include "histogram_cache.hh"
+
+/*
+ * The Euclidean distance of two histograms is calculated as
+ *
+ *   |a - b|^2 = |a|^2 + |b|^2 - 2 a.b
+ *
+ * with the squared norms calculated once per histogram. For the dot
+ * products a block of BIGRAM_PAIRS_ROWS rows is scattered into a dense
+ * interleaved table, every other histogram is then gathered against
+ * all rows of the block at once. So each sparse histogram is read once
+ * per block instead of once per pair.
+ */
+
+/*! \brief Rows scattered into one dense block */
+#define BIGRAM_PAIRS_ROWS 8
+
+/*! \brief Called with the row i, the column j, and the distance */
+typedef std::function<void(size_t, size_t, double)> Bigram_Pairs_Emit;
+
+/*! \brief Squared Euclidean norm of a sparse histogram */
+double sparse_norm2(const Sparse_Histogram &histo);
+
+/*! \brief Distances of all pairs of histograms
+ *
+ * The blocks of rows are calculated on all threads, the distances are
+ * emitted in the calling thread ordered by i and j.
+ *
+ * \param histos the histograms
+ * \param first for each row i the first column to calculate, the
+ *        pairs (i, j) with i < j and j >= first[i] are emitted; empty
+ *        for all pairs
+ * \param threads number of threads, 0 = number of cores
+ * \param emit called for each pair
+ * \return number of pairs emitted
+ */
+unsigned long bigram_all_pairs(const std::vector<Sparse_Histogram> &histos, const std::vector<size_t> &first, unsigned int threads, const Bigram_Pairs_Emit &emit);
+
+#endif
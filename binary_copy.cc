@@ -0,0 +1,166 @@
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include "binary_copy.hh"
+#include "metrics.hh"
+
+#define COPY_SIGNATURE "PGCOPY\n\377\r\n"
+#define COPY_SIGNATURE_SIZE 11
+
+static uint16_t get_be16(const uint8_t *data) {
+  return (data[0] << 8) | data[1];
+}
+
+static uint32_t get_be32(const uint8_t *data) {
+  return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+int64_t Copy_Field::integer() const {
+  switch(size) {
+  case 2:
+    return int16_t(get_be16(data));
+  case 4:
+    return int32_t(get_be32(data));
+  case 8:
+    return int64_t((uint64_t(get_be32(data)) << 32) | get_be32(data + 4));
+  }
+  throw std::runtime_error("binary copy: no integer field");
+}
+
+
+/*! \brief Parse the complete rows of a buffer
+ *
+ * \param header the file header has not been seen yet
+ * \param done set when the trailer was found
+ * \return bytes consumed, the rest is an incomplete row
+ */
+static size_t parse_rows(const uint8_t *data, size_t size, size_t fields, bool &header, bool &done, std::vector<Copy_Field> &row, const Copy_Row_Callback &fn, unsigned long &rows) {
+  size_t pos = 0;
+
+  if(header) {
+    if(size < COPY_SIGNATURE_SIZE + 8) return 0;
+    if(std::memcmp(data, COPY_SIGNATURE, COPY_SIGNATURE_SIZE) != 0) throw std::runtime_error("binary copy: invalid signature");
+    size_t extension = get_be32(data + COPY_SIGNATURE_SIZE + 4);
+    if(size < COPY_SIGNATURE_SIZE + 8 + extension) return 0;
+    pos = COPY_SIGNATURE_SIZE + 8 + extension;
+    header = false;
+  }
+  while(!done && pos + 2 <= size) {
+    size_t at = pos + 2;
+    int16_t count = get_be16(data + pos);
+    if(count == -1) {
+      done = true;
+      return pos + 2;
+    }
+    if(static_cast<size_t>(count) != fields) throw std::runtime_error("binary copy: unexpected number of fields");
+    for(size_t i = 0; i < fields; ++i) {
+      if(at + 4 > size) return pos;
+      row[i].size = get_be32(data + at);
+      row[i].data = data + at + 4;
+      at += 4 + (row[i].size > 0 ? row[i].size : 0);
+      if(at > size) return pos;
+    }
+    fn(row.data());
+    ++rows;
+    pos = at;
+  }
+  return pos;
+}
+
+
+Binary_Copy::Binary_Copy(const std::string &connection_string) : conn(PQconnectdb(connection_string.c_str())) {
+  if(PQstatus(conn) != CONNECTION_OK) {
+    std::string error(PQerrorMessage(conn));
+    PQfinish(conn);
+    throw std::runtime_error("binary copy: " + error);
+  }
+}
+
+Binary_Copy::~Binary_Copy() {
+  PQfinish(conn);
+}
+
+void Binary_Copy::exec(const std::string &query) {
+  PGresult *result = PQexec(conn, query.c_str());
+  ExecStatusType status = PQresultStatus(result);
+  std::string error(PQresultErrorMessage(result));
+
+  PQclear(result);
+  if(status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) throw std::runtime_error("binary copy: " + error);
+}
+
+void Binary_Copy::begin(const std::string &snapshot) {
+  exec("BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+  if(!snapshot.empty()) {
+    char *quoted = PQescapeLiteral(conn, snapshot.c_str(), snapshot.size());
+    if(!quoted) throw std::runtime_error("binary copy: " + std::string(PQerrorMessage(conn)));
+    std::string query("SET TRANSACTION SNAPSHOT " + std::string(quoted));
+    PQfreemem(quoted);
+    exec(query);
+  }
+}
+
+void Binary_Copy::commit() {
+  exec("COMMIT");
+}
+
+int64_t Binary_Copy::count(const std::string &query) {
+  PGresult *result = PQexec(conn, query.c_str());
+
+  if(PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) < 1 || PQnfields(result) < 1) {
+    std::string error(PQresultErrorMessage(result));
+    PQclear(result);
+    throw std::runtime_error("binary copy: " + error);
+  }
+  int64_t value = PQgetisnull(result, 0, 0) ? 0 : std::strtoll(PQgetvalue(result, 0, 0), NULL, 10);
+  PQclear(result);
+  return value;
+}
+
+unsigned long Binary_Copy::copy(const std::string &query, size_t fields, const Copy_Row_Callback &fn) {
+  std::vector<Copy_Field> row(fields);
+  unsigned long rows = 0;
+  bool header = true, done = false;
+  PGresult *result = PQexec(conn, ("COPY (" + query + ") TO STDOUT (FORMAT binary)").c_str());
+  Metrics_Counter &copied(metrics().counter("copied_bytes"));
+  char *buf;
+  int size;
+
+  if(PQresultStatus(result) != PGRES_COPY_OUT) {
+    std::string error(PQresultErrorMessage(result));
+    PQclear(result);
+    throw std::runtime_error("binary copy: " + error);
+  }
+  PQclear(result);
+  pending.clear();
+  //Every message holds whole rows, the pending buffer is only a fallback.
+  while((size = PQgetCopyData(conn, &buf, 0)) > 0) {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(buf);
+    copied.add(size);
+    try {
+      if(pending.empty()) {
+	size_t used = parse_rows(data, size, fields, header, done, row, fn, rows);
+	pending.assign(data + used, data + size);
+      } else {
+	pending.insert(pending.end(), data, data + size);
+	size_t used = parse_rows(pending.data(), pending.size(), fields, header, done, row, fn, rows);
+	pending.erase(pending.begin(), pending.begin() + used);
+      }
+    }
+    catch(...) {
+      PQfreemem(buf);
+      while(PQgetCopyData(conn, &buf, 0) > 0) PQfreemem(buf);
+      while((result = PQgetResult(conn))) PQclear(result);
+      throw;
+    }
+    PQfreemem(buf);
+  }
+  std::string error(size == -2 ? PQerrorMessage(conn) : "");
+  while((result = PQgetResult(conn))) {
+    if(PQresultStatus(result) != PGRES_COMMAND_OK && error.empty()) error = PQresultErrorMessage(result);
+    PQclear(result);
+  }
+  if(!error.empty()) throw std::runtime_error("binary copy: " + error);
+  if(!done || !pending.empty()) throw std::runtime_error("binary copy: truncated data");
+  return rows;
+}
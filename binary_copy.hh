@@ -0,0 +1,68 @@
+#ifndef __BINARY_COPY_HH_2017__
+#define __BINARY_COPY_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <libpq-fe.h>
+
+/*
+ * Bulk reads with COPY ... TO STDOUT (FORMAT binary). pqxx 4 only
+ * offers the text format, where every integer is parsed and every
+ * bytea is unescaped from hex into a temporary string. In the binary
+ * format the fields arrive as length and raw bytes in network byte
+ * order, so the rows are decoded in place from the buffer of libpq.
+ */
+
+/*! \brief A field of a row, pointing into the COPY buffer */
+struct Copy_Field {
+  const uint8_t *data;
+  /*! \brief Length in bytes, -1 for NULL */
+  int32_t size;
+
+  bool null() const { return size < 0; }
+  /*! \brief Value of an integer column (int2, int4, or int8) */
+  int64_t integer() const;
+};
+
+/*! \brief Called for every row with fields[0] ... fields[n - 1] */
+typedef std::function<void(const Copy_Field *fields)> Copy_Row_Callback;
+
+/*! \brief Own libpq connection for binary COPY
+ *
+ * The connection is independent of any pqxx connection. To see the
+ * same data as a pqxx transaction it can attach to a snapshot exported
+ * with pg_export_snapshot().
+ */
+class Binary_Copy {
+  PGconn *conn;
+  std::vector<uint8_t> pending;
+
+  void exec(const std::string &query);
+
+public:
+  explicit Binary_Copy(const std::string &connection_string);
+  ~Binary_Copy();
+  Binary_Copy(const Binary_Copy &) = delete;
+  Binary_Copy &operator=(const Binary_Copy &) = delete;
+
+  /*! \brief Start a read only transaction
+   *
+   * \param snapshot exported snapshot to use, empty for a new one
+   */
+  void begin(const std::string &snapshot = std::string());
+  /*! \brief End the transaction */
+  void commit();
+  /*! \brief Value of the first column of the first row, e.g. a count */
+  int64_t count(const std::string &query);
+  /*! \brief Stream the rows of a query
+   *
+   * \param query SELECT whose rows are copied
+   * \param fields number of columns of the query
+   * \return number of rows
+   */
+  unsigned long copy(const std::string &query, size_t fields, const Copy_Row_Callback &fn);
+};
+
+#endif
@@ -1,6 +1,199 @@
 #ifndef __BITSHRED_HH__20170113
 #define __BITSHRED_HH__20170113
 
-typedef std::vector<bool> BitshredType;
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+/*
+ * Bitshreds are stored as bytea in the database. Bit i of the shred
+ * lives in byte i/8 with the mask 0x80 >> (i%8), i.e. the first bit is
+ * the most significant bit of the first byte. The classes below keep
+ * exactly this byte layout in memory but back it with 64-bit words,
+ * so that the bytea can be written out without any repacking and the
+ * set operations can work on whole words using popcount.
+ */
+
+/*! \brief Intersection and union count of two bitshreds
+ *
+ * The Jaccard distance is 1 - intersection / unio.
+ */
+struct Bitshred_Counts {
+  unsigned long intersection;
+  unsigned long unio;
+};
+
+/*! \brief Load a 64-bit word from a possibly unaligned pointer
+ *
+ * The memcpy is compiled to a single unaligned load, this allows to
+ * work directly on the data delivered by pqxx::binarystring.
+ */
+inline uint64_t bitshred_load_word(const uint8_t *ptr) {
+  uint64_t word;
+  std::memcpy(&word, ptr, sizeof(word));
+  return word;
+}
+
+/*! \brief Count intersection and union bits of two bitshreds
+ *
+ * \param fst first bitshred in bytea layout
+ * \param snd second bitshred in bytea layout
+ * \param bytes size of both bitshreds in bytes
+ * \return counts of the intersection and the union
+ */
+inline Bitshred_Counts bitshred_counts(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  Bitshred_Counts counts = { 0, 0 };
+  size_t i;
+
+  for(i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+    uint64_t x = bitshred_load_word(fst + i);
+    uint64_t y = bitshred_load_word(snd + i);
+    counts.intersection += __builtin_popcountll(x & y);
+    counts.unio += __builtin_popcountll(x | y);
+  }
+  for(; i < bytes; ++i) {
+    counts.intersection += __builtin_popcount(fst[i] & snd[i]);
+    counts.unio += __builtin_popcount(fst[i] | snd[i]);
+  }
+  return counts;
+}
+
+/*! \brief Count intersection and union bits for a compile time size
+ *
+ * With the size known the compiler can fully unroll the loop.
+ *
+ * \param BYTES size of both bitshreds in bytes, multiple of eight
+ */
+template<size_t BYTES> inline Bitshred_Counts bitshred_counts_fixed(const uint8_t *fst, const uint8_t *snd) {
+  static_assert(BYTES % sizeof(uint64_t) == 0, "fixed bitshred size must be a multiple of 64 bits");
+  Bitshred_Counts counts = { 0, 0 };
+
+  for(size_t i = 0; i < BYTES; i += sizeof(uint64_t)) {
+    uint64_t x = bitshred_load_word(fst + i);
+    uint64_t y = bitshred_load_word(snd + i);
+    counts.intersection += __builtin_popcountll(x & y);
+    counts.unio += __builtin_popcountll(x | y);
+  }
+  return counts;
+}
+
+/*! \brief Count set bits of a bitshred in bytea layout
+ */
+inline unsigned long bitshred_bit_count(const uint8_t *data, size_t bytes) {
+  unsigned long count = 0;
+  size_t i;
+
+  for(i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+    count += __builtin_popcountll(bitshred_load_word(data + i));
+  }
+  for(; i < bytes; ++i) count += __builtin_popcount(data[i]);
+  return count;
+}
+
+/*! \brief Bitshred with m bits
+ *
+ * The primary template has a compile time size (e.g. the 8192 bits of
+ * the old bitshred8192 table) and keeps the words in a std::array.
+ * The specialisation Bitshred<0> is sized at runtime.
+ *
+ * \param M bitshred size in bits (aka m)
+ */
+template<size_t M = 0> class Bitshred {
+  static_assert(M % 64 == 0, "fixed bitshred size must be a multiple of 64 bits");
+  std::array<uint64_t, M / 64> words;
+
+public:
+  Bitshred() { words.fill(0); }
+  /*! \brief Create from bytea data, the data is copied */
+  Bitshred(const uint8_t *data, size_t bytes) {
+    if(bytes != M / 8) throw std::invalid_argument("bitshred size mismatch");
+    std::memcpy(words.data(), data, bytes);
+  }
+  size_t size() const { return M; }
+  size_t byte_size() const { return M / 8; }
+  void set(size_t bit) { reinterpret_cast<uint8_t *>(words.data())[bit >> 3] |= 0x80 >> (bit & 7); }
+  bool test(size_t bit) const { return data()[bit >> 3] & (0x80 >> (bit & 7)); }
+  /*! \brief Pointer to the bitshred in bytea layout */
+  const uint8_t *data() const { return reinterpret_cast<const uint8_t *>(words.data()); }
+  unsigned long count() const { return bitshred_bit_count(data(), byte_size()); }
+  Bitshred_Counts counts(const Bitshred &other) const { return bitshred_counts_fixed<M / 8>(data(), other.data()); }
+};
+
+/*! \brief Bitshred with m bits given at runtime
+ *
+ * m does not need to be a multiple of 64, unused bits in the last
+ * word are always zero.
+ */
+template<> class Bitshred<0> {
+  size_t m;
+  std::vector<uint64_t> words;
+
+public:
+  explicit Bitshred(size_t m = 0) : m(m), words((m + 63) / 64) {}
+  /*! \brief Create from bytea data, the data is copied */
+  Bitshred(const uint8_t *data, size_t bytes) : m(bytes * 8), words((bytes + 7) / 8) {
+    std::memcpy(words.data(), data, bytes);
+  }
+  size_t size() const { return m; }
+  size_t byte_size() const { return (m + 7) / 8; }
+  void set(size_t bit) { reinterpret_cast<uint8_t *>(words.data())[bit >> 3] |= 0x80 >> (bit & 7); }
+  bool test(size_t bit) const { return data()[bit >> 3] & (0x80 >> (bit & 7)); }
+  /*! \brief Pointer to the bitshred in bytea layout */
+  const uint8_t *data() const { return reinterpret_cast<const uint8_t *>(words.data()); }
+  unsigned long count() const { return bitshred_bit_count(data(), byte_size()); }
+  Bitshred_Counts counts(const Bitshred &other) const {
+    if(m != other.m) throw std::invalid_argument("bitshred size mismatch");
+    return bitshred_counts(data(), other.data(), byte_size());
+  }
+};
+
+typedef Bitshred<> BitshredType;
+typedef Bitshred<8192> Bitshred8192;
+
+/*! \brief Count intersection and union bits, fixed sizes are unrolled
+ *
+ * The common sizes are dispatched to bitshred_counts_fixed(), all
+ * other to the generic loop.
+ */
+inline Bitshred_Counts bitshred_counts_any(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  switch(bytes) {
+  case 1024 / 8:
+    return bitshred_counts_fixed<1024 / 8>(fst, snd);
+  case 2048 / 8:
+    return bitshred_counts_fixed<2048 / 8>(fst, snd);
+  case 4096 / 8:
+    return bitshred_counts_fixed<4096 / 8>(fst, snd);
+  case 8192 / 8:
+    return bitshred_counts_fixed<8192 / 8>(fst, snd);
+  case 16384 / 8:
+    return bitshred_counts_fixed<16384 / 8>(fst, snd);
+  default:
+    return bitshred_counts(fst, snd, bytes);
+  }
+}
+
+/*! \brief Bitshreds of equal size stored in one contiguous block
+ *
+ * This is only a view, the memory belongs to e.g. a Bitshred_Index or
+ * a Bitshred_Table.
+ */
+struct Bitshred_Block {
+  const uint8_t *shreds;
+  size_t stride;
+  size_t bytes;
+  size_t count;
+  const uint32_t *sids;
+
+  const uint8_t *shred(size_t idx) const { return shreds + idx * stride; }
+};
+
+template<size_t M> std::ostream &operator<<(std::ostream &out, const Bitshred<M> &bitshred) {
+  for(size_t i = 0; i < bitshred.size(); ++i) out << (bitshred.test(i) ? '1' : '0');
+  return out;
+}
 
 #endif
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "bitshred_index.hh"
+
+Bitshred_Index::Bitshred_Index(const std::string &fname) : file(fname, "bitshred index", sizeof(Bitshred_Index_Header)), map(file.data()), header(NULL), sids(NULL) {
+  header = reinterpret_cast<const Bitshred_Index_Header *>(map);
+  if(!file.has_header(BITSHRED_INDEX_MAGIC, BITSHRED_INDEX_VERSION)
+     || header->stride < header->bytes
+     || header->shreds_offset + header->count * header->stride > file.size()
+     || header->sids_offset + header->count * sizeof(uint32_t) > file.size()) {
+    throw std::runtime_error("invalid bitshred index: " + fname);
+  }
+  sids = reinterpret_cast<const uint32_t *>(map + header->sids_offset);
+  //Queries scan the whole file.
+  file.advise(MADV_WILLNEED);
+}
+
+size_t Bitshred_Index::find(unsigned int sid) const {
+  const uint32_t *end = sids + header->count;
+  const uint32_t *pos = std::lower_bound(sids, end, sid);
+
+  if(pos == end || *pos != sid) return header->count;
+  return pos - sids;
+}
+
+Bitshred_Block Bitshred_Index::block() const {
+  Bitshred_Block block = { map + header->shreds_offset, header->stride, header->bytes, header->count, sids };
+  return block;
+}
+
+
+
+Bitshred_Index_Writer::Bitshred_Index_Writer(const std::string &fname, unsigned int m, unsigned int n, const std::string &hash) : out(fname, "bitshred index") {
+  if(hash.size() >= sizeof(header.hash)) throw std::invalid_argument("hash name too long for bitshred index");
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, BITSHRED_INDEX_MAGIC, sizeof(header.magic));
+  std::memcpy(header.hash, hash.data(), hash.size());
+  header.version = BITSHRED_INDEX_VERSION;
+  header.m = m;
+  header.n = n;
+  header.bytes = (m + 7) / 8;
+  header.stride = (header.bytes + BITSHRED_INDEX_ALIGN - 1) / BITSHRED_INDEX_ALIGN * BITSHRED_INDEX_ALIGN;
+  header.shreds_offset = BITSHRED_INDEX_HEADER;
+  static_assert(sizeof(Bitshred_Index_Header) <= BITSHRED_INDEX_HEADER, "bitshred index header too large");
+  //Placeholder, rewritten by close().
+  out.pad(BITSHRED_INDEX_HEADER);
+}
+
+void Bitshred_Index_Writer::add(unsigned int sid, const uint8_t *data, size_t bytes) {
+  if(bytes != header.bytes) throw std::invalid_argument("bitshred size does not match index");
+  if(!sids.empty() && sid <= sids.back()) throw std::invalid_argument("sids must be added in ascending order");
+  out.write(data, bytes);
+  out.pad(header.stride - bytes);
+  sids.push_back(sid);
+}
+
+void Bitshred_Index_Writer::close() {
+  header.count = sids.size();
+  header.sids_offset = header.shreds_offset + header.count * header.stride;
+  out.write(sids.data(), sids.size() * sizeof(uint32_t));
+  out.seek(0);
+  out.write(&header, sizeof(header));
+  out.commit();
+}
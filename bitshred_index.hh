@@ -0,0 +1,105 @@
+#ifndef __BITSHRED_INDEX_HH_2017__
+#define __BITSHRED_INDEX_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bitshred.hh"
+#include "mapped_file.hh"
+
+/*
+ * A bitshred index file holds all bitshreds of a single (m, n, hash)
+ * triple, so that queries can scan them directly from the page cache
+ * instead of going through the database. The file is in native byte
+ * order:
+ *
+ *   header     Bitshred_Index_Header, padded to BITSHRED_INDEX_HEADER bytes
+ *   shreds     count * stride bytes, each shred in bytea layout
+ *   sids       count * uint32_t, ascending
+ *
+ * The shreds start at an aligned offset and the stride is a multiple of
+ * BITSHRED_INDEX_ALIGN, so each shred starts on a cache line.
+ */
+
+#define BITSHRED_INDEX_MAGIC "SIDBSIDX"
+#define BITSHRED_INDEX_VERSION 1
+#define BITSHRED_INDEX_ALIGN 64
+#define BITSHRED_INDEX_HEADER 128
+
+struct Bitshred_Index_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t m;
+  uint32_t n;
+  uint32_t bytes;
+  uint64_t count;
+  uint64_t stride;
+  uint64_t shreds_offset;
+  uint64_t sids_offset;
+  char hash[16];
+};
+
+/*! \brief Read only memory mapped bitshred index
+ */
+class Bitshred_Index {
+  Mapped_File file;
+  const uint8_t *map;
+  const Bitshred_Index_Header *header;
+  const uint32_t *sids;
+
+public:
+  /*! \brief Map an index file
+   *
+   * \param fname file name of the index
+   */
+  explicit Bitshred_Index(const std::string &fname);
+  Bitshred_Index(const Bitshred_Index &) = delete;
+  Bitshred_Index &operator=(const Bitshred_Index &) = delete;
+
+  unsigned int m() const { return header->m; }
+  unsigned int n() const { return header->n; }
+  std::string hash() const { return std::string(header->hash, strnlen(header->hash, sizeof(header->hash))); }
+  /*! \brief Number of bitshreds in the index */
+  size_t size() const { return header->count; }
+  /*! \brief Size of a single bitshred in bytes */
+  size_t byte_size() const { return header->bytes; }
+  /*! \brief Distance between two consecutive bitshreds in bytes */
+  size_t stride() const { return header->stride; }
+  unsigned int sid(size_t idx) const { return sids[idx]; }
+  const uint8_t *shred(size_t idx) const { return map + header->shreds_offset + idx * header->stride; }
+  /*! \brief View on all bitshreds */
+  Bitshred_Block block() const;
+  /*! \brief Find the row of a sid
+   *
+   * \return row index or size() if the sid is not in the index
+   */
+  size_t find(unsigned int sid) const;
+};
+
+/*! \brief Write a bitshred index file
+ *
+ * The shreds are streamed to the file, the sids are appended at the
+ * end by close(). The sids must be added in ascending order. The index
+ * is written to a temporary file which is renamed on close() so that
+ * readers never see a half written index.
+ */
+class Bitshred_Index_Writer {
+  Atomic_File out;
+  Bitshred_Index_Header header;
+  std::vector<uint32_t> sids;
+
+public:
+  Bitshred_Index_Writer(const std::string &fname, unsigned int m, unsigned int n, const std::string &hash);
+  Bitshred_Index_Writer(const Bitshred_Index_Writer &) = delete;
+  Bitshred_Index_Writer &operator=(const Bitshred_Index_Writer &) = delete;
+
+  /*! \brief Append a bitshred in bytea layout */
+  void add(unsigned int sid, const uint8_t *data, size_t bytes);
+  /*! \brief Finish the index and move it into place */
+  void close();
+  size_t size() const { return sids.size(); }
+};
+
+#endif
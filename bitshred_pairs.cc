@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "bitshred_pairs.hh"
+#include "jaccard.hh"
+
+//Bytes of bitshreds of both tiles which should fit into L2.
+#define PAIRS_TILE_BYTES (256 * 1024)
+#define PAIRS_STRIDE_ALIGN 64
+
+Bitshred_Table::Bitshred_Table(size_t bytes) : bytes(bytes), stride((bytes + PAIRS_STRIDE_ALIGN - 1) / PAIRS_STRIDE_ALIGN * PAIRS_STRIDE_ALIGN) {
+}
+
+void Bitshred_Table::add(unsigned int sid, const uint8_t *data, size_t size) {
+  if(size != bytes) throw std::invalid_argument("bitshred size mismatch");
+  words.resize(words.size() + stride / sizeof(uint64_t));
+  std::copy(data, data + size, reinterpret_cast<uint8_t *>(words.data()) + sids.size() * stride);
+  sids.push_back(sid);
+}
+
+void Bitshred_Table::reserve(size_t count) {
+  words.reserve(count * stride / sizeof(uint64_t));
+  sids.reserve(count);
+}
+
+Bitshred_Block Bitshred_Table::block() const {
+  Bitshred_Block block = { reinterpret_cast<const uint8_t *>(words.data()), stride, bytes, sids.size(), sids.data() };
+  return block;
+}
+
+
+/*! \brief Number of rows in a tile */
+static size_t tile_rows(const Bitshred_Block &block) {
+  return std::max<size_t>(PAIRS_TILE_BYTES / (2 * block.stride), 16);
+}
+
+static unsigned int thread_count(unsigned int threads) {
+  if(threads == 0) threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
+/*! \brief Run worker(thread) on all threads and wait for them */
+template<typename WORKER> static void run_threads(unsigned int threads, WORKER worker) {
+  std::vector<std::thread> pool;
+
+  for(unsigned int i = 1; i < threads; ++i) pool.emplace_back(worker, i);
+  worker(0);
+  for(auto &i : pool) i.join();
+}
+
+/*! \brief Compare all rows of tile ti with the rows of tile tj
+ *
+ * If both tiles are the same only pairs with i < j are compared.
+ *
+ * \param emit_row called with row i, the first row j, and the counts
+ *        of the rows j from there to the end of tile tj
+ */
+template<typename EMIT_ROW> static void compare_tiles(const Bitshred_Block &block, size_t rows, size_t ti, size_t tj, std::vector<Bitshred_Counts> &counts, EMIT_ROW emit_row) {
+  size_t ibegin = ti * rows;
+  size_t iend = std::min(ibegin + rows, block.count);
+  size_t jbegin = tj * rows;
+  size_t jend = std::min(jbegin + rows, block.count);
+
+  for(size_t i = ibegin; i < iend; ++i) {
+    size_t jstart = (ti == tj) ? i + 1 : jbegin;
+    if(jstart >= jend) continue;
+    jaccard_counts_many(block.shred(i), block.shred(jstart), block.stride, block.bytes, jend - jstart, counts.data());
+    emit_row(i, jstart, jend - jstart);
+  }
+}
+
+/*! \brief The tile pairs of the upper triangle, diagonal included */
+static std::vector<std::pair<size_t, size_t> > upper_tile_pairs(size_t tiles) {
+  std::vector<std::pair<size_t, size_t> > tile_pairs;
+
+  for(size_t ti = 0; ti < tiles; ++ti) {
+    for(size_t tj = ti; tj < tiles; ++tj) tile_pairs.push_back(std::make_pair(ti, tj));
+  }
+  return tile_pairs;
+}
+
+std::vector<Bitshred_Edge> all_pairs_closer(const Bitshred_Block &block, double delta, unsigned int threads) {
+  size_t rows = tile_rows(block);
+  std::vector<std::pair<size_t, size_t> > tile_pairs(upper_tile_pairs((block.count + rows - 1) / rows));
+  std::atomic<size_t> next(0);
+  std::vector<std::vector<Bitshred_Edge> > found;
+  std::vector<Bitshred_Edge> edges;
+
+  threads = thread_count(threads);
+  found.resize(threads);
+  run_threads(threads, [&](unsigned int thread) {
+      std::vector<Bitshred_Counts> counts(rows);
+      std::vector<Bitshred_Edge> &out(found[thread]);
+      size_t idx;
+      while((idx = next++) < tile_pairs.size()) {
+	compare_tiles(block, rows, tile_pairs[idx].first, tile_pairs[idx].second, counts, [&](size_t i, size_t jstart, size_t num) {
+	    for(size_t j = 0; j < num; ++j) {
+	      double distance = jaccard_distance(counts[j]);
+	      if(distance <= delta) {
+		Bitshred_Edge edge = { block.sids[i], block.sids[jstart + j], distance };
+		out.push_back(edge);
+	      }
+	    }
+	  });
+      }
+    });
+  for(auto &i : found) edges.insert(edges.end(), i.begin(), i.end());
+  std::sort(edges.begin(), edges.end(), [](const Bitshred_Edge &x, const Bitshred_Edge &y) {
+      return x.fst < y.fst || (x.fst == y.fst && x.snd < y.snd);
+    });
+  return edges;
+}
+
+std::vector<DistancesVector> all_pairs_lowest(const Bitshred_Block &block, unsigned int k, unsigned int threads) {
+  size_t rows = tile_rows(block);
+  size_t tiles = (block.count + rows - 1) / rows;
+  std::vector<std::pair<size_t, size_t> > tile_pairs(upper_tile_pairs(tiles));
+  std::atomic<size_t> next(0);
+  std::vector<Distance_Selector> selectors(block.count, Distance_Selector::top(k));
+  std::vector<std::mutex> locks(tiles);
+  std::vector<DistancesVector> lowest;
+
+  /*
+   * Each pair is calculated once in the upper triangle and offered to
+   * the lists of both rows. The lists of a row tile are guarded by one
+   * lock, which is only held to update the lists of one row i or of
+   * the rows j of one comparison.
+   */
+  run_threads(thread_count(threads), [&](unsigned int) {
+      std::vector<Bitshred_Counts> counts(rows);
+      size_t idx;
+      while((idx = next++) < tile_pairs.size()) {
+	size_t ti = tile_pairs[idx].first, tj = tile_pairs[idx].second;
+	compare_tiles(block, rows, ti, tj, counts, [&](size_t i, size_t jstart, size_t num) {
+	    {
+	      std::lock_guard<std::mutex> guard(locks[ti]);
+	      for(size_t j = 0; j < num; ++j) selectors[i].add(block.sids[jstart + j], jaccard_distance(counts[j]));
+	    }
+	    std::lock_guard<std::mutex> guard(locks[tj]);
+	    for(size_t j = 0; j < num; ++j) selectors[jstart + j].add(block.sids[i], jaccard_distance(counts[j]));
+	  });
+      }
+    });
+  for(auto &i : selectors) lowest.push_back(i.take());
+  return lowest;
+}
+
+
+Bitshred_Batch::Bitshred_Batch(const Bitshred_Block &queries, const Distance_Selector &selector, unsigned int threads) : queries(queries), threads(thread_count(threads)), found(queries.count, selector) {
+}
+
+void Bitshred_Batch::scan(const Bitshred_Block &block) {
+  if(block.bytes != queries.bytes) throw std::invalid_argument("bitshred size mismatch");
+  size_t rows = tile_rows(block);
+  size_t groups = (queries.count + rows - 1) / rows;
+  std::atomic<size_t> next(0);
+
+  //Every thread owns whole groups of queries, the lists need no locking.
+  run_threads(std::min<size_t>(threads, std::max<size_t>(groups, 1)), [&](unsigned int) {
+      std::vector<Bitshred_Counts> counts(rows);
+      size_t group;
+      while((group = next++) < groups) {
+	size_t qend = std::min((group + 1) * rows, queries.count);
+	for(size_t jbegin = 0; jbegin < block.count; jbegin += rows) {
+	  size_t num = std::min(rows, block.count - jbegin);
+	  for(size_t q = group * rows; q < qend; ++q) {
+	    jaccard_counts_many(queries.shred(q), block.shred(jbegin), block.stride, block.bytes, num, counts.data());
+	    for(size_t j = 0; j < num; ++j) {
+	      unsigned int sid = block.sids[jbegin + j];
+	      if(sid == queries.sids[q]) continue;
+	      found[q].add(sid, jaccard_distance(counts[j]));
+	    }
+	  }
+	}
+      }
+    });
+}
+
+std::vector<DistancesVector> Bitshred_Batch::results() {
+  std::vector<DistancesVector> sorted;
+
+  for(auto &i : found) sorted.push_back(i.take());
+  return sorted;
+}
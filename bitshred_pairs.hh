@@ -0,0 +1,94 @@
+#ifndef __BITSHRED_PAIRS_HH_2017__
+#define __BITSHRED_PAIRS_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+#include "bitshred.hh"
+#include "topk.hh"
+
+/*! \brief Bitshreds loaded into memory
+ *
+ * The stride is padded to 64 bytes like in the index file.
+ */
+class Bitshred_Table {
+  std::vector<uint64_t> words;
+  std::vector<uint32_t> sids;
+  size_t bytes;
+  size_t stride;
+
+public:
+  explicit Bitshred_Table(size_t bytes);
+  /*! \brief Append a bitshred in bytea layout */
+  void add(unsigned int sid, const uint8_t *data, size_t size);
+  /*! \brief Allocate room for count bitshreds in advance */
+  void reserve(size_t count);
+  size_t size() const { return sids.size(); }
+  Bitshred_Block block() const;
+};
+
+/*! \brief Pair of SIDs with their Jaccard distance */
+struct Bitshred_Edge {
+  uint32_t fst;
+  uint32_t snd;
+  double distance;
+};
+
+typedef std::vector<std::pair<unsigned int, double> > DistancesVector;
+
+/*! \brief All pairs closer than delta
+ *
+ * The upper triangle of the distance matrix is calculated in tiles
+ * which fit into the cache, the tiles are distributed over all
+ * threads.
+ *
+ * \param block all bitshreds
+ * \param delta maximum Jaccard distance
+ * \param threads number of threads, 0 = number of cores
+ * \return edges with fst < snd, sorted by fst and snd
+ */
+std::vector<Bitshred_Edge> all_pairs_closer(const Bitshred_Block &block, double delta, unsigned int threads);
+
+/*! \brief The k closest SIDs for every SID
+ *
+ * Like all_pairs_closer() only the upper triangle is calculated, each
+ * distance is offered to the closest SIDs of both rows.
+ *
+ * \param block all bitshreds
+ * \param k number of closest SIDs to keep
+ * \param threads number of threads, 0 = number of cores
+ * \return for each row of the block the closest SIDs, sorted by distance
+ */
+std::vector<DistancesVector> all_pairs_lowest(const Bitshred_Block &block, unsigned int k, unsigned int threads);
+
+/*! \brief Many queries answered in one pass over the bitshreds
+ *
+ * The bitshreds are passed in blocks to scan(), e.g. chunks streamed
+ * from the database. Each block is compared with all queries, the
+ * queries are distributed in groups over the threads.
+ */
+class Bitshred_Batch {
+  Bitshred_Block queries;
+  unsigned int threads;
+  std::vector<Distance_Selector> found;
+
+public:
+  /*!
+   * \param queries bitshreds of the query SIDs, must outlive the batch
+   * \param selector empty selector copied for every query
+   * \param threads number of threads, 0 = number of cores
+   */
+  Bitshred_Batch(const Bitshred_Block &queries, const Distance_Selector &selector, unsigned int threads);
+  /*! \brief Compare all queries with a block of bitshreds
+   *
+   * The query SID itself is skipped.
+   */
+  void scan(const Bitshred_Block &block);
+  /*! \brief For each query the closest SIDs, sorted by distance
+   *
+   * The selected SIDs are moved out of the batch.
+   */
+  std::vector<DistancesVector> results();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include "bulk_writer.hh"
+#include "metrics.hh"
+
+Copy_Row &Copy_Row::operator<<(double value) {
+  char buf[32];
+
+  separator();
+  std::snprintf(buf, sizeof(buf), "%.17g", value);
+  line += buf;
+  return *this;
+}
+
+Copy_Row &Copy_Row::operator<<(const std::string &text) {
+  separator();
+  for(char c : text) {
+    switch(c) {
+    case '\\':
+      line += "\\\\";
+      break;
+    case '\t':
+      line += "\\t";
+      break;
+    case '\n':
+      line += "\\n";
+      break;
+    case '\r':
+      line += "\\r";
+      break;
+    default:
+      line += c;
+    }
+  }
+  return *this;
+}
+
+Copy_Row &Copy_Row::bytea(const uint8_t *data, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+
+  separator();
+  // The backslash of the bytea hex format is escaped for COPY.
+  line += "\\\\x";
+  size_t pos = line.size();
+  line.resize(pos + 2 * size);
+  char *out = &line[pos];
+  for(size_t i = 0; i < size; ++i) {
+    out[2 * i] = digits[data[i] >> 4];
+    out[2 * i + 1] = digits[data[i] & 15];
+  }
+  return *this;
+}
+
+Copy_Row &Copy_Row::null() {
+  separator();
+  line += "\\N";
+  return *this;
+}
+
+
+void copy_rows(pqxx::work &txn, const std::string &table, const std::vector<std::string> &columns, const std::vector<Copy_Row> &rows) {
+  if(rows.empty()) return;
+  pqxx::tablewriter writer(txn, table, columns.begin(), columns.end());
+  for(auto &row : rows) writer.write_raw_line(row.str());
+  writer.complete();
+}
+
+
+Bulk_Writer::Bulk_Writer(pqxx::connection_base &conn, const std::string &table, const std::vector<std::string> &columns, size_t batch_size, double flush_interval) : conn(conn), table(table), columns(columns), batch_size(batch_size), flush_interval(flush_interval), pending(0), total(0) {
+}
+
+Bulk_Writer::~Bulk_Writer() {
+  // The writer has to go before its transaction. Without a commit the
+  // transaction is aborted.
+  try {
+    writer.reset();
+  }
+  catch(...) {
+  }
+  txn.reset();
+}
+
+void Bulk_Writer::write(const Copy_Row &row) {
+  if(!writer) {
+    txn.reset(new pqxx::work(conn, "bulk write " + table));
+    writer.reset(new pqxx::tablewriter(*txn, table, columns.begin(), columns.end()));
+    started = std::chrono::steady_clock::now();
+  }
+  writer->write_raw_line(row.str());
+  ++pending;
+  if((batch_size > 0 && pending >= batch_size) || (flush_interval.count() > 0 && std::chrono::steady_clock::now() - started >= flush_interval)) {
+    flush();
+  }
+}
+
+void Bulk_Writer::flush() {
+  if(!writer) return;
+  Metrics_Scope scope(metrics().timer("commit"));
+  try {
+    writer->complete();
+    writer.reset();
+    if(commit_hook) commit_hook(*txn);
+    txn->commit();
+  }
+  catch(...) {
+    // The rows are lost, but the next write starts a new COPY.
+    writer.reset();
+    txn.reset();
+    pending = 0;
+    throw;
+  }
+  txn.reset();
+  metrics().counter("rows_written").add(pending);
+  total += pending;
+  pending = 0;
+}
@@ -0,0 +1,118 @@
+#ifndef __BULK_WRITER_HH_2017__
+#define __BULK_WRITER_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+/*
+ * Rows are streamed into the tables with COPY ... FROM STDIN instead
+ * of one INSERT per row. pqxx::tablewriter only speaks the text format
+ * of COPY, so bytea columns are sent in the hex format (\x...) which
+ * the server decodes without any further escaping.
+ *
+ * Unlike the reads of Binary_Copy, the writes stay in the text format:
+ * the commit hooks store the cursor and the referencing rows in the
+ * transaction of the COPY, and pqxx 4 neither has a binary COPY nor
+ * hands out its libpq connection. A second connection would commit the
+ * fingerprints apart from their cursor. The price is twice the bytes on
+ * the wire for bytea, the encoding itself runs at about 1 GB/s (see
+ * copy/bytea_hex of sid_bench) and is far from the cost of the COPY.
+ */
+
+/*! \brief Default number of rows per COPY */
+#define BULK_WRITER_BATCH 4096
+/*! \brief Default maximum age of the first row of a COPY in seconds */
+#define BULK_WRITER_FLUSH 5.0
+
+/*! \brief One row in the text format of COPY
+ *
+ * The columns are appended in the order given to the Bulk_Writer.
+ */
+class Copy_Row {
+  std::string line;
+  size_t columns;
+
+  void separator() { if(columns++ > 0) line += '\t'; }
+
+public:
+  Copy_Row() : columns(0) {}
+  Copy_Row &operator<<(int value) { separator(); line += std::to_string(value); return *this; }
+  Copy_Row &operator<<(unsigned int value) { separator(); line += std::to_string(value); return *this; }
+  Copy_Row &operator<<(long value) { separator(); line += std::to_string(value); return *this; }
+  Copy_Row &operator<<(unsigned long value) { separator(); line += std::to_string(value); return *this; }
+  /*! \brief Floating point value, printed with full precision */
+  Copy_Row &operator<<(double value);
+  /*! \brief Text value, tabs, newlines, and backslashes are escaped */
+  Copy_Row &operator<<(const std::string &text);
+  Copy_Row &operator<<(const char *text) { return *this << std::string(text); }
+  /*! \brief bytea value */
+  Copy_Row &bytea(const uint8_t *data, size_t size);
+  /*! \brief NULL value */
+  Copy_Row &null();
+  /*! \brief The row without the line terminator */
+  const std::string &str() const { return line; }
+};
+
+/*! \brief COPY rows into a table within an open transaction
+ *
+ * Used in the commit hook of a Bulk_Writer to store rows of tables
+ * referencing the rows of the writer in the same transaction.
+ */
+void copy_rows(pqxx::work &txn, const std::string &table, const std::vector<std::string> &columns, const std::vector<Copy_Row> &rows);
+
+/*! \brief Stream rows into a table with COPY
+ *
+ * The writer uses its own transactions on the connection, so no other
+ * transaction may be open on it. A COPY is completed and committed
+ * after batch_size rows or when a row is written and the first row of
+ * the COPY is older than flush_interval seconds. Rows not flushed are
+ * discarded on destruction just like an uncommitted transaction, so
+ * flush() has to be called at the end.
+ */
+class Bulk_Writer {
+  pqxx::connection_base &conn;
+  std::string table;
+  std::vector<std::string> columns;
+  size_t batch_size;
+  std::chrono::duration<double> flush_interval;
+  std::unique_ptr<pqxx::work> txn;
+  std::unique_ptr<pqxx::tablewriter> writer;
+  std::chrono::steady_clock::time_point started;
+  size_t pending;
+  unsigned long total;
+  std::function<void(pqxx::work &)> commit_hook;
+
+public:
+  /*!
+   * \param conn database connection used only by this writer
+   * \param table name of the table
+   * \param columns column names in the order of the Copy_Row values
+   * \param batch_size rows per COPY (0 = no limit)
+   * \param flush_interval maximum age of a COPY in seconds (0 = no limit)
+   */
+  Bulk_Writer(pqxx::connection_base &conn, const std::string &table, const std::vector<std::string> &columns, size_t batch_size = BULK_WRITER_BATCH, double flush_interval = BULK_WRITER_FLUSH);
+  ~Bulk_Writer();
+  Bulk_Writer(const Bulk_Writer &) = delete;
+  Bulk_Writer &operator=(const Bulk_Writer &) = delete;
+
+  /*! \brief Write a row, flushes if the batch is full or too old */
+  void write(const Copy_Row &row);
+  /*! \brief Complete and commit the current COPY */
+  void flush();
+  /*! \brief Function called in the transaction after the COPY is complete
+   *
+   * It allows to store e.g. the progress together with the rows.
+   */
+  void on_commit(const std::function<void(pqxx::work &)> &hook) { commit_hook = hook; }
+  /*! \brief Rows not committed yet */
+  size_t size() const { return pending; }
+  /*! \brief Rows committed */
+  unsigned long written() const { return total; }
+};
+
+#endif
@@ -3,16 +3,33 @@
 #include <iostream>
 #include <boost/format.hpp>
 #include <pqxx/pqxx>
-#include <set>
+#include <map>
+#include <memory>
 #include <vector>
 #include <sstream>
 #include <cstdlib>
 #include <cmath>
 #include <cstdio>
 #include <getopt.h>
+#include <stdexcept>
+#include "bulk_writer.hh"
+#include "bigram.hh"
+#include "histogram_cache.hh"
+#include "bigram_pairs.hh"
+#include "corpus_archive.hh"
+#include "metrics.hh"
+
+#define RESULT_STRIDE 89
+#define HISTOGRAM_CACHE_FILE "bigram_histograms.cache"
 
 typedef std::vector<unsigned long> SIDs_Container;
-typedef std::set<std::pair<unsigned long, unsigned long> > SIDs_Pairs;
+
+/*! \brief Length and MD5 (hex) of the data of a file */
+struct Data_Digest {
+  uint64_t size;
+  std::string md5;
+};
+typedef std::map<unsigned long, Data_Digest> Data_Digests;
 
 struct option long_options[] {
   { "dbname", required_argument, 0, 'd' },
@@ -21,23 +38,114 @@ struct option long_options[] {
   { "dbuser", required_argument, 0, 'u' },
   { "min", required_argument, 0, 'm' },
   { "max", required_argument, 0, 'M' },
+  { "copy-batch", required_argument, 0, 'b' },
+  { "flush-interval", required_argument, 0, 'f' },
+  { "cache", required_argument, 0, 'c' },
+  { "rebuild-cache", no_argument, 0, 'r' },
+  { "threads", required_argument, 0, 'j' },
+  { "archive", required_argument, 0, 'a' },
+  { "quiet", no_argument, 0, 'q' },
+  { "metrics", required_argument, 0, 'E' },
+  { "metrics-interval", required_argument, 0, 'I' },
   { 0, 0, 0, 0}
 };
 
-SIDs_Pairs get_known_sid_distances(pqxx::work &txn) {
-  pqxx::result query(txn.exec("SELECT DISTINCT ON (fst, snd) fst, snd FROM bigram_counts_distance;"));
-  std::set<std::pair<unsigned long, unsigned long> > known_sid_pairs;
-  std::for_each(query.begin(), query.end(), [&known_sid_pairs](const pqxx::result::tuple &x) {
-      known_sid_pairs.insert(std::make_pair(x[0].as<unsigned long>(), x[1].as<unsigned long>()));
-    });
-  return known_sid_pairs;
+/*! \brief Pairs already in bigram_counts_distance, by row of sidlist
+ *
+ * The distances are written ordered by fst and snd, so usually all
+ * pairs of a row up to its largest known column are stored and the row
+ * continues behind it. A row can have gaps, e.g. columns of a sid
+ * skipped in an earlier run or rows lost in a failed COPY; its missing
+ * columns are listed and calculated again.
+ */
+struct Known_Pairs {
+  /*! \brief First column to calculate of each row */
+  std::vector<size_t> first;
+  /*! \brief Columns from here on are not known */
+  std::vector<size_t> end;
+  /*! \brief Unknown columns below end of the rows with gaps */
+  std::map<size_t, std::vector<size_t> > missing;
+
+  bool wanted(size_t i, size_t j) const {
+    if(j >= end[i]) return true;
+    auto row(missing.find(i));
+    return row != missing.end() && std::binary_search(row->second.begin(), row->second.end(), j);
+  }
+};
+
+/*! \brief Index of a sid in the ascending sidlist or sidlist.size() */
+static size_t sid_index(const SIDs_Container &sidlist, unsigned long sid) {
+  auto pos(std::lower_bound(sidlist.begin(), sidlist.end(), sid));
+
+  return pos != sidlist.end() && *pos == sid ? pos - sidlist.begin() : sidlist.size();
 }
 
-SIDs_Container get_sids_with_counts(pqxx::connection &conn) {
+/*! \brief Find the known pairs among the sids of this run
+ *
+ * A row without gaps has as many known columns as there are sids up
+ * to its largest one. Only the rows with gaps have their columns
+ * loaded.
+ */
+Known_Pairs get_known_pairs(pqxx::connection &conn, const SIDs_Container &sidlist) {
+  Known_Pairs known;
+  std::ostringstream array;
+  std::vector<unsigned long> gapped;
+  pqxx::work txn(conn, "get_known_pairs");
+
+  for(size_t i = 0; i < sidlist.size(); ++i) {
+    known.first.push_back(i + 1);
+    known.end.push_back(i + 1);
+    array << (i == 0 ? "{" : ",") << sidlist[i];
+  }
+  array << (sidlist.empty() ? "{}" : "}");
+  //Pairs with sids not in this run do not count.
+  txn.exec("CREATE TEMPORARY TABLE current_sids (sid INTEGER PRIMARY KEY) ON COMMIT DROP;");
+  txn.exec("INSERT INTO current_sids SELECT unnest(" + txn.quote(array.str()) + "::INTEGER[]);");
+  pqxx::result ends(txn.exec("SELECT d.fst, count(*), max(d.snd) FROM bigram_counts_distance AS d JOIN current_sids AS c ON c.sid = d.snd GROUP BY d.fst;"));
+  for(const pqxx::result::tuple &r : ends) {
+    size_t i = sid_index(sidlist, r[0].as<unsigned long>());
+    if(i == sidlist.size()) continue;
+    known.end[i] = sid_index(sidlist, r[2].as<unsigned long>()) + 1;
+    known.first[i] = known.end[i];
+    if(r[1].as<size_t>() != known.end[i] - i - 1) gapped.push_back(sidlist[i]);
+  }
+  if(gapped.empty()) return known;
+  std::cout << "Rows with missing pairs: " << gapped.size() << std::endl;
+  array.str("");
+  for(size_t k = 0; k < gapped.size(); ++k) array << (k == 0 ? "{" : ",") << gapped[k];
+  array << '}';
+  std::string query("SELECT d.fst, d.snd FROM bigram_counts_distance AS d JOIN current_sids AS c ON c.sid = d.snd WHERE d.fst = ANY(" + txn.quote(array.str()) + "::INTEGER[]) ORDER BY d.fst, d.snd");
+  pqxx::icursorstream cursor(txn, query, "cursor for known pairs", RESULT_STRIDE);
+  pqxx::result result;
+  size_t row = sidlist.size(), next = 0;
+  //The columns between the known ones of a row are missing.
+  auto finish_row = [&]() {
+    if(row == sidlist.size()) return;
+    std::vector<size_t> &missing(known.missing[row]);
+    for(; next < known.end[row]; ++next) missing.push_back(next);
+    if(!missing.empty()) known.first[row] = missing.front();
+  };
+  while(cursor >> result) {
+    for(auto r : result) {
+      size_t i = sid_index(sidlist, r[0].as<unsigned long>()), j = sid_index(sidlist, r[1].as<unsigned long>());
+      if(i != row) {
+	finish_row();
+	row = i;
+	next = i + 1;
+      }
+      for(; next < j; ++next) known.missing[row].push_back(next);
+      next = j + 1;
+    }
+  }
+  finish_row();
+  return known;
+}
+
+SIDs_Container get_sids_with_data(pqxx::connection &conn) {
   SIDs_Container sidlist;
   auto fun([&sidlist](const pqxx::result::tuple &x) { sidlist.push_back(x["sid"].as<unsigned long>()); });
-  pqxx::work txn(conn, "get_sids_with_counts");
-  pqxx::result query(txn.exec("SELECT DISTINCT ON (sid) sid FROM bigram_counts ORDER BY sid;"));
+  pqxx::work txn(conn, "get_sids_with_data");
+  pqxx::result query(txn.exec("SELECT sid FROM files WHERE data NOTNULL ORDER BY sid;"));
 
   std::cout << "Query returned " << query.size() << " distinct storage ids.\n";
   std::for_each(query.begin(), query.end(), fun);
@@ -45,91 +153,172 @@ SIDs_Container get_sids_with_counts(pqxx::connection &conn) {
 }
 
 
+/*! \brief Length and MD5 of the data of all files
+ *
+ * The database reads the data but only the digests are transferred.
+ */
+Data_Digests get_data_digests(pqxx::connection &conn) {
+  Data_Digests digests;
+  pqxx::work txn(conn, "get_data_digests");
+  pqxx::icursorstream cursor(txn, "SELECT sid, octet_length(data) AS size, md5(data) AS md5 FROM files WHERE data NOTNULL", "cursor for digests", RESULT_STRIDE);
+  pqxx::result result;
 
-SIDs_Pairs get_sids_without_counts(pqxx::connection &conn) {
-  SIDs_Container sidlist;
-  auto fun([&sidlist](const pqxx::result::tuple &x) { sidlist.push_back(x["sid"].as<unsigned long>()); });
-  //auto fun([&sidlist](const pqxx::result::tuple &x) { sidlist.insert(x[0].as<unsigned long>()); });
-  pqxx::work txn(conn, "get_sids_with_counts");
-  pqxx::result query(txn.exec("SELECT DISTINCT ON (sid) sid FROM bigram_counts ORDER BY sid;"));
+  while(cursor >> result) {
+    for(auto row : result) {
+      Data_Digest digest = { row["size"].as<uint64_t>(), row["md5"].as<std::string>() };
+      digests[row["sid"].as<unsigned long>()] = digest;
+    }
+  }
+  return digests;
+}
 
-  std::cout << "Query returned " << query.size() << " distinct storage ids.\n";
-  std::for_each(query.begin(), query.end(), fun);
-  //std::copy(sidlist.begin(), sidlist.end(), std::ostream_iterator<unsigned long>(std::cout, "\t"));
-  //std::cout << std::endl;
-  //
-  std::set<std::pair<unsigned long, unsigned long> > sid_pairs;
-  auto sidlist_end(sidlist.end());
-  for(auto i = sidlist.begin(); i != sidlist_end; ++i) {
-    auto j(i);
-    std::for_each(++j, sidlist_end, [i,&sid_pairs](unsigned long x) {
-	//std::cout << *i << '\t' << x << std::endl;
-	sid_pairs.insert(std::make_pair(*i, x));
-      });
+/*! \brief Whether the cache has a histogram of the data the database has for the sid */
+bool has_current_histogram(const Histogram_Cache &cache, const Data_Digests &digests, unsigned long sid) {
+  size_t idx = cache.find(sid);
+  auto digest(digests.find(sid));
+
+  return idx != cache.size() && digest != digests.end() && cache.is_current(idx, digest->second.size, digest->second.md5);
+}
+
+/*! \brief Calculate the histograms of all files and write the cache
+ *
+ * The bigrams are counted from files.data or, if given, from the
+ * corpus archive, the bigram_counts table is not needed any more.
+ */
+void build_histogram_cache(pqxx::connection &conn, const std::string &fname, const Corpus_Archive *archive) {
+  Bigram_Counter counter;
+  std::unique_ptr<Bigram_Histogram> histo(new Bigram_Histogram);
+  Histogram_Cache_Writer cache(fname);
+
+  if(archive) {
+    for(size_t i = 0; i < archive->size(); ++i) {
+      bigram_histogram(counter, archive->data(i), archive->data_size(i), *histo);
+      cache.add(archive->sid(i), *histo, archive->data(i), archive->data_size(i));
+    }
+    cache.close();
+    std::cout << "Histograms cached: " << cache.size() << std::endl;
+    return;
   }
-  std::cout << "Total number of sid pairs: " << sid_pairs.size() << std::endl;
-  std::set<std::pair<unsigned long, unsigned long> > known_sid_pairs(get_known_sid_distances(txn));
-  std::cout << "Number of known sid pairs: " << known_sid_pairs.size() << std::endl;
-  for(auto i : known_sid_pairs) sid_pairs.erase(i);
-  return sid_pairs;
+  pqxx::work txn(conn, "build_histogram_cache");
+  pqxx::icursorstream cursor(txn, "SELECT sid, data FROM files WHERE data NOTNULL ORDER BY sid", "cursor for histograms", RESULT_STRIDE);
+  pqxx::result result;
+
+  while(cursor >> result) {
+    for(auto row : result) {
+      pqxx::binarystring data(row["data"]);
+      bigram_histogram(counter, data.data(), data.size(), *histo);
+      cache.add(row["sid"].as<unsigned long>(), *histo, data.data(), data.size());
+    }
+  }
+  cache.close();
+  std::cout << "Histograms cached: " << cache.size() << std::endl;
 }
 
-void get_2d_histogram(pqxx::work &txn, unsigned long sid, std::array<double,65536> &histo) {
-  unsigned long maxc = 0;
-  pqxx::result query(txn.exec("SELECT fst,snd,count FROM bigram_counts WHERE sid=" + txn.quote(sid)));
+/*! \brief Map the histogram cache
+ *
+ * The cache is built if it does not exist, can not be read, misses one
+ * of the sids, or has a histogram of data which changed since.
+ */
+std::unique_ptr<Histogram_Cache> open_histogram_cache(pqxx::connection &conn, const std::string &fname, const SIDs_Container &sidlist, const Data_Digests &digests, bool rebuild, const Corpus_Archive *archive) {
+  std::unique_ptr<Histogram_Cache> cache;
 
-  for(const pqxx::result::tuple &r : query) {
-    unsigned long count = r[2].as<unsigned long>();
-    histo.at(r[0].as<unsigned>() * 256 + r[1].as<unsigned>()) = count;
-    //std::cout << r[0].as<unsigned>() << ',' << r[1].as<unsigned>() << '=' << count << '\n';
-    if(count > maxc) maxc = count;
+  if(!rebuild) {
+    try {
+      cache.reset(new Histogram_Cache(fname));
+      for(auto sid : sidlist) {
+	if(cache->find(sid) == cache->size()) {
+	  std::cout << "Histogram cache misses sid " << sid << std::endl;
+	  cache.reset();
+	  break;
+	}
+	if(!has_current_histogram(*cache, digests, sid)) {
+	  std::cout << "Histogram cache is stale for sid " << sid << std::endl;
+	  cache.reset();
+	  break;
+	}
+      }
+    }
+    catch(const std::runtime_error &excp) {
+      std::cout << excp.what() << std::endl;
+      cache.reset();
+    }
   }
-  for(auto &i : histo) i /= maxc;
+  if(!cache) {
+    build_histogram_cache(conn, fname, archive);
+    cache.reset(new Histogram_Cache(fname));
+  }
+  return cache;
 }
 
-double calc_distance(const std::array<double,65536> &left, const std::array<double,65536> right) {
-  std::array<double,65536> temp;
-  std::transform(left.begin(), left.end(), right.begin(), temp.begin(), [](double x, double y) {
-      double d = x - y;
-      return d*d;
-    });
-  return std::sqrt(std::accumulate(temp.begin(), temp.end(), 0.0));
+/*! \brief Remove the sids without a current histogram in the cache
+ *
+ * A rebuilt cache only covers the files it was built from, e.g. a
+ * corpus archive not holding all files of the database or older
+ * versions of some. The distances of these sids are not calculated.
+ *
+ * \return number of removed sids
+ */
+size_t drop_uncached_sids(const Histogram_Cache &cache, const Data_Digests &digests, SIDs_Container &sidlist) {
+  SIDs_Container cached;
+  size_t missing = 0;
+
+  for(auto sid : sidlist) {
+    if(has_current_histogram(cache, digests, sid)) {
+      cached.push_back(sid);
+    } else {
+      if(missing < 16) std::cerr << "No current histogram for sid " << sid << ", skipped" << std::endl;
+      ++missing;
+    }
+  }
+  if(missing > 0) std::cerr << "Sids without current histogram: " << missing << " of " << sidlist.size() << std::endl;
+  sidlist.swap(cached);
+  return missing;
 }
 
+void insert_distance(Bulk_Writer &writer, unsigned long first, unsigned long second, double distance) {
+  Copy_Row row;
 
-void insert_distance(pqxx::work &txn, unsigned long first, unsigned long second, double distance) {
-  txn.exec("INSERT INTO bigram_counts_distance"
-	   " (fst,snd,distance)"
-	   " VALUES(" + txn.quote(first) + ',' + txn.quote(second) + ',' + txn.quote(distance) + ')');
+  row << first << second << distance;
+  writer.write(row);
 }
 
 
-int run(pqxx::connection &conn, unsigned long int min, unsigned long int max) {
- std::array<double,65536> histo1, histo2;
- auto sidlist(get_sids_with_counts(conn));
+int run(const std::string &connection_string, unsigned long int min, unsigned long int max, size_t copy_batch, double flush_interval, const std::string &cache_file, bool rebuild, unsigned int threads, const std::string &archive_file, bool quiet) {
+ Metrics_Counter &pairs(metrics().counter("pairs"));
+ pqxx::connection conn(connection_string);
+ pqxx::connection store_conn(connection_string);
+ Bulk_Writer writer(store_conn, "bigram_counts_distance", { "fst", "snd", "distance" }, copy_batch, flush_interval);
+ auto sidlist(get_sids_with_data(conn));
+ std::unique_ptr<Corpus_Archive> archive;
 
  if(min > 0) sidlist.erase(std::remove_if(sidlist.begin(), sidlist.end(), [min] (unsigned long x) { return x < min; }), sidlist.end());
  if(max > 0) sidlist.erase(std::remove_if(sidlist.begin(), sidlist.end(), [max] (unsigned long x) { return x > max; }), sidlist.end());
- auto sidlist_end(sidlist.end());
- for(auto i = sidlist.begin(); i != sidlist_end; ++i) {
-   auto j(i);
-   try {
-     histo1.fill(0);
-     pqxx::work txn(conn, "sidlist outer loop");
-     get_2d_histogram(txn, *i, histo1);
-     std::for_each(++j, sidlist_end, [i, &txn, &conn, &histo1, &histo2](unsigned long x) {
-	 histo2.fill(0);
-	 get_2d_histogram(txn, x, histo2);
-	 double distance = calc_distance(histo1, histo2);
-	 std::cout << boost::format("Inserting (%08X,%08X) d=%12.6e\n") % *i % x % distance;
-	 insert_distance(txn, *i, x, distance);
-       });
-     txn.commit();
-   }
-   catch(const std::exception &excp) {
-     std::cerr << "Exception: " << excp.what() << std::endl;
-   }
+ if(!archive_file.empty()) archive.reset(new Corpus_Archive(archive_file));
+ std::unique_ptr<Histogram_Cache> cache;
+ Data_Digests digests;
+ {
+   Metrics_Scope scope(metrics().timer("fetch"));
+   digests = get_data_digests(conn);
+   cache = open_histogram_cache(conn, cache_file, sidlist, digests, rebuild, archive.get());
  }
+ drop_uncached_sids(*cache, digests, sidlist);
+ Known_Pairs known(get_known_pairs(conn, sidlist));
+ std::vector<Sparse_Histogram> histos;
+ for(size_t i = 0; i < sidlist.size(); ++i) histos.push_back(cache->histogram(cache->find(sidlist[i])));
+ //A pair is too short to be timed, the stage includes the writes.
+ Metrics_Scope scope(metrics().timer("compare"));
+ bigram_all_pairs(histos, known.first, threads, [&](size_t i, size_t j, double distance) {
+     if(!known.wanted(i, j)) return;
+     try {
+       if(!quiet) std::cout << boost::format("Inserting (%08X,%08X) d=%12.6e\n") % sidlist[i] % sidlist[j] % distance;
+       insert_distance(writer, sidlist[i], sidlist[j], distance);
+       pairs.add();
+     }
+     catch(const std::exception &excp) {
+       std::cerr << "Exception: " << excp.what() << std::endl;
+     }
+   });
+ writer.flush();
  return 0;
 }
 
@@ -142,8 +331,17 @@ int main(int argc, char **argv) {
   int clichar;
   int option_index = 0;
   int retval = -1;
-  int min = -1;
-  int max = -1;
+  int min = 0;
+  int max = 0;
+  std::string cache_file(HISTOGRAM_CACHE_FILE);
+  bool rebuild = false;
+  unsigned int threads = 0;
+  std::string archive_file;
+  bool quiet = false;
+  std::string metrics_file;
+  double metrics_interval = 10;
+  size_t copy_batch = BULK_WRITER_BATCH;
+  double flush_interval = BULK_WRITER_FLUSH;
   
   if(std::getenv("SIDDB")) dbname = std::getenv("SIDDB");
   if(std::getenv("SIDUSER")) dbname = std::getenv("SIDUSER");
@@ -173,6 +371,41 @@ int main(int argc, char **argv) {
     case 'M':
       max = std::atoi(optarg);
       break;
+    case 'b':
+      if(std::atoi(optarg) < 0) {
+	std::cerr << "--copy-batch must not be negative\n";
+	return 1;
+      }
+      copy_batch = std::atoi(optarg);
+      break;
+    case 'f':
+      flush_interval = std::atof(optarg);
+      break;
+    case 'c':
+      cache_file = optarg;
+      break;
+    case 'r':
+      rebuild = true;
+      break;
+    case 'j':
+      if(std::atoi(optarg) < 0) {
+	std::cerr << "--threads must not be negative\n";
+	return 1;
+      }
+      threads = std::atoi(optarg);
+      break;
+    case 'a':
+      archive_file = optarg;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'E':
+      metrics_file = optarg;
+      break;
+    case 'I':
+      metrics_interval = std::atof(optarg);
+      break;
     default:
       std::cerr << "Unknow getopt return code " << clichar << std::endl;
       return -1;
@@ -182,8 +415,8 @@ int main(int argc, char **argv) {
     connection_string << "dbname=" << dbname << " user=" << dbuser;
     if(!dbhost.empty()) connection_string << " host=" << dbhost;
     if(dbpass.size() > 0) connection_string << " password=" << dbpass;
-    pqxx::connection conn(connection_string.str());
-    retval = run(conn, min, max);
+    Metrics_Exporter exporter(metrics_file, "calc_bigram_distances", metrics_interval);
+    retval = run(connection_string.str(), min, max, copy_batch, flush_interval, cache_file, rebuild, threads, archive_file, quiet);
   }
   catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
@@ -1,7 +1,7 @@
 #include <algorithm>
 #include <iostream>
 #include <boost/format.hpp>
-#include <pqxx/pqxx>
+#include <memory>
 #include <set>
 #include <vector>
 #include <sstream>
@@ -12,150 +12,210 @@
 #include <stdexcept>
 #include "calculate_bitshred.cmdline.h"
 #include "bitshred.hh"
-#include "hash.hh"
+#include "shred.hh"
+#include "pipeline.hh"
+#include "storage.hh"
+#include "metrics.hh"
 
 #define CALC_STRIDE 839
+#define STORE_BATCH 97
 
-typedef std::map<unsigned long, pqxx::binarystring> Sid2Data;
+typedef std::vector<Bitshred_Config> Config_List;
 
-/*! \brief Get sids without calculated bitshreds
+/*! \brief Configurations sharing the same n-gram hashes
  *
- * This function gets all (up to maxs) SIDs with date which do not
- * have any bitshred with the correct parameters attaced.
+ * All configurations with the same hash and n only differ in m, so the
+ * n-gram hashes are calculated once for all of them.
+ */
+struct Shred_Group {
+  unsigned int n;
+  std::string hash;
+  Bitshred_Function shred;
+  Ngram_Hash_Function ngram_hashes;
+  std::vector<size_t> configs;
+};
+
+/*! \brief Calculated bitshreds of a SID, with the index of the configuration
  *
- * \param conn postgresql connection
- * \param maxs maximum sids (0 = unlimited)
- * \param m bitshred size in bits
- * \param n n-gram selection
- * \param hash hash name
- * \return Map with sid to binary data mappings
+ * Configurations which could not be calculated are in failures with
+ * the reason.
  */
-Sid2Data get_sids_without(pqxx::connection &conn, unsigned int maxs, unsigned int m, unsigned int n, const std::string &hash) {
-  Sid2Data sids;
-  pqxx::work txn(conn, "get sids");
-  std::ostringstream query;
-
-  query << "SELECT sid,data FROM files WHERE sid NOT IN"
-	<< " (SELECT sid FROM bitshred WHERE"
-	<< " m = " << txn.quote(m)
-	<< " AND n = " << txn.quote(n)
-	<< " AND hash = " << txn.quote(hash)
-	<< ") AND data NOTNULL";
-  if(maxs > 0) {
-    query << " LIMIT " << maxs;
-  }
-  //std::cout << query.str() << std::endl;
-  pqxx::result result(txn.exec(query.str()));
-  for(auto row : result) {
-    pqxx::binarystring binstr(row["data"]);
-    unsigned long sid = row["sid"].as<unsigned long>();
-    sids.emplace(sid, binstr);
-  }
-  return sids;
+struct Sid_Shreds {
+  unsigned long sid;
+  size_t size;
+  std::vector<std::pair<size_t, BitshredType> > shreds;
+  std::vector<std::pair<size_t, std::string> > failures;
+};
+
+BitshredType calculate_bitshred(const uint8_t *data, size_t size, unsigned int m, unsigned int n, Bitshred_Function shred) {
+  if(size < n) throw std::invalid_argument("not enough bytes for bitshred");
+  return shred(data, size, m, n);
 }
 
 
-BitshredType calculate_bitshred(const pqxx::binarystring &data, unsigned int m, unsigned int n, const std::function<uint32_t(const uint8_t *, size_t)> &hashfun) {
-  BitshredType bitshred(m);
-  pqxx::binarystring::const_iterator dbegin(data.begin());
-  pqxx::binarystring::const_iterator dend(data.end());
+unsigned store_bitshred(Fingerprint_Writer &writer, unsigned long sid, size_t kind, const BitshredType &bitshred) {
+  writer.write(sid, kind, bitshred.data(), bitshred.byte_size());
+  return bitshred.count();
+}
 
-  assert(std::distance(dbegin, dend) >= 0);
-  if(static_cast<size_t>(std::distance(dbegin, dend)) < n) throw std::invalid_argument("not enough bytes for bitshred");
-  for(auto ptr = dbegin; ptr < dend - n; ++ptr) {
-    uint32_t hash = hashfun(&ptr[0], n);
-    bitshred[hash % m] = 1;
+/*! \brief Group the configurations by hash and n
+ */
+std::vector<Shred_Group> group_configs(const Config_List &configs) {
+  std::vector<Shred_Group> groups;
+
+  for(size_t i = 0; i < configs.size(); ++i) {
+    auto group = std::find_if(groups.begin(), groups.end(), [&](const Shred_Group &x) { return x.n == configs[i].n && x.hash == configs[i].hash; });
+    if(group == groups.end()) {
+      Shred_Group newgroup = { configs[i].n, configs[i].hash, bitshred_function(configs[i].hash), ngram_hash_function(configs[i].hash), std::vector<size_t>() };
+      groups.push_back(newgroup);
+      group = groups.end() - 1;
+    }
+    group->configs.push_back(i);
   }
-  return bitshred;
+  return groups;
 }
 
-
-std::ostream &operator<<(std::ostream &out, const BitshredType &bitshred) {
-  for(auto i : bitshred) out << (i ? '1' : '0');
-  return out;
+/*! \brief Calculate all missing bitshreds of a single SID
+ *
+ * \param job SID with data and missing configurations in the order of configs
+ * \param configs bitshred configurations
+ * \param groups configurations grouped by group_configs()
+ * \return calculated bitshreds
+ */
+Sid_Shreds calculate_sid_bitshreds(const Sid_Data &job, const Config_List &configs, const std::vector<Shred_Group> &groups) {
+  Sid_Shreds result = { job.sid, job.size(), std::vector<std::pair<size_t, BitshredType> >(), std::vector<std::pair<size_t, std::string> >() };
+  const uint8_t *data = job.bytes();
+  std::vector<uint32_t> hashes;
+  std::vector<size_t> todo;
+
+  for(auto &group : groups) {
+    todo.clear();
+    for(size_t i : group.configs) {
+      if(job.missing[i]) todo.push_back(i);
+    }
+    if(todo.empty()) continue;
+    try {
+      if(job.size() < group.n) throw std::invalid_argument("not enough bytes for bitshred");
+      if(todo.size() > 1) group.ngram_hashes(data, job.size(), group.n, hashes);
+      for(size_t i : todo) {
+	const Bitshred_Config &config(configs[i]);
+	if(todo.size() > 1) {
+	  result.shreds.push_back(std::make_pair(i, bitshred_from_hashes(hashes, config.m)));
+	} else {
+	  result.shreds.push_back(std::make_pair(i, calculate_bitshred(data, job.size(), config.m, config.n, group.shred)));
+	}
+      }
+    }
+    catch(const std::exception &excp) {
+      for(size_t i : todo) result.failures.push_back(std::make_pair(i, std::string(excp.what())));
+    }
+  }
+  return result;
 }
 
-unsigned store_bitshred(pqxx::work &txn, unsigned long sid, unsigned int m, unsigned int n, const std::string &hashname, const BitshredType &bitshred) {
-  unsigned int bits = 0;
-  std::ostringstream query;
-  std::ostringstream shred;
-  std::string binstr;
-  char buf[4];
-
-  for(unsigned int i = 0; i < bitshred.size(); i += 8) {
-    unsigned val = (bitshred[i] ? 128 : 0   )
-      		 | (bitshred[i + 1] ? 64 : 0)
-      		 | (bitshred[i + 2] ? 32 : 0)
-      		 | (bitshred[i + 3] ? 16 : 0)
-      		 | (bitshred[i + 4] ?  8 : 0)
-      		 | (bitshred[i + 5] ?  4 : 0)
-      		 | (bitshred[i + 6] ?  2 : 0)
-      		 | (bitshred[i + 7] ?  1 : 0);
-    sprintf(buf, "%02X", val);
-    binstr += buf;
+/*! \brief Store a batch of calculated bitshreds
+ *
+ * The failures are recorded by the writer, so they are skipped in
+ * future scans. Without quiet a line is printed for every SID.
+ */
+void store_bitshreds(Fingerprint_Writer &writer, const std::vector<Sid_Shreds> &batch, const Config_List &configs, bool quiet) {
+  static Metrics_Counter &stored(metrics().counter("fingerprints"));
+  static Metrics_Counter &failed(metrics().counter("failures"));
+
+  for(auto &i : batch) {
+    if(!quiet) std::cout << boost::format("$%04X size=$%04x") % i.sid % i.size;
+    for(auto &shred : i.shreds) {
+      const Bitshred_Config &config(configs[shred.first]);
+      unsigned int bits = store_bitshred(writer, i.sid, shred.first, shred.second);
+      if(!quiet) std::cout << boost::format(" %u/%u/%s bits=$%04x %13.6e") % config.m % config.n % config.hash % bits % (static_cast<double>(bits) / shred.second.size());
+    }
+    for(auto &failure : i.failures) {
+      const Bitshred_Config &config(configs[failure.first]);
+      writer.failed(i.sid, failure.first, failure.second);
+      if(!quiet) std::cout << boost::format(" %u/%u/%s failed: %s") % config.m % config.n % config.hash % failure.second;
+    }
+    if(!quiet) std::cout << '\n';
+    stored.add(i.shreds.size());
+    failed.add(i.failures.size());
+    writer.done(i.sid);
   }
-  query << "INSERT INTO bitshred (sid, m, n, hash, bitshred) VALUES ("
-	<< txn.quote(sid) << ", "
-	<< txn.quote(m) << ", "
-	<< txn.quote(n) << ", "
-	<< txn.quote(hashname) << ", "
-	<< "decode(" << txn.quote(binstr) << ", 'hex') );";
-  //std::cout << query.str() << std::endl;
-  txn.exec(query.str());
-  bits = std::count(bitshred.begin(), bitshred.end(), 1);
-  return bits;
+  if(!quiet) std::cout << std::flush;
+  writer.checkpoint();
 }
 
-unsigned long calculate_all_bitshreds(pqxx::connection &conn, unsigned int m, unsigned int n, const std::string &hash) {
-  unsigned long sids_got;
-  unsigned int bits;
-  unsigned long total = 0;
-  static std::map<std::string, std::function<uint32_t(const uint8_t *, size_t)> > hash_functions {
-    { "jenkins", &jenkins_one_at_a_time_hash },
-    { "djb2", &djb2_hash },
-    { "djb2xor", &djb2xor_hash },
-    { "sbox", &sbox_hash}
-  };
-
-  if(hash_functions.find(hash) == hash_functions.end()) {
-    //Count not find the selected hash.
-    bool first = true;
-    std::ostringstream error;
-    for(auto &i : hash_functions) {
-      if(first) {
-	error << "unknown hash, valid are: " << i.first;
-	first = false;
-      } else {
-	error << ", " << i.first;
+/*! \brief Calculate all missing bitshreds
+ *
+ * A fetch thread reads the SIDs without bitshreds, the pool shreds
+ * them and the calling thread stores them. The scan starts at the
+ * position stored for the configurations.
+ *
+ * \param storage database or local directory
+ * \param configs bitshred configurations
+ * \param pipeline threads and queue sizes
+ * \param copy_batch rows per COPY
+ * \param flush_interval seconds after which a COPY is committed
+ * \param rescan start at the first SID and retry failed SIDs
+ * \param quiet do not print the bitshreds of every SID
+ * \return number of SIDs calculated
+ */
+unsigned long calculate_all_bitshreds(Sid_Storage &storage, const Config_List &configs, const Pipeline_Config &pipeline, size_t copy_batch, double flush_interval, bool rescan, bool quiet) {
+  std::vector<Shred_Group> groups(group_configs(configs));
+  std::vector<std::string> kinds;
+  unsigned long total;
+
+  for(auto &config : configs) kinds.push_back(bitshred_kind(config.m, config.n, config.hash));
+  std::unique_ptr<Fingerprint_Writer> writer(storage.writer(kinds, copy_batch, flush_interval, rescan));
+  unsigned long start = writer->start();
+  total = run_pipeline<Sid_Data, Sid_Shreds>(pipeline,
+    [&](const std::function<bool(Sid_Data &&)> &emit) {
+      std::unique_ptr<File_Source> source(storage.files_without(kinds, 0));
+      unsigned long after = start;
+      for(;;) {
+	auto jobs(source->next(after, CALC_STRIDE));
+	if(jobs.empty()) break;
+	after = jobs.back().sid;
+	for(auto &job : jobs) {
+	  writer->issue(job.sid);
+	  if(!emit(std::move(job))) return;
+	}
       }
-    }
-    throw std::runtime_error(error.str());
-  }
-  auto hash_function = hash_functions.at(hash);
-
-  do {
-    auto siddata(get_sids_without(conn, CALC_STRIDE, m, n, hash));
-    pqxx::work txn(conn, "store bitshred");
-    sids_got = siddata.size();
-    //std::cout << sids_got << std::endl;
-    total += sids_got;
-    for(auto const &i : siddata) {
-      std::cout << boost::format("$%04X ") % i.first;
-      BitshredType bitshred(calculate_bitshred(i.second, m, n, hash_function));
-      bits = store_bitshred(txn, i.first, m, n, hash, bitshred);
-      std::cout << boost::format("size=$%04x bits=$%04x %13.6e") % i.second.size() % bits % (static_cast<double>(bits) / bitshred.size());
-      std::cout << std::endl;
-    }
-    txn.commit();
-  } while(sids_got > 0);
+    },
+    [&](const Sid_Data &job) { return calculate_sid_bitshreds(job, configs, groups); },
+    [&](const std::vector<Sid_Shreds> &batch) { store_bitshreds(*writer, batch, configs, quiet); });
+  writer->flush();
   return total;
 }
 
 
-int run(pqxx::connection &conn, const gengetopt_args_info &args) {
+/*! \brief Collect the configurations from the command line
+ *
+ * The single configuration of -m, -n, and -h and all --config
+ * arguments are used.
+ */
+Config_List get_configs(const gengetopt_args_info &args) {
+  Config_List configs;
+
+  if(args.size_given || args.ngram_given || args.hash_given) {
+    if(!(args.size_given && args.ngram_given && args.hash_given)) throw std::invalid_argument("size, ngram, and hash have to be given together");
+    //The same range checks as for --config.
+    configs.push_back(parse_bitshred_config(std::to_string(args.size_arg) + ':' + std::to_string(args.ngram_arg) + ':' + args.hash_arg));
+  }
+  for(unsigned int i = 0; i < args.config_given; ++i) configs.push_back(parse_bitshred_config(args.config_arg[i]));
+  if(configs.empty()) throw std::invalid_argument("no bitshred configuration given");
+  return configs;
+}
+
+
+int run(const std::string &connection_string, const gengetopt_args_info &args) {
   unsigned long total;
   try {
-    total = calculate_all_bitshreds(conn, args.size_arg, args.ngram_arg, args.hash_arg);
+    if(args.threads_arg < 0) throw std::invalid_argument("--threads must not be negative");
+    if(args.copy_batch_arg < 0) throw std::invalid_argument("--copy-batch must not be negative");
+    Pipeline_Config pipeline = { static_cast<unsigned int>(args.threads_arg), 0, STORE_BATCH };
+    pipeline.queue_size = 4 * (args.threads_arg > 0 ? args.threads_arg : std::thread::hardware_concurrency()) + 1;
+    Metrics_Exporter exporter(args.metrics_given ? args.metrics_arg : "", "calculate_bitshred", args.metrics_interval_arg);
+    std::unique_ptr<Sid_Storage> storage(open_storage(connection_string, args.local_given ? args.local_arg : NULL));
+    total = calculate_all_bitshreds(*storage, get_configs(args), pipeline, args.copy_batch_arg, args.flush_interval_arg, args.rescan_flag, args.quiet_flag);
     std::cout << "SIDs calculated: " << total << std::endl;
   }
   catch(const std::exception &excp) {
@@ -180,8 +240,7 @@ int main(int argc, char **argv) {
     connection_string << "dbname=" << args.dbname_arg << " user=" << args.dbuser_arg;
     if(args.dbhost_given) connection_string << " host=" << args.dbhost_arg;
     if(args.dbpass_given) connection_string << " password=" << args.dbpass_arg;
-    pqxx::connection conn(connection_string.str());
-    retval = run(conn, args);
+    retval = run(connection_string.str(), args);
   }
   catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
@@ -1,7 +1,7 @@
 #include <algorithm>
 #include <iostream>
 #include <boost/format.hpp>
-#include <pqxx/pqxx>
+#include <map>
 #include <set>
 #include <vector>
 #include <sstream>
@@ -13,9 +13,20 @@
 #include <tlsh.h>
 #include <fuzzy.h>
 #include <boost/lexical_cast.hpp>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include "calculate_fuzzy_hash.cmdline.h"
+#include "pipeline.hh"
+#include "storage.hh"
+#include "tlsh_index.hh"
+#include "ssdeep_ngrams.hh"
+#include "sid_list.hh"
+#include "topk.hh"
+#include "metrics.hh"
 
 #define RESULT_STRIDE 23
+#define STORE_BATCH 97
 #ifndef MIN_DATA_LENGTH
 #define MIN_DATA_LENGTH 256
 #endif
@@ -28,7 +39,107 @@ protected:
     bool operator<(const Comp_Res &other) const { return difference < other.difference; }
   };
   typedef std::vector<Comp_Res> ComRes_List;
-  virtual ComRes_List calc_differences(pqxx::work &txn, unsigned int sid) = 0;
+  /*! \brief Offer the differences to a SID to the selector
+   *
+   * Hashes with an index may skip everything above the threshold of
+   * the selector.
+   */
+  virtual void calc_differences(Sid_Storage &storage, unsigned int sid, Distance_Selector &selector) = 0;
+  /*! \brief The selected SIDs, sorted by difference */
+  static ComRes_List selected(Distance_Selector &selector) {
+    static Metrics_Timer &timer(metrics().timer("select"));
+    Metrics_Scope scope(timer);
+    ComRes_List differences;
+
+    for(auto &i : selector.take()) differences.push_back({i.first, i.second});
+    return differences;
+  }
+  /*! \brief The k closest SIDs, sorted by difference */
+  virtual ComRes_List calc_closest(Sid_Storage &storage, unsigned int sid, size_t k) {
+    static Metrics_Timer &timer(metrics().timer("compare"));
+    Distance_Selector selector(Distance_Selector::top(k));
+
+    {
+      Metrics_Scope scope(timer);
+      calc_differences(storage, sid, selector);
+    }
+    return selected(selector);
+  }
+  /*! \brief The k closest SIDs for many queries
+   *
+   * A query which fails is reported and gets an empty list.
+   *
+   * \param threads number of threads for hashes which can answer
+   * queries in parallel, 0 = number of cores
+   */
+  virtual std::vector<ComRes_List> calc_closest_many(Sid_Storage &storage, const std::vector<unsigned int> &sids, size_t k, unsigned int) {
+    std::vector<ComRes_List> results(sids.size());
+    for(size_t i = 0; i < sids.size(); ++i) {
+      try {
+	results[i] = calc_closest(storage, sids[i], k);
+      }
+      catch(const std::exception &excp) {
+	std::cerr << "SID " << sids[i] << ": " << excp.what() << std::endl;
+      }
+    }
+    return results;
+  }
+
+  /*! \brief Calculated hash of a SID, or the reason why it failed */
+  struct Hash_Result {
+    unsigned long sid;
+    size_t size;
+    std::string hash;
+    std::string error;
+  };
+
+  /*! \brief Fingerprint kind of the hashes, the name of their table */
+  virtual const char *kind() const = 0;
+  /*! \brief Minimum size of the files to hash */
+  virtual size_t min_size() const { return 0; }
+  /*! \brief Calculate the hash, called in the hashing threads
+   *
+   * \return hash as printable string
+   */
+  virtual std::string hash_data(const uint8_t *data, size_t size) const = 0;
+  /*! \brief Stored value of a hash returned by hash_data() */
+  virtual std::string value(const std::string &hash) const = 0;
+
+  /*! \brief Store a batch of hashes
+   *
+   * The failures are recorded by the writer, so they are skipped in
+   * future scans. Without quiet the hash of every SID is printed.
+   */
+  void store_hashes(Fingerprint_Writer &writer, const std::vector<Hash_Result> &batch, bool quiet) {
+    static Metrics_Counter &hashed(metrics().counter("fingerprints"));
+    static Metrics_Counter &failed(metrics().counter("failures"));
+
+    for(auto &i : batch) {
+      std::string error(i.error);
+      std::string stored;
+      if(!quiet) std::cout << boost::format("$%06lx $%04lX\n") % i.sid % i.size;
+      if(error.empty()) {
+	try {
+	  stored = value(i.hash);
+	}
+	catch(const std::exception &excp) {
+	  error = excp.what();
+	}
+      }
+      if(error.empty()) {
+	writer.write(i.sid, 0, reinterpret_cast<const uint8_t *>(stored.data()), stored.size());
+	if(!quiet) std::cout << '\t' << i.hash << '\n';
+	hashed.add();
+      } else {
+	if(!quiet) std::cout << "\tfailed: " << error << '\n';
+	writer.failed(i.sid, 0, error);
+	failed.add();
+      }
+      writer.done(i.sid);
+    }
+    if(!quiet) std::cout << std::flush;
+    writer.checkpoint();
+  }
 
 public:
   /*! \brief List of SID ids
@@ -40,31 +151,70 @@ public:
   /*! \brief All missing hashes are calculated
    *
    * This function has to calculate all the missing hashes in the
-   * database. It is always called.
+   * storage. It is always called. A fetch thread reads the SIDs
+   * without a hash, the pool hashes them and the calling thread
+   * stores them. The scan starts at the position stored for the
+   * kind. Afterwards the index of the hashes, if any, is updated.
    *
-   * \param conn database connection object
+   * \param storage database or local directory
+   * \param pipeline threads and queue sizes
+   * \param copy_batch rows per COPY
+   * \param flush_interval seconds after which a COPY is committed
+   * \param rescan start at the first SID and retry failed SIDs
+   * \param quiet do not print the hash of every SID
    * \return number of actually calculated hashes
    */
-  virtual unsigned long calculate_missing_hashes(pqxx::connection &conn) = 0;
+  virtual unsigned long calculate_missing_hashes(Sid_Storage &storage, const Pipeline_Config &pipeline, size_t copy_batch, double flush_interval, bool rescan, bool quiet) {
+    std::vector<std::string> kinds(1, kind());
+    std::unique_ptr<Fingerprint_Writer> writer(storage.writer(kinds, copy_batch, flush_interval, rescan));
+    unsigned long start = writer->start();
+    unsigned long total;
+
+    total = run_pipeline<Sid_Data, Hash_Result>(pipeline,
+      [&](const std::function<bool(Sid_Data &&)> &emit) {
+	std::unique_ptr<File_Source> source(storage.files_without(kinds, min_size()));
+	unsigned long after = start;
+	for(;;) {
+	  auto jobs(source->next(after, RESULT_STRIDE));
+	  if(jobs.empty()) break;
+	  after = jobs.back().sid;
+	  for(auto &job : jobs) {
+	    writer->issue(job.sid);
+	    if(!emit(std::move(job))) return;
+	  }
+	}
+      },
+      [this](const Sid_Data &job) {
+	Hash_Result result = { job.sid, job.size(), std::string(), std::string() };
+	try {
+	  result.hash = hash_data(job.bytes(), job.size());
+	}
+	catch(const std::exception &excp) {
+	  result.error = excp.what();
+	}
+	return result;
+      },
+      [&](const std::vector<Hash_Result> &batch) { store_hashes(*writer, batch, quiet); });
+    writer->flush();
+    storage.update_index(kind(), copy_batch, flush_interval);
+    return total;
+  }
 
   /*! \brief Find similar SID files.
    *
    * Similar SID are found used the fuzzy hash in this class. The
-   * maximum number is given by args.maximum_dist_arg.
+   * maximum number is given by args.maximum_dist_arg. All queries are
+   * answered before the output starts.
    *
-   * \param txn transaction object
+   * \param storage database or local directory
    * \param sids list of SIDs to find similar songs to
    * \param args CLI arguments
    */
-  virtual void find_similarities(pqxx::work &txn, const SID_List_Type &sids, const gengetopt_args_info &args) {
-    for(unsigned int sid : sids) {
-      std::cout << "\v\tFinding closest to sid: " << sid << std::endl;
-      ComRes_List differences(calc_differences(txn, sid));
-      std::sort(differences.begin(), differences.end());
-      if(differences.size() > static_cast<unsigned int>(args.maximum_dist_arg)) {
-	differences.resize(args.maximum_dist_arg);
-      }
-      output_differences(txn, differences);
+  virtual void find_similarities(Sid_Storage &storage, const SID_List_Type &sids, const gengetopt_args_info &args) {
+    std::vector<ComRes_List> results(calc_closest_many(storage, sids, std::max(args.maximum_dist_arg, 0), std::max(args.threads_arg, 0)));
+    for(size_t i = 0; i < sids.size(); ++i) {
+      std::cout << "\v\tFinding closest to sid: " << sids[i] << std::endl;
+      output_differences(storage, results[i]);
     }
   }
 
@@ -72,20 +222,23 @@ public:
    *
    * Output the found SIDs with difference measure to stdout.
    *
-   * \param txn database transaction object
+   * \param storage database or local directory
    * \param differences List of SIDs, type is SID_List_Type
    */
-  virtual void output_differences(pqxx::work &txn, const ComRes_List &differences) {
-    pqxx::result result;
-    
+  virtual void output_differences(Sid_Storage &storage, const ComRes_List &differences) {
+    std::vector<unsigned int> sids;
+    std::map<unsigned int, Sid_Entry> entries;
+
+    for(auto i : differences) sids.push_back(i.sid);
+    for(auto &entry : storage.entries(sids)) entries[entry.sid] = entry;
     for(auto i : differences) {
-      result = txn.exec((boost::format("SELECT sid,name,author,released,filename,length(data) FROM songs NATURAL JOIN files WHERE sid = %u") % i.sid).str(), "natural join");
+      const Sid_Entry &entry(entries[i.sid]);
       std::cout << boost::format("%5u %8.3e %32s %32s %32s %s\n")
 	% i.sid % i.difference
-	% result[0]["name"]
-	% result[0]["author"]
-	% result[0]["released"]
-	% result[0]["filename"]
+	% entry.name
+	% entry.author
+	% entry.released
+	% entry.filename
 	;
     }
   }
@@ -100,181 +253,131 @@ public:
 
 class SSDeep : public Fuzzy_Interface {
 protected:
-  std::pair<unsigned int, std::string> calculate_hash(const uint8_t *buf, unsigned long size) {
+  const char *kind() const { return SSDEEP_KIND; }
+
+  std::string hash_data(const uint8_t *buf, size_t size) const {
     char hbuf[FUZZY_MAX_RESULT + 1];
-    std::string hash_string;
-    std::string hash;
-    unsigned int blocksize;
-    
+
     if(fuzzy_hash_buf(buf, size, hbuf) != 0) {
       throw std::runtime_error("fuzzy hashing (ssdeep) failed");
     }
-    hash_string = hbuf;
-    hash = hash_string.substr(hash_string.find(':') + 1);
-    hbuf[hash_string.find(':')] = '\0';
-    std::istringstream lexical(hbuf);
-    if(!(lexical >> blocksize)) throw std::runtime_error("blocksize extraction from ssdeep failed");
-    return std::make_pair(blocksize, hash);
+    return hbuf;
   }
-  std::string retrieve_hash(pqxx::work &txn, unsigned int sid) {
-    std::ostringstream query, hs;
-    std::string hash;
- 
-    query << "SELECT blocksize, hash FROM fuzzy_ssdeep WHERE"
-	  << " sid = " << sid
-	  << ";";
-    pqxx::result result(txn.exec(query.str()));
-    if(result.empty()) throw std::runtime_error("can not retrieve hash");
-    hs << result[0]["blocksize"].as<unsigned int>()
-       << ':'
-       << result[0]["hash"].as<std::string>();
-    hash = hs.str();
+
+  std::string retrieve_hash(Sid_Storage &storage, unsigned int sid) {
+    auto values(storage.get(kind(), { sid }));
+    if(values.empty()) throw std::runtime_error("can not retrieve hash");
+    std::string hash(values[0].second);
     assert(hash.size() <= FUZZY_MAX_RESULT);
     return hash;
   }
 
-  void insert(pqxx::work &txn, unsigned int sid, unsigned int blocksize, const std::string &hash) {
-    std::ostringstream query;
-    query << "INSERT INTO fuzzy_ssdeep (sid, blocksize, hash) VALUES ("
-	  << sid << ','
-	  << blocksize << ','
-	  << txn.quote(hash)
-	  << ");";
-    txn.exec(query.str());
+  /*! \brief The hash given as blocksize:hash is stored as it is */
+  std::string value(const std::string &hash_string) const {
+    split_ssdeep_hash(hash_string);
+    return hash_string;
   }
 
 public:
-  virtual unsigned long calculate_missing_hashes(pqxx::connection &conn) {
-    std::ostringstream query;
-    pqxx::result result;
-    unsigned long count = 0;
-
-    query << "SELECT sid, data, length(data) FROM files WHERE sid NOT IN"
-	  << " (SELECT sid FROM fuzzy_ssdeep) AND data NOTNULL"
-	  << " LIMIT " << RESULT_STRIDE
-	  << ';';
-    do {
-      //Cursor needs nested transactions!?
-      //pqxx::icursorstream cursor(txn, query.str(), "cursor for TLSH", RESULT_STRIDE);
-      pqxx::work txn(conn, "calculate ssdeep hashes");
-      result = txn.exec(query.str());
-      for(auto row : result) {
-	unsigned long dsize = row[2].as<unsigned long>();
-	unsigned long sid = row[0].as<unsigned long>();
-	std::cout << boost::format("$%06lx $%04lX\n") % sid % dsize;
-	pqxx::binarystring binstr(row["data"]);
-	std::pair<unsigned int, std::string> hash(calculate_hash(binstr.data(), binstr.size()));
-	std::cout << '\t' << hash.first << "⁚" << hash.second << std::endl;
-	insert(txn, sid, hash.first, hash.second);
-      }
-      txn.commit();
-      ++count;
-    } while(!result.empty());
-    return count - 1;
-  }
+  /*! \brief Differences to the hashes sharing an n-gram key
+   *
+   * All other hashes have the difference 100 and are not offered.
+   */
+  void calc_differences(Sid_Storage &storage, unsigned int sid, Distance_Selector &selector) {
+    std::string left(retrieve_hash(storage, sid));
+    Ssdeep_Hash hash(split_ssdeep_hash(left));
+    std::vector<int64_t> keys(ssdeep_ngram_keys(hash.blocksize, hash.signatures));
 
-  ComRes_List calc_differences(pqxx::work &txn, unsigned int sid) {
-    pqxx::result result;
-    ComRes_List distvec;
-    std::ostringstream query;
-    double diff;
- 
-    std::string left(retrieve_hash(txn, sid));
-    query << "SELECT sid, blocksize, hash FROM fuzzy_ssdeep;";
-    pqxx::icursorstream cursor(txn, query.str(), "cursor for ssdeep", RESULT_STRIDE);
-    while(cursor >> result) {
-      for(auto row : result) {
-	unsigned int rsid = row["sid"].as<unsigned int>();
-	unsigned int rblocksize = row["blocksize"].as<unsigned int>();
-	std::string  rhash(row["hash"].c_str());
-	{
-	  std::ostringstream right;
-	  right << rblocksize << ':' << rhash;
-	  diff = 100 - fuzzy_compare(left.c_str(), right.str().c_str());
-	}
-	distvec.push_back({rsid, diff});
-      }
-    }
-    return distvec;
+    storage.scan_ssdeep_candidates(left, keys, [&](unsigned int rsid, const uint8_t *data, size_t size) {
+	std::string right(reinterpret_cast<const char *>(data), size);
+	selector.add(rsid, 100 - fuzzy_compare(left.c_str(), right.c_str()));
+      });
   }
 };
 
 
 class TLSH : public Fuzzy_Interface {
-  std::string hash;
+  std::unique_ptr<Tlsh_Index> index;
+
+  /*! \brief Load all digests on first use
+   *
+   * The index stays resident for all further queries.
+   */
+  const Tlsh_Index &get_index(Sid_Storage &storage) {
+    if(!index) {
+      Metrics_Scope scope(metrics().timer("fetch"));
+      std::unique_ptr<Tlsh_Index> loaded(new Tlsh_Index);
+      storage.scan(kind(), [&loaded](unsigned int sid, const uint8_t *data, size_t size) { loaded->add(sid, tlsh_decode(data, size)); });
+      loaded->finish();
+      index = std::move(loaded);
+    }
+    return *index;
+  }
+
+  const Tlsh_Digest &get_digest(Sid_Storage &storage, unsigned int sid) {
+    const Tlsh_Digest *digest = get_index(storage).find(sid);
+    if(!digest) throw std::runtime_error((boost::format("no TLSH hash for sid %u") % sid).str());
+    return *digest;
+  }
+
 protected:
-  std::string calculate_tlsh(const pqxx::binarystring &binstr) {
+  const char *kind() const { return TLSH_KIND; }
+
+  size_t min_size() const { return MIN_DATA_LENGTH; }
+
+  std::string hash_data(const uint8_t *data, size_t size) const {
     Tlsh tlsh;
-    tlsh.final(binstr.data(), binstr.size());
+    tlsh.final(data, size);
     std::string hash(tlsh.getHash());
     if(hash.empty()) throw std::invalid_argument("empty TLSH hash");
     return hash;
   }
 
-  void insert_tlsh(pqxx::work &txn, unsigned long sid, const std::string &hash) {
-    std::ostringstream query;
-    
-    query << "INSERT INTO fuzzy_tlsh (sid, hash) VALUES ("
-	  << sid << ','
-	  << "decode(" << txn.quote(hash) << ", 'hex')"
-	  << ");";
-    txn.exec(query.str());
-  }
-  
-public:
-  ComRes_List calc_differences(pqxx::work &txn, unsigned int sid) {
-    pqxx::result result;
-    Tlsh left, right;
-    ComRes_List distvec;
-
-    result = txn.exec((boost::format("SELECT encode(hash, 'hex') AS h FROM fuzzy_tlsh WHERE sid = %u;") % sid).str());
-    left.fromTlshStr(result[0]["h"].c_str());
-    pqxx::icursorstream cursor(txn, "SELECT sid, encode(hash, 'hex') AS h FROM fuzzy_tlsh", "cursor for TLSH", RESULT_STRIDE);
-    while(cursor >> result) {
-      for(auto row : result) {
-	right.fromTlshStr(row["h"].c_str());
-	double diff = left.totalDiff(&right);
-	//std::cout << row["sid"].c_str() << ' ' << row["h"].c_str() << ' ' << diff <<std::endl;
-	distvec.push_back({row["sid"].as<unsigned int>(), diff});
-      }
-    }
-    return distvec;
+  /*! \brief The hex string is stored as bytes */
+  std::string value(const std::string &hash) const {
+    return tlsh_hex_bytes(hash);
   }
 
-  virtual unsigned long calculate_missing_hashes(pqxx::connection &conn) {
-    std::ostringstream query;
-    pqxx::result result;
-    unsigned long count = 0;
-
-    query << "SELECT sid, data, length(data) FROM files WHERE sid NOT IN"
-	  << " (SELECT sid FROM fuzzy_tlsh) AND data NOTNULL AND length(data) >= " << MIN_DATA_LENGTH
-	  << " LIMIT " << RESULT_STRIDE
-	  << ';';
-    do {
-      //Cursor needs nested transactions!?
-      //pqxx::icursorstream cursor(txn, query.str(), "cursor for TLSH", RESULT_STRIDE);
-      pqxx::work txn(conn, "calculate TLSH hashes");
-      result = txn.exec(query.str());
-      for(auto row : result) {
-	unsigned long dsize = row[2].as<unsigned long>();
-	unsigned long sid = row[0].as<unsigned long>();
-	std::cout << boost::format("$%06lx $%04lX\n") % sid % dsize;
-	if(dsize >= MIN_DATA_LENGTH) {
-	  pqxx::binarystring binstr(row["data"]);
-	  std::string hash(calculate_tlsh(binstr));
-	  std::cout << '\t' << hash << std::endl;
-	  insert_tlsh(txn, sid, hash);
+  /*! \brief Answer the queries in parallel on the resident index */
+  std::vector<ComRes_List> calc_closest_many(Sid_Storage &storage, const std::vector<unsigned int> &sids, size_t k, unsigned int threads) {
+    const Tlsh_Index &idx(get_index(storage));
+    std::vector<ComRes_List> results(sids.size());
+    std::vector<const Tlsh_Digest *> digests;
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    Metrics_Timer &timer(metrics().timer("compare"));
+
+    for(auto sid : sids) {
+      digests.push_back(idx.find(sid));
+      if(!digests.back()) std::cerr << "SID " << sid << ": no TLSH hash" << std::endl;
+    }
+    if(threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    auto worker = [&]() {
+      size_t i;
+      while((i = next++) < sids.size()) {
+	if(!digests[i]) continue;
+	Distance_Selector selector(Distance_Selector::top(k));
+	{
+	  Metrics_Scope scope(timer);
+	  idx.closest(*digests[i], selector, NULL);
 	}
+	results[i] = selected(selector);
       }
-      txn.commit();
-      ++count;
-    } while(!result.empty());
-    return count - 1;
+    };
+    for(unsigned int i = 1; i < std::min<size_t>(threads, sids.size()); ++i) pool.emplace_back(worker);
+    worker();
+    for(auto &i : pool) i.join();
+    return results;
+  }
+
+public:
+  void calc_differences(Sid_Storage &storage, unsigned int sid, Distance_Selector &selector) {
+    get_index(storage).closest(get_digest(storage, sid), selector, NULL);
   }
 };
 
 
-int run(pqxx::connection &conn, char **begin, char **end, const gengetopt_args_info &args) {
+int run(const std::string &connection_string, char **begin, char **end, const gengetopt_args_info &args) {
   std::string hash_type(args.hash_arg);
   Fuzzy_Interface *fuzzy_interface = NULL;
 
@@ -286,13 +389,17 @@ int run(pqxx::connection &conn, char **begin, char **end, const gengetopt_args_i
     throw std::runtime_error("unknown hash type: " + hash_type);
   }
   try {
-    fuzzy_interface->calculate_missing_hashes(conn);
+    if(args.threads_arg < 0) throw std::invalid_argument("--threads must not be negative");
+    if(args.copy_batch_arg < 0) throw std::invalid_argument("--copy-batch must not be negative");
+    Pipeline_Config pipeline = { static_cast<unsigned int>(args.threads_arg), 0, STORE_BATCH };
+    pipeline.queue_size = 4 * (args.threads_arg > 0 ? args.threads_arg : std::thread::hardware_concurrency()) + 1;
+    Metrics_Exporter exporter(args.metrics_given ? args.metrics_arg : "", "calculate_fuzzy_hash", args.metrics_interval_arg);
+    std::unique_ptr<Sid_Storage> storage(open_storage(connection_string, args.local_given ? args.local_arg : NULL));
+    fuzzy_interface->calculate_missing_hashes(*storage, pipeline, args.copy_batch_arg, args.flush_interval_arg, args.rescan_flag, args.quiet_flag);
     //And direct query
-    if(begin < end) {
-      pqxx::work txn(conn, "query fuzzy hashes");
-      Fuzzy_Interface::SID_List_Type sids(std::distance(begin, end));
-      std::transform(begin, end, sids.begin(), [](const char *arg) { return boost::lexical_cast<unsigned int>(arg); });
-      fuzzy_interface->find_similarities(txn, sids, args);
+    if(begin < end || args.sids_file_given) {
+      Fuzzy_Interface::SID_List_Type sids(query_sids(begin, end, args.sids_file_given ? args.sids_file_arg : NULL));
+      fuzzy_interface->find_similarities(*storage, sids, args);
     }
   }
   catch(const std::exception &excp) {
@@ -313,8 +420,7 @@ int main(int argc, char **argv) {
 
   if(cmdline_parser(argc, argv, &args) != 0) return 1;
   try {
-    pqxx::connection conn(connection_string.str());
-    retval = run(conn, &args.inputs[0], &args.inputs[args.inputs_num], args);
+    retval = run(connection_string.str(), &args.inputs[0], &args.inputs[args.inputs_num], args);
   }
   catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
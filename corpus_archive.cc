@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "corpus_archive.hh"
+
+Corpus_Archive::Corpus_Archive(const std::string &fname) : file(fname, "corpus archive", sizeof(Corpus_Archive_Header)), map(file.data()), header(NULL), entries(NULL), strings(NULL) {
+  bool valid;
+
+  header = reinterpret_cast<const Corpus_Archive_Header *>(map);
+  valid = file.has_header(CORPUS_ARCHIVE_MAGIC, CORPUS_ARCHIVE_VERSION)
+    && header->entry_size == sizeof(Corpus_Archive_Entry)
+    && header->entries_offset % alignof(Corpus_Archive_Entry) == 0
+    && header->entries_offset + header->count * sizeof(Corpus_Archive_Entry) <= header->strings_offset
+    && header->strings_offset + header->strings_size <= file.size()
+    && header->strings_size > 0
+    && map[header->strings_offset + header->strings_size - 1] == 0;
+  if(valid) {
+    entries = reinterpret_cast<const Corpus_Archive_Entry *>(map + header->entries_offset);
+    strings = reinterpret_cast<const char *>(map + header->strings_offset);
+    for(size_t i = 0; i < header->count && valid; ++i) {
+      const Corpus_Archive_Entry &entry(entries[i]);
+      valid = entry.offset + entry.size <= header->entries_offset
+	&& (i == 0 || entries[i - 1].sid < entry.sid)
+	&& entry.filename < header->strings_size && entry.name < header->strings_size
+	&& entry.author < header->strings_size && entry.released < header->strings_size;
+    }
+  }
+  if(!valid) throw std::runtime_error("invalid corpus archive: " + fname);
+  //Batch jobs walk the payloads in sid order.
+  file.advise(MADV_SEQUENTIAL);
+}
+
+size_t Corpus_Archive::find(unsigned int sid) const {
+  const Corpus_Archive_Entry *end = entries + header->count;
+  const Corpus_Archive_Entry *pos = std::lower_bound(entries, end, sid, [](const Corpus_Archive_Entry &x, unsigned int y) { return x.sid < y; });
+
+  if(pos == end || pos->sid != sid) return header->count;
+  return pos - entries;
+}
+
+Corpus_Archive_Writer::Corpus_Archive_Writer(const std::string &fname) : out(fname, "corpus archive"), offset(CORPUS_ARCHIVE_HEADER), strings(1, '\0') {
+  static_assert(sizeof(Corpus_Archive_Header) <= CORPUS_ARCHIVE_HEADER, "corpus archive header too large");
+  //Placeholder, rewritten by close().
+  out.pad(CORPUS_ARCHIVE_HEADER);
+}
+
+/*! \brief Offset of the string in the string table, the empty string is shared */
+uint32_t Corpus_Archive_Writer::add_string(const std::string &str) {
+  uint32_t pos = strings.size();
+
+  if(str.empty()) return 0;
+  if(strings.size() + str.size() + 1 > UINT32_MAX) throw std::runtime_error("string table of corpus archive too large");
+  strings.append(str.c_str(), strnlen(str.c_str(), str.size()));
+  strings.push_back('\0');
+  return pos;
+}
+
+void Corpus_Archive_Writer::add(unsigned int sid, const std::string &filename, const uint8_t *data, size_t size, const Psid_Header *header) {
+  Corpus_Archive_Entry entry;
+  size_t pad = (CORPUS_ARCHIVE_ALIGN - size % CORPUS_ARCHIVE_ALIGN) % CORPUS_ARCHIVE_ALIGN;
+
+  if(size > UINT32_MAX) throw std::invalid_argument("file too large for corpus archive: " + filename);
+  std::memset(&entry, 0, sizeof(entry));
+  entry.sid = sid;
+  entry.size = size;
+  entry.offset = offset;
+  entry.filename = add_string(filename);
+  if(header) {
+    entry.name = add_string(header->name);
+    entry.author = add_string(header->author);
+    entry.released = add_string(header->released);
+    entry.magic = header->magic;
+    entry.speed = header->speed;
+    entry.version = header->version;
+    entry.data_offset = header->data_offset;
+    entry.load_address = header->load_address;
+    entry.init_address = header->init_address;
+    entry.play_address = header->play_address;
+    entry.songs = header->songs;
+    entry.start_song = header->start_song;
+  }
+  out.write(data, size);
+  out.pad(pad);
+  offset += size + pad;
+  entries.push_back(entry);
+}
+
+void Corpus_Archive_Writer::close() {
+  Corpus_Archive_Header header;
+
+  std::sort(entries.begin(), entries.end(), [](const Corpus_Archive_Entry &x, const Corpus_Archive_Entry &y) { return x.sid < y.sid; });
+  for(size_t i = 1; i < entries.size(); ++i) {
+    if(entries[i - 1].sid == entries[i].sid) throw std::invalid_argument("sid " + std::to_string(entries[i].sid) + " twice in corpus archive");
+  }
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CORPUS_ARCHIVE_MAGIC, sizeof(header.magic));
+  header.version = CORPUS_ARCHIVE_VERSION;
+  header.entry_size = sizeof(Corpus_Archive_Entry);
+  header.count = entries.size();
+  header.entries_offset = offset;
+  header.strings_offset = offset + entries.size() * sizeof(Corpus_Archive_Entry);
+  header.strings_size = strings.size();
+  out.write(entries.data(), entries.size() * sizeof(Corpus_Archive_Entry));
+  out.write(strings.data(), strings.size());
+  out.seek(0);
+  out.write(&header, sizeof(header));
+  out.commit();
+}
@@ -0,0 +1,136 @@
+#ifndef __CORPUS_ARCHIVE_HH_2017__
+#define __CORPUS_ARCHIVE_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "psid.hh"
+#include "mapped_file.hh"
+
+/*
+ * A corpus archive holds the SID files of the collection in a single
+ * file, so batch jobs read them straight from the page cache instead of
+ * pulling files.data through the database. The file is in native byte
+ * order:
+ *
+ *   header     Corpus_Archive_Header, padded to CORPUS_ARCHIVE_HEADER bytes
+ *   payloads   the files, each starting at a multiple of CORPUS_ARCHIVE_ALIGN
+ *   entries    count * Corpus_Archive_Entry, ascending sids
+ *   strings    NUL terminated UTF-8 strings referenced by the entries
+ */
+
+#define CORPUS_ARCHIVE_MAGIC "SIDCORPS"
+#define CORPUS_ARCHIVE_VERSION 1
+#define CORPUS_ARCHIVE_ALIGN 64
+#define CORPUS_ARCHIVE_HEADER 128
+
+struct Corpus_Archive_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t count;
+  uint64_t entries_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+};
+
+/*! \brief A file in the offset table with its parsed PSID header
+ *
+ * The strings are offsets into the string table. Without a valid
+ * header magic is 0 and all header fields are 0.
+ */
+struct Corpus_Archive_Entry {
+  uint32_t sid;
+  uint32_t size;
+  uint64_t offset;
+  uint32_t filename;
+  uint32_t name;
+  uint32_t author;
+  uint32_t released;
+  uint32_t magic;
+  uint32_t speed;
+  uint16_t version;
+  uint16_t data_offset;
+  uint16_t load_address;
+  uint16_t init_address;
+  uint16_t play_address;
+  uint16_t songs;
+  uint16_t start_song;
+  uint16_t reserved;
+};
+
+/*! \brief Read only memory mapped corpus archive
+ */
+class Corpus_Archive {
+  Mapped_File file;
+  const uint8_t *map;
+  const Corpus_Archive_Header *header;
+  const Corpus_Archive_Entry *entries;
+  const char *strings;
+
+public:
+  /*! \brief Map an archive file
+   *
+   * \param fname file name of the archive
+   */
+  explicit Corpus_Archive(const std::string &fname);
+  Corpus_Archive(const Corpus_Archive &) = delete;
+  Corpus_Archive &operator=(const Corpus_Archive &) = delete;
+
+  /*! \brief Number of files in the archive */
+  size_t size() const { return header->count; }
+  const Corpus_Archive_Entry &entry(size_t idx) const { return entries[idx]; }
+  unsigned int sid(size_t idx) const { return entries[idx].sid; }
+  /*! \brief Contents of a file, mapped from the archive */
+  const uint8_t *data(size_t idx) const { return map + entries[idx].offset; }
+  size_t data_size(size_t idx) const { return entries[idx].size; }
+  const char *filename(size_t idx) const { return strings + entries[idx].filename; }
+  const char *name(size_t idx) const { return strings + entries[idx].name; }
+  const char *author(size_t idx) const { return strings + entries[idx].author; }
+  const char *released(size_t idx) const { return strings + entries[idx].released; }
+  /*! \brief Whether there is a song: a parsed header or strings from the songs table */
+  bool has_song(size_t idx) const {
+    return entries[idx].magic != 0 || entries[idx].name != 0 || entries[idx].author != 0 || entries[idx].released != 0;
+  }
+  /*! \brief Find the entry of a sid
+   *
+   * \return entry index or size() if the sid is not in the archive
+   */
+  size_t find(unsigned int sid) const;
+};
+
+/*! \brief Write a corpus archive file
+ *
+ * The payloads are streamed to the file, the entries and strings are
+ * appended by close(). The archive is written to a temporary file
+ * which is renamed on close() so that readers never see a half written
+ * archive.
+ */
+class Corpus_Archive_Writer {
+  Atomic_File out;
+  uint64_t offset;
+  std::vector<Corpus_Archive_Entry> entries;
+  std::string strings;
+
+  uint32_t add_string(const std::string &str);
+
+public:
+  explicit Corpus_Archive_Writer(const std::string &fname);
+  Corpus_Archive_Writer(const Corpus_Archive_Writer &) = delete;
+  Corpus_Archive_Writer &operator=(const Corpus_Archive_Writer &) = delete;
+
+  /*! \brief Append a file
+   *
+   * \param header parsed header with the song information or NULL
+   */
+  void add(unsigned int sid, const std::string &filename, const uint8_t *data, size_t size, const Psid_Header *header);
+  /*! \brief Finish the archive and move it into place
+   *
+   * Throws std::invalid_argument if a sid was added twice.
+   */
+  void close();
+  size_t size() const { return entries.size(); }
+};
+
+#endif
@@ -15,7 +15,7 @@ import matplotlib.pyplot as plt
 import numpy as np
 
 def get_sizes(crsr):
-    crsr.execute("SELECT sid,length(data) FROM files ORDER BY length;")
+    crsr.execute("SELECT sid,length(data) FROM files WHERE data IS NOT NULL ORDER BY length;")
     records = crsr.fetchall()
     return np.array([i[1] for i in records])
 
@@ -43,6 +43,10 @@ def main():
     print("average       = %15.8e" % np.average(sizes))
     print("std deviation = %15.8e" % np.std(sizes))
     print("median        = %15.8e" % np.median(sizes))
+    # sid_bench draws exp(mu + sigma * N(0, 1)) bytes, --median-size is
+    # exp(mu) and --size-sigma is sigma, both fitted to the log sizes.
+    logs = np.log(sizes[sizes > 0])
+    print("sid_bench --median-size=%.0f --size-sigma=%.3f" % (np.exp(np.mean(logs)), np.std(logs)))
     histogram(sizes, BINS)
     histogram(get_per_author(crsr), BINS)
     
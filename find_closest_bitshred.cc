@@ -1,7 +1,7 @@
 #include <algorithm>
 #include <iostream>
 #include <boost/format.hpp>
-#include <pqxx/pqxx>
+#include <map>
 #include <set>
 #include <vector>
 #include <sstream>
@@ -12,178 +12,413 @@
 #include <getopt.h>
 #include <bitset>
 #include <stdexcept>
+#include <memory>
 #include "find_closest_bitshred.cmdline.h"
 #include "bitshred.hh"
+#include "jaccard.hh"
+#include "bitshred_index.hh"
+#include "bitshred_pairs.hh"
+#include "minhash.hh"
+#include "sid_list.hh"
+#include "storage.hh"
+#include "metrics.hh"
 
-#define RESULT_STRIDE 89
-
-typedef std::vector<std::pair<unsigned int, double> > DistancesVector;
-
-unsigned bit_count(uint8_t x) {
-  struct {
-    unsigned operator()(uint8_t nibble) const {
-      switch(nibble) {
-      case 0:
-	return 0;
-      case 1:
-      case 2:
-      case 4:
-      case 8:
-	return 1;
-      case 3:
-      case 5:
-      case 6:
-      case 9:
-      case 10:
-      case 12:
-	return 2;
-      case 7:
-      case 11:
-      case 13:
-      case 14:
-	return 3;
-      case 15:
-	return 4;
-      default:
-	throw std::logic_error("nibble");
+#define INDEX_BLOCK 4096
+//Bitshreds streamed from the storage per batch scan
+#define BATCH_CHUNK 8192
+
+/*! \brief Calculate the distances by scanning the storage
+ *
+ * \param kind bitshred kind with m, n, and hash
+ * \param selector receives all distances
+ */
+void calc_distances(Sid_Storage &storage, unsigned int fstsid, const std::string &kind, bool verbose, Distance_Selector &selector) {
+  auto values(storage.get(kind, { fstsid }));
+
+  if(values.empty()) throw std::runtime_error("no bitshred for sid");
+  const std::string &fst(values[0].second);
+  storage.scan(kind, [&](unsigned int sndsid, const uint8_t *snd, size_t size) {
+      if(sndsid == fstsid) return;
+      if(fst.size() != size) throw std::runtime_error("fst.size() != snd.size");
+      Bitshred_Counts counts(jaccard_counts(reinterpret_cast<const uint8_t *>(fst.data()), snd, size));
+      assert(counts.intersection <= counts.unio);
+      //Jaccard distance
+      double jaccard = jaccard_distance(counts);
+      if(verbose) {
+	std::cout << boost::format("\t%6d $%04X %20.15e") % sndsid % sndsid % jaccard;
+	std::cout << std::endl;
       }
-    }
-  } locf;
-  return locf(x & 0xF) + locf(x >> 4);
+      selector.add(sndsid, jaccard);
+    });
 }
 
-DistancesVector calc_distances(pqxx::work &txn, unsigned int fstsid, unsigned int m, unsigned int n, const std::string &hashname, bool verbose) {
-  std::ostringstream query;
-  pqxx::result result;
-  std::vector<std::pair<unsigned int, double> > distances;
-  static auto plus_bitcount = [](unsigned s, uint8_t x) { return s + bit_count(x);};
-
-  query << "SELECT bfst.sid, bsnd.sid, bfst.bitshred, bsnd.bitshred FROM bitshred bfst, bitshred bsnd WHERE"
-	<< " (bfst.m, bfst.n, bfst.hash) = (bsnd.m, bsnd.n, bsnd.hash) AND bfst.sid != bsnd.sid"
-	<< " AND bfst.sid = " << fstsid
-	<< " AND bfst.m = " << m
-	<< " AND bfst.n = " << n
-	<< " AND bfst.hash = " << txn.quote(hashname)
-	<< ';';
-  //std::cout << query.str() << std::endl;
-  /*
-   * Warning! This query
-   * 
-   * pqxx::result result(txn.exec(query.str()));
-   *
-   * loads the *whole* data into memory, killing small computers like
-   * RPi or Chip. Therefore we use this curser to load the results
-   * sequentially and process them in batches of stride=12 rows.
-   */
-  pqxx::icursorstream cursor(txn, query.str(), "calc distances", RESULT_STRIDE);
-  while(cursor >> result) {
-    for(auto row : result) {
-#ifndef NDEBUG
-      unsigned int fstsid = row[0].as<unsigned int>();
-#endif
-      unsigned int sndsid = row[1].as<unsigned int>();
-      pqxx::binarystring fst(row[2]);
-      pqxx::binarystring snd(row[3]);      
-      // std::vector<uint8_t> setdifference(fst.size());
-      // std::vector<uint8_t> setunion(fst.size());
-      if(fst.size() != snd.size()) throw std::runtime_error("fst.size() != snd.size");
-      double diff_count = std::inner_product(fst.begin(), fst.end(), snd.begin(), 0U, plus_bitcount, std::bit_and<uint8_t>());
-      double unio_count = std::inner_product(fst.begin(), fst.end(), snd.begin(), 0U, plus_bitcount, std::bit_or<uint8_t>());
-      // double diff_count = static_cast<double>(std::count(setdifference.begin(), setdifference.end(), '1'));
-      // double unio_count = static_cast<double>(std::count(setunion.begin(), setunion.end(), '1'));
-      assert(fstsid != sndsid);
-      assert(diff_count <= unio_count);
-      //Jaccard distance
-      double jaccard = 1 - diff_count / unio_count;
+
+/*! \brief Calculate the distances using a local bitshred index
+ *
+ * Same as calc_distances() but all bitshreds are scanned directly
+ * from the memory mapped index file.
+ *
+ * \param index bitshred index, m, n, and hash are given by the index
+ * \param fstsid SID to find the distances to
+ * \param verbose output every distance
+ * \param selector receives all distances
+ */
+void index_distances(const Bitshred_Index &index, unsigned int fstsid, bool verbose, Distance_Selector &selector) {
+  std::vector<Bitshred_Counts> counts(INDEX_BLOCK);
+  size_t fstidx = index.find(fstsid);
+
+  if(fstidx == index.size()) throw std::runtime_error("sid not in bitshred index");
+  const uint8_t *fst = index.shred(fstidx);
+  for(size_t block = 0; block < index.size(); block += INDEX_BLOCK) {
+    size_t num = std::min<size_t>(INDEX_BLOCK, index.size() - block);
+    jaccard_counts_many(fst, index.shred(block), index.stride(), index.byte_size(), num, counts.data());
+    for(size_t i = 0; i < num; ++i) {
+      unsigned int sndsid = index.sid(block + i);
+      if(sndsid == fstsid) continue;
+      double jaccard = jaccard_distance(counts[i]);
       if(verbose) {
 	std::cout << boost::format("\t%6d $%04X %20.15e") % sndsid % sndsid % jaccard;
 	std::cout << std::endl;
       }
-      distances.push_back(std::make_pair(sndsid, jaccard));
+      selector.add(sndsid, jaccard);
     }
   }
-  return distances;
 }
 
 
-void list_entries(pqxx::work &txn, const DistancesVector &distances) {
+/*! \brief Get the bitshred of a SID
+ *
+ * \param storage used if there is no index
+ * \param index bitshred index or NULL
+ * \param sid SID of the bitshred
+ * \param args CLI arguments with m, n, and hash
+ * \return bitshred in bytea layout
+ */
+std::string get_bitshred(Sid_Storage &storage, const Bitshred_Index *index, unsigned int sid, const gengetopt_args_info &args) {
+  if(index) {
+    size_t idx = index->find(sid);
+    if(idx == index->size()) throw std::runtime_error("sid not in bitshred index");
+    return std::string(reinterpret_cast<const char *>(index->shred(idx)), index->byte_size());
+  }
+  auto values(storage.get(bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), { sid }));
+  if(values.empty()) throw std::runtime_error("no bitshred for sid");
+  return values[0].second;
+}
+
+
+/*! \brief Calculate the distances to the LSH candidates only
+ *
+ * The candidates are the SIDs sharing an LSH bucket with the SID, their
+ * exact Jaccard distances are calculated from the bitshred index or,
+ * without an index, fetched from the storage.
+ *
+ * \param storage used if there is no index
+ * \param lsh LSH index
+ * \param index bitshred index or NULL
+ * \param fstsid SID to find the distances to
+ * \param args CLI arguments
+ * \param candidates number of candidates compared
+ * \param selector receives the distances of the candidates
+ */
+void lsh_distances(Sid_Storage &storage, const Minhash_Index &lsh, const Bitshred_Index *index, unsigned int fstsid, const gengetopt_args_info &args, size_t &candidates, Distance_Selector &selector) {
+  DistancesVector distances;
+  std::string fst(get_bitshred(storage, index, fstsid, args));
+  const uint8_t *fstdata = reinterpret_cast<const uint8_t *>(fst.data());
+  std::vector<unsigned int> sids(lsh.candidates(fstdata, fst.size()));
+
+  sids.erase(std::remove(sids.begin(), sids.end(), fstsid), sids.end());
+  candidates = sids.size();
+  if(sids.empty()) return;
+  if(index) {
+    for(auto sndsid : sids) {
+      size_t idx = index->find(sndsid);
+      if(idx == index->size()) throw std::runtime_error("LSH index does not match bitshred index");
+      distances.push_back(std::make_pair(sndsid, jaccard_distance(jaccard_counts(fstdata, index->shred(idx), fst.size()))));
+    }
+  } else {
+    for(auto &value : storage.get(bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), sids)) {
+      if(value.second.size() != fst.size()) throw std::runtime_error("fst.size() != snd.size");
+      distances.push_back(std::make_pair(value.first, jaccard_distance(jaccard_counts(fstdata, reinterpret_cast<const uint8_t *>(value.second.data()), fst.size()))));
+    }
+  }
+  if(args.verbose_flag) {
+    for(auto &i : distances) std::cout << boost::format("\t%6d $%04X %20.15e\n") % i.first % i.first % i.second;
+  }
+  for(auto &i : distances) selector.add(i.first, i.second);
+}
+
+
+/*! \brief Write all bitshreds of one parameter set into an index file
+ *
+ * \param storage database or local directory
+ * \param fname file name of the index
+ * \param m bitshred size in bits
+ * \param n n-gram selection
+ * \param hashname hash name
+ * \return number of exported bitshreds
+ */
+unsigned long export_index(Sid_Storage &storage, const std::string &fname, unsigned int m, unsigned int n, const std::string &hashname) {
+  Bitshred_Index_Writer writer(fname, m, n, hashname);
+
+  storage.scan(bitshred_kind(m, n, hashname), [&writer](unsigned int sid, const uint8_t *data, size_t size) { writer.add(sid, data, size); });
+  writer.close();
+  return writer.size();
+}
+
+
+/*! \brief Load all bitshreds of one parameter set into memory
+ *
+ * \param storage database or local directory
+ * \param m bitshred size in bits
+ * \param n n-gram selection
+ * \param hashname hash name
+ * \return table of all bitshreds ordered by sid
+ */
+Bitshred_Table load_bitshreds(Sid_Storage &storage, unsigned int m, unsigned int n, const std::string &hashname) {
+  Bitshred_Table table((m + 7) / 8);
+  Metrics_Scope scope(metrics().timer("fetch"));
+
+  storage.scan(bitshred_kind(m, n, hashname), [&table](unsigned int sid, const uint8_t *data, size_t size) { table.add(sid, data, size); });
+  return table;
+}
+
+
+/*! \brief Output the distances between all SIDs
+ *
+ * With --closer all pairs closer than delta are written as an edge
+ * list, otherwise the --top closest SIDs for every SID.
+ *
+ * \param block all bitshreds
+ * \param args CLI arguments
+ */
+void all_pairs(const Bitshred_Block &block, const gengetopt_args_info &args) {
+  if(args.closer_given) {
+    auto edges(all_pairs_closer(block, args.closer_arg, args.threads_arg));
+    for(auto &i : edges) std::cout << boost::format("%6d %6d %20.16e\n") % i.fst % i.snd % i.distance;
+  } else {
+    auto lowest(all_pairs_lowest(block, args.top_arg, args.threads_arg));
+    for(size_t i = 0; i < block.count; ++i) {
+      std::cout << boost::format("SID: %d\n") % block.sids[i];
+      for(auto j : lowest[i]) std::cout << boost::format("|\t %6d $%04X d=%20.16e\n") % j.first % j.first % j.second;
+    }
+  }
+}
+
+
+void list_entries(Sid_Storage &storage, const DistancesVector &distances) {
   std::vector<unsigned int> sids(distances.size());
-  std::ostringstream query;
   boost::format format("*%6d L=$%04X %31s %31s %31s %s\n");
 
   std::transform(distances.begin(), distances.end(), sids.begin(), [](std::pair<unsigned int, double> x) { return x.first; });
-  query << "SELECT sid,name,author,released,filename,length(data) FROM songs NATURAL JOIN files WHERE sid ";
-  if(sids.size() >=2) {
-    query << "IN (";
-    auto sids_end(sids.end());
-    --sids_end;
-    std::copy(sids.begin(), sids_end, std::ostream_iterator<unsigned int>(query, ","));
-    query << *sids_end << ") ORDER BY sid;";
-  } else {
-    query << "= " << sids[0] << ';';
-  }
-  //std::cout << query.str() << std::endl;
-  pqxx::result result(txn.exec(query.str()));
-  for(auto row : result) {
+  for(auto &entry : storage.entries(sids)) {
     std::cout << format
-      % row[0].as<unsigned int>()
-      % row[5].as<unsigned int>()
-      % row[1].c_str()
-      % row[2].c_str()
-      % row[3].c_str()
-      % row[4]
+      % entry.sid
+      % entry.size
+      % entry.name
+      % entry.author
+      % entry.released
+      % entry.filename
       ;
   }
 }
 
 
-void reduce_to_lowest(DistancesVector &distances, unsigned int num) {
-  auto cmpfun = [](const std::pair<unsigned int, double> &x, const std::pair<unsigned int, double> &y) { return x.second < y.second; };
-  if(distances.size() < num) {
-    std::sort(distances.begin(), distances.end(), cmpfun);
+/*! \brief Selector for the closest SIDs, either closer than --closer or the --top ones */
+Distance_Selector make_selector(const gengetopt_args_info &args) {
+  if(args.closer_given) return Distance_Selector::closer(args.closer_arg);
+  return Distance_Selector::top(args.top_arg);
+}
+
+/*! \brief Fraction of the exact results found by the approximate query */
+double recall(const DistancesVector &approx, const DistancesVector &exact) {
+  std::set<unsigned int> found;
+  unsigned int hits = 0;
+
+  if(exact.empty()) return 1.0;
+  for(auto &i : approx) found.insert(i.first);
+  for(auto &i : exact) hits += found.count(i.first);
+  return static_cast<double>(hits) / exact.size();
+}
+
+/*! \brief Load the bitshreds of the query SIDs
+ *
+ * Duplicate SIDs are loaded once, SIDs without a bitshred are reported
+ * and left out.
+ */
+Bitshred_Table load_queries(Sid_Storage &storage, const Bitshred_Index *index, const std::vector<unsigned int> &sids, const gengetopt_args_info &args) {
+  Bitshred_Table table((args.size_arg + 7) / 8);
+  std::set<unsigned int> missing(sids.begin(), sids.end());
+
+  if(index) {
+    for(auto sid : missing) {
+      size_t idx = index->find(sid);
+      if(idx < index->size()) table.add(sid, index->shred(idx), index->byte_size());
+    }
   } else {
-    std::partial_sort(distances.begin(), distances.begin() + num, distances.end(), cmpfun);
-    distances.resize(num);
+    std::vector<unsigned int> wanted(missing.begin(), missing.end());
+    for(auto &value : storage.get(bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), wanted)) {
+      table.add(value.first, reinterpret_cast<const uint8_t *>(value.second.data()), value.second.size());
+    }
   }
+  Bitshred_Block block(table.block());
+  for(size_t i = 0; i < block.count; ++i) missing.erase(block.sids[i]);
+  for(auto sid : missing) std::cerr << "No bitshred for SID " << sid << std::endl;
+  return table;
 }
 
-unsigned int closer_than(DistancesVector &distances, double delta) {
-  unsigned int idx;
-  auto cmpfun = [](const std::pair<unsigned int, double> &x, const std::pair<unsigned int, double> &y) { return x.second < y.second; };
 
-  std::sort(distances.begin(), distances.end(), cmpfun);
-  for(idx = 0; idx < distances.size(); ++idx) {
-    if(distances[idx].second > delta) break;
-  }
-  if(idx > 0) {
-    distances.resize(idx);
+/*! \brief Closest SIDs of many queries in a single scan
+ *
+ * The bitshreds are scanned once, either in the index or streamed from
+ * the storage in chunks, and compared with all queries.
+ *
+ * \param queries bitshreds of the query SIDs
+ * \return for each query row the selected distances
+ */
+std::vector<DistancesVector> batch_distances(Sid_Storage &storage, const Bitshred_Index *index, const Bitshred_Block &queries, const gengetopt_args_info &args) {
+  Bitshred_Batch batch(queries, make_selector(args), args.threads_arg);
+
+  if(index) {
+    batch.scan(index->block());
   } else {
-    distances.clear();
+    Bitshred_Table chunk(queries.bytes);
+    storage.scan(bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), [&](unsigned int sid, const uint8_t *data, size_t size) {
+	chunk.add(sid, data, size);
+	if(chunk.size() >= BATCH_CHUNK) {
+	  batch.scan(chunk.block());
+	  chunk = Bitshred_Table(queries.bytes);
+	}
+      });
+    batch.scan(chunk.block());
+  }
+  return batch.results();
+}
+
+
+/*! \brief Output the closest SIDs of a query */
+void print_closest(Sid_Storage &storage, unsigned int sid, const DistancesVector &minsids, const gengetopt_args_info &args) {
+  if(minsids.empty()) {
+    std::cout << boost::format("No SID close to %d\n") % sid << std::endl;
+    return;
   }
-  return idx;
+  auto minsid = minsids.begin();
+  std::cout << boost::format("Minimum to %d: %d $%04X d=%20.16e\n") % sid % minsid->first % minsid->first % minsid->second;
+  for(auto i : minsids) std::cout << boost::format("|\t %6d $%04X d=%20.16e\n") % i.first % i.first % i.second;
+  if(args.query_flag) list_entries(storage, minsids);
+  std::cout << std::endl;
 }
 
-int run(pqxx::connection &conn, char **begin, char **end, const gengetopt_args_info &args) {
+
+int run(Sid_Storage &storage, char **begin, char **end, const gengetopt_args_info &args) {
+  double recall_sum = 0;
+  unsigned int recall_queries = 0;
+  Metrics_Timer &compare_timer(metrics().timer("compare"));
+  Metrics_Timer &select_timer(metrics().timer("select"));
+  Metrics_Counter &queries_counter(metrics().counter("queries"));
+
   try {
-    pqxx::work txn(conn, "recall bitshred");
-    while(begin < end) {
-      unsigned int sid = atoi(*begin);
+    Metrics_Exporter exporter(args.metrics_given ? args.metrics_arg : "", "find_closest_bitshred", args.metrics_interval_arg);
+    std::unique_ptr<Bitshred_Index> index;
+    std::unique_ptr<Minhash_Index> lsh;
+    if(args.export_index_given) {
+      unsigned long exported = export_index(storage, args.export_index_arg, args.size_arg, args.ngram_arg, args.hash_arg);
+      std::cout << "Bitshreds exported: " << exported << std::endl;
+    }
+    if(args.index_given) {
+      index.reset(new Bitshred_Index(args.index_arg));
+      if(index->m() != static_cast<unsigned int>(args.size_arg) || index->n() != static_cast<unsigned int>(args.ngram_arg) || index->hash() != args.hash_arg) {
+	throw std::runtime_error("bitshred index does not match m, n, and hash");
+      }
+    }
+    if(args.export_lsh_given) {
+      unsigned long exported;
+      if(index) {
+	exported = write_minhash_index(args.export_lsh_arg, index->block(), args.size_arg, args.ngram_arg, args.hash_arg, args.bands_arg, args.rows_arg);
+      } else {
+	Bitshred_Table table(load_bitshreds(storage, args.size_arg, args.ngram_arg, args.hash_arg));
+	exported = write_minhash_index(args.export_lsh_arg, table.block(), args.size_arg, args.ngram_arg, args.hash_arg, args.bands_arg, args.rows_arg);
+      }
+      std::cout << "Bitshreds in LSH index: " << exported << std::endl;
+    }
+    if(args.lsh_given) {
+      lsh.reset(new Minhash_Index(args.lsh_arg));
+      if(lsh->m() != static_cast<unsigned int>(args.size_arg) || lsh->n() != static_cast<unsigned int>(args.ngram_arg) || lsh->hash() != args.hash_arg) {
+	throw std::runtime_error("LSH index does not match m, n, and hash");
+      }
+      if(args.verbose_flag) std::cout << boost::format("LSH index: %u bitshreds, %u bands of %u rows\n") % lsh->size() % lsh->bands() % lsh->rows();
+    }
+    if(args.verbose_flag) std::cout << "Jaccard kernel: " << jaccard_kernel_name() << std::endl;
+    if(args.all_pairs_flag) {
+      if(index) {
+	all_pairs(index->block(), args);
+      } else {
+	Bitshred_Table table(load_bitshreds(storage, args.size_arg, args.ngram_arg, args.hash_arg));
+	all_pairs(table.block(), args);
+      }
+    }
+    std::vector<unsigned int> sids(query_sids(begin, end, args.sids_file_given ? args.sids_file_arg : NULL));
+    if(args.batch_flag) {
+      Bitshred_Table table(load_queries(storage, index.get(), sids, args));
+      Bitshred_Block queries(table.block());
+      std::map<unsigned int, size_t> rows;
+      for(size_t i = 0; i < queries.count; ++i) rows[queries.sids[i]] = i;
+      std::vector<DistancesVector> results;
+      {
+	//The selection is part of the scan of a batch.
+	Metrics_Scope scope(compare_timer);
+	results = batch_distances(storage, index.get(), queries, args);
+      }
+      queries_counter.add(queries.count);
+      for(auto sid : sids) {
+	auto row = rows.find(sid);
+	if(row == rows.end()) continue;
+	std::cout << "SID: " << sid << std::endl;
+	print_closest(storage, sid, results[row->second], args);
+      }
+      sids.clear();
+    }
+    for(auto sid : sids) {
+      Distance_Selector selector(make_selector(args));
+      DistancesVector minsids;
       std::cout << "SID: " << sid << std::endl;
-      auto minsids(calc_distances(txn, sid, args.size_arg, args.ngram_arg, args.hash_arg, args.verbose_flag));
-      if(args.closer_given) {
-	closer_than(minsids, args.closer_arg);
+      if(lsh) {
+	size_t candidates;
+	{
+	  Metrics_Scope scope(compare_timer);
+	  lsh_distances(storage, *lsh, index.get(), sid, args, candidates, selector);
+	}
+	{
+	  Metrics_Scope scope(select_timer);
+	  minsids = selector.take();
+	}
+	if(args.recall_flag) {
+	  Distance_Selector exact(make_selector(args));
+	  if(index) {
+	    index_distances(*index, sid, false, exact);
+	  } else {
+	    calc_distances(storage, sid, bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), false, exact);
+	  }
+	  double r = recall(minsids, exact.take());
+	  recall_sum += r;
+	  ++recall_queries;
+	  std::cout << boost::format("Recall: %5.3f, candidates %u of %u\n") % r % candidates % lsh->size();
+	}
       } else {
-	reduce_to_lowest(minsids, 8);
+	{
+	  Metrics_Scope scope(compare_timer);
+	  if(index) {
+	    index_distances(*index, sid, args.verbose_flag, selector);
+	  } else {
+	    calc_distances(storage, sid, bitshred_kind(args.size_arg, args.ngram_arg, args.hash_arg), args.verbose_flag, selector);
+	  }
+	}
+	Metrics_Scope scope(select_timer);
+	minsids = selector.take();
       }
-      //
-      if(minsids.empty()) throw std::logic_error("empty minsid");
-      auto minsid = minsids.begin();
-      std::cout << boost::format("Minimum to %d: %d $%04X d=%20.16e\n") % sid % minsid->first % minsid->first % minsid->second;
-      for(auto i : minsids) std::cout << boost::format("|\t %6d $%04X d=%20.16e\n") % i.first % i.first % i.second;
-      if(args.query_flag) list_entries(txn, minsids);
-      ++begin;
-      std::cout << std::endl;
+      queries_counter.add();
+      print_closest(storage, sid, minsids, args);
     }
+    if(recall_queries > 0) std::cout << boost::format("Mean recall: %5.3f over %u queries\n") % (recall_sum / recall_queries) % recall_queries;
   }
   catch(const std::exception &excp) {
     std::cerr << "Exception: " << excp.what() << std::endl;
@@ -204,11 +439,16 @@ int main(int argc, char **argv) {
   //if(std::getenv("SIDUSER")) dbname = std::getenv("SIDUSER");
   if(cmdline_parser(argc, argv, &args) != 0) return 1;
   try {
+    if(args.threads_arg < 0) throw std::invalid_argument("--threads must not be negative");
+    if(args.top_arg < 0) throw std::invalid_argument("--top must not be negative");
+    if(args.bands_arg < 1 || args.rows_arg < 1) throw std::invalid_argument("--bands and --rows must be positive");
+    if(args.batch_flag && args.lsh_given) throw std::invalid_argument("--batch can not be combined with --lsh");
     connection_string << "dbname=" << args.dbname_arg << " user=" << args.dbuser_arg;
     if(args.dbhost_given) connection_string << " host=" << args.dbhost_arg;
     if(args.dbpass_given) connection_string << " password=" << args.dbpass_arg;
-    pqxx::connection conn(connection_string.str());
-    retval = run(conn, &args.inputs[0], &args.inputs[args.inputs_num], args);
+    //Lazy, with an index the database is only needed for --query.
+    std::unique_ptr<Sid_Storage> storage(open_storage(connection_string.str(), args.local_given ? args.local_arg : NULL));
+    retval = run(*storage, &args.inputs[0], &args.inputs[args.inputs_num], args);
   }
   catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
@@ -7,5 +7,220 @@ uint32_t jenkins_one_at_a_time_hash(const uint8_t* key, size_t length);
 uint32_t djb2_hash(const uint8_t *data, size_t length);
 uint32_t djb2xor_hash(const uint8_t *data, size_t length);
 uint32_t sbox_hash(const uint8_t *data, size_t length);
+uint32_t rabinkarp_hash(const uint8_t *data, size_t length);
+uint32_t buzhash_hash(const uint8_t *data, size_t length);
+
+extern const uint32_t sbox_table[256];
+
+/*
+ * Batch versions for n-gram windows: out[i] is the hash of the n bytes
+ * at data + i for i < count, so count + n - 1 bytes are read. The
+ * results are bit for bit those of the functions above. With AVX2
+ * sixteen windows are hashed at once, one window per 32-bit lane; the
+ * implementation (scalar, avx2) is selected on first use by checking
+ * the CPU.
+ */
+
+typedef void (*Hash_Windows_Function)(const uint8_t *data, size_t n, size_t count, uint32_t *out);
+
+void jenkins_hash_windows(const uint8_t *data, size_t n, size_t count, uint32_t *out);
+void djb2_hash_windows(const uint8_t *data, size_t n, size_t count, uint32_t *out);
+void djb2xor_hash_windows(const uint8_t *data, size_t n, size_t count, uint32_t *out);
+void sbox_hash_windows(const uint8_t *data, size_t n, size_t count, uint32_t *out);
+
+/*! \brief Name of the selected window implementation */
+const char *hash_windows_kernel_name();
+
+/*! \brief Force an implementation
+ *
+ * \param name one of scalar, avx2
+ * \return false if the implementation is not available on this CPU
+ */
+bool hash_windows_select_kernel(const char *name);
+
+/*
+ * The hashes are also available as function objects so that they can
+ * be passed as template parameters and inlined into the n-gram loops.
+ */
+
+struct Jenkins_Hash {
+  uint32_t operator()(const uint8_t *key, size_t length) const {
+    size_t i = 0;
+    uint32_t hash = 0;
+    while (i != length) {
+      hash += key[i++];
+      hash += hash << 10;
+      hash ^= hash >> 6;
+    }
+    hash += hash << 3;
+    hash ^= hash >> 11;
+    hash += hash << 15;
+    return hash;
+  }
+};
+
+struct Djb2_Hash {
+  uint32_t operator()(const uint8_t *data, size_t length) const {
+    size_t i = 0;
+    uint32_t hash = 5381;
+    while (i != length) {
+      hash = hash * 33 + data[i++];
+    }
+    return hash;
+  }
+};
+
+struct Djb2xor_Hash {
+  uint32_t operator()(const uint8_t *data, size_t length) const {
+    size_t i = 0;
+    uint32_t hash = 5381;
+    while (i != length) {
+      hash = hash * 33 ^ data[i++];
+    }
+    return hash;
+  }
+};
+
+struct Sbox_Hash {
+  uint32_t operator()(const uint8_t *data, size_t length) const {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < length; i++) {
+      hash *= 3;
+      hash ^= sbox_table[data[i]];
+    }
+    return hash;
+  }
+};
+
+/*! \brief Multiplier of the Rabin-Karp polynomial (odd, golden ratio) */
+#define RABINKARP_BASE 0x9E3779B1u
+
+/*! \brief Final mix of murmur3
+ *
+ * The polynomial is weak in the low bits which are used by % m.
+ */
+inline uint32_t hash_fmix32(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+struct Rabinkarp_Hash {
+  uint32_t operator()(const uint8_t *data, size_t length) const {
+    uint32_t poly = 0;
+    for (size_t i = 0; i < length; i++) {
+      poly = poly * RABINKARP_BASE + data[i];
+    }
+    return hash_fmix32(poly);
+  }
+};
+
+inline uint32_t hash_rotl32(uint32_t x, unsigned int r) {
+  r &= 31;
+  return r == 0 ? x : (x << r) | (x >> (32 - r));
+}
+
+struct Buzhash_Hash {
+  uint32_t operator()(const uint8_t *data, size_t length) const {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < length; i++) {
+      hash = hash_rotl32(hash, 1) ^ sbox_table[data[i]];
+    }
+    return hash;
+  }
+};
+
+/*
+ * N-gram hashers: first() hashes the window at the start of the data,
+ * next() the window starting one byte later than the last one. The
+ * rolling hashers only look at the byte leaving and the byte entering
+ * the window. jenkins, djb2xor, and sbox can not be rolled, they are
+ * hashed in blocks by Batch_Hasher.
+ */
+
+/*! \brief Hash the windows in blocks with a batch function
+ *
+ * Used for jenkins, djb2, djb2xor, and sbox, see for_each_ngram_hash().
+ */
+template<Hash_Windows_Function WINDOWS> class Batch_Hasher {
+  size_t n;
+
+public:
+  explicit Batch_Hasher(size_t n) : n(n) {}
+  void windows(const uint8_t *data, size_t count, uint32_t *out) const { WINDOWS(data, n, count, out); }
+};
+
+/*! \brief Rolling djb2
+ *
+ * djb2 is the polynomial 5381 * 33^n + sum d_k * 33^(n-1-k) modulo
+ * 2^32, so the results are identical to djb2_hash().
+ */
+class Djb2_Rolling {
+  size_t n;
+  uint32_t offset;
+  uint32_t out_factor;
+  uint32_t poly;
+
+public:
+  explicit Djb2_Rolling(size_t n) : n(n), offset(5381), out_factor(1), poly(0) {
+    for(size_t i = 1; i < n; ++i) out_factor *= 33;
+    offset *= out_factor * 33;
+  }
+  uint32_t first(const uint8_t *window) {
+    poly = 0;
+    for(size_t i = 0; i < n; ++i) poly = poly * 33 + window[i];
+    return offset + poly;
+  }
+  uint32_t next(const uint8_t *window) {
+    poly = (poly - window[-1] * out_factor) * 33 + window[n - 1];
+    return offset + poly;
+  }
+};
+
+/*! \brief Rolling Rabin-Karp, identical to rabinkarp_hash() */
+class Rabinkarp_Rolling {
+  size_t n;
+  uint32_t out_factor;
+  uint32_t poly;
+
+public:
+  explicit Rabinkarp_Rolling(size_t n) : n(n), out_factor(1), poly(0) {
+    for(size_t i = 1; i < n; ++i) out_factor *= RABINKARP_BASE;
+  }
+  uint32_t first(const uint8_t *window) {
+    poly = 0;
+    for(size_t i = 0; i < n; ++i) poly = poly * RABINKARP_BASE + window[i];
+    return hash_fmix32(poly);
+  }
+  uint32_t next(const uint8_t *window) {
+    poly = (poly - window[-1] * out_factor) * RABINKARP_BASE + window[n - 1];
+    return hash_fmix32(poly);
+  }
+};
+
+/*! \brief Rolling cyclic polynomial, identical to buzhash_hash()
+ *
+ * D. Lemire, O. Kaser, "Recursive n-gram hashing is pairwise
+ * independent, at best", 2010.
+ */
+class Buzhash_Rolling {
+  size_t n;
+  uint32_t hash;
+
+public:
+  explicit Buzhash_Rolling(size_t n) : n(n), hash(0) {}
+  uint32_t first(const uint8_t *window) {
+    hash = 0;
+    for(size_t i = 0; i < n; ++i) hash = hash_rotl32(hash, 1) ^ sbox_table[window[i]];
+    return hash;
+  }
+  uint32_t next(const uint8_t *window) {
+    hash = hash_rotl32(hash, 1) ^ hash_rotl32(sbox_table[window[-1]], n) ^ sbox_table[window[n - 1]];
+    return hash;
+  }
+};
 
 #endif
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "histogram_cache.hh"
+
+double sparse_distance(const Sparse_Histogram &left, const Sparse_Histogram &right) {
+  double sum = 0;
+  size_t i = 0, j = 0;
+
+  while(i < left.size && j < right.size) {
+    double d;
+    if(left.bins[i] == right.bins[j]) {
+      d = static_cast<double>(left.values[i++]) - right.values[j++];
+    } else if(left.bins[i] < right.bins[j]) {
+      d = left.values[i++];
+    } else {
+      d = right.values[j++];
+    }
+    sum += d * d;
+  }
+  for(; i < left.size; ++i) sum += static_cast<double>(left.values[i]) * left.values[i];
+  for(; j < right.size; ++j) sum += static_cast<double>(right.values[j]) * right.values[j];
+  return std::sqrt(sum);
+}
+
+
+Histogram_Cache::Histogram_Cache(const std::string &fname) : file(fname, "histogram cache", HISTOGRAM_CACHE_HEADER), map(file.data()), header(NULL), table(NULL) {
+  header = reinterpret_cast<const Histogram_Cache_Header *>(map);
+  if(!file.has_header(HISTOGRAM_CACHE_MAGIC, HISTOGRAM_CACHE_VERSION)
+     || header->bins != BIGRAM_BINS
+     || header->table_offset % sizeof(uint64_t) != 0
+     || header->table_offset + header->count * sizeof(Histogram_Cache_Row) > file.size()) {
+    throw std::runtime_error("invalid histogram cache: " + fname);
+  }
+  table = reinterpret_cast<const Histogram_Cache_Row *>(map + header->table_offset);
+  for(size_t i = 0; i < header->count; ++i) {
+    if(table[i].offset + table[i].size * (sizeof(float) + sizeof(uint16_t)) > header->table_offset) {
+      throw std::runtime_error("invalid histogram cache: " + fname);
+    }
+  }
+  //All pairs are evaluated, so everything is needed.
+  file.advise(MADV_WILLNEED);
+}
+
+size_t Histogram_Cache::find(unsigned int sid) const {
+  const Histogram_Cache_Row *end = table + header->count;
+  const Histogram_Cache_Row *pos = std::lower_bound(table, end, sid, [](const Histogram_Cache_Row &row, unsigned int x) { return row.sid < x; });
+
+  if(pos == end || pos->sid != sid) return header->count;
+  return pos - table;
+}
+
+
+
+Histogram_Cache_Writer::Histogram_Cache_Writer(const std::string &fname) : out(fname, "histogram cache"), offset(HISTOGRAM_CACHE_HEADER) {
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, HISTOGRAM_CACHE_MAGIC, sizeof(header.magic));
+  header.version = HISTOGRAM_CACHE_VERSION;
+  header.bins = BIGRAM_BINS;
+  static_assert(sizeof(Histogram_Cache_Header) <= HISTOGRAM_CACHE_HEADER, "histogram cache header too large");
+  //Placeholder, rewritten by close().
+  out.pad(HISTOGRAM_CACHE_HEADER);
+}
+
+void Histogram_Cache_Writer::add(unsigned int sid, const Bigram_Histogram &histo, const uint8_t *data, size_t data_size) {
+  Histogram_Cache_Row row = { sid, 0, offset, data_size, { 0 } };
+
+  if(!table.empty() && sid <= table.back().sid) throw std::invalid_argument("sids must be added in ascending order");
+  values.clear();
+  bins.clear();
+  for(size_t i = 0; i < BIGRAM_BINS; ++i) {
+    if(histo[i] != 0) {
+      values.push_back(histo[i]);
+      bins.push_back(i);
+    }
+  }
+  row.size = values.size();
+  md5(data, data_size, row.md5);
+  out.write(values.data(), values.size() * sizeof(float));
+  out.write(bins.data(), bins.size() * sizeof(uint16_t));
+  out.pad((bins.size() & 1) * sizeof(uint16_t));
+  offset += row.size * sizeof(float) + (row.size + (row.size & 1)) * sizeof(uint16_t);
+  header.entries += row.size;
+  table.push_back(row);
+}
+
+void Histogram_Cache_Writer::close() {
+  size_t pad = (sizeof(uint64_t) - offset % sizeof(uint64_t)) % sizeof(uint64_t);
+
+  header.count = table.size();
+  header.table_offset = offset + pad;
+  out.pad(pad);
+  out.write(table.data(), table.size() * sizeof(Histogram_Cache_Row));
+  out.seek(0);
+  out.write(&header, sizeof(header));
+  out.commit();
+}
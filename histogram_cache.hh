@@ -0,0 +1,126 @@
+#ifndef __HISTOGRAM_CACHE_HH_2017__
+#define __HISTOGRAM_CACHE_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "bigram.hh"
+#include "mapped_file.hh"
+#include "md5.hh"
+
+/*
+ * The normalised bigram histograms of all files are calculated once and
+ * kept in a cache file which is memory mapped on the next run. Only the
+ * non-zero bins are stored, as float. The file is in native byte order:
+ *
+ *   header   Histogram_Cache_Header, padded to HISTOGRAM_CACHE_HEADER bytes
+ *   rows     for each histogram size floats followed by size uint16_t
+ *            bins (ascending), padded to four bytes
+ *   table    count * Histogram_Cache_Row, ascending sids, aligned to
+ *            eight bytes
+ *
+ * Each row also has the length and the MD5 of the data the histogram
+ * was calculated from. Comparing them with the files table tells
+ * whether a file changed since the cache was built.
+ */
+
+#define HISTOGRAM_CACHE_MAGIC "SIDBGHST"
+#define HISTOGRAM_CACHE_VERSION 2
+#define HISTOGRAM_CACHE_HEADER 64
+
+struct Histogram_Cache_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t bins;
+  uint64_t count;
+  uint64_t entries;
+  uint64_t table_offset;
+};
+
+struct Histogram_Cache_Row {
+  uint32_t sid;
+  uint32_t size;
+  uint64_t offset;
+  uint64_t data_size;
+  uint8_t md5[MD5_DIGEST_SIZE];
+};
+
+/*! \brief Non-zero bins of a normalised bigram histogram
+ */
+struct Sparse_Histogram {
+  const float *values;
+  const uint16_t *bins;
+  size_t size;
+};
+
+/*! \brief Euclidean distance of two sparse histograms
+ *
+ * The sum is done in double precision.
+ */
+double sparse_distance(const Sparse_Histogram &left, const Sparse_Histogram &right);
+
+/*! \brief Read only memory mapped histogram cache
+ */
+class Histogram_Cache {
+  Mapped_File file;
+  const uint8_t *map;
+  const Histogram_Cache_Header *header;
+  const Histogram_Cache_Row *table;
+
+public:
+  /*! \brief Map a cache file
+   *
+   * \param fname file name of the cache
+   */
+  explicit Histogram_Cache(const std::string &fname);
+  Histogram_Cache(const Histogram_Cache &) = delete;
+  Histogram_Cache &operator=(const Histogram_Cache &) = delete;
+
+  /*! \brief Number of histograms in the cache */
+  size_t size() const { return header->count; }
+  /*! \brief Number of non-zero bins of all histograms */
+  size_t entries() const { return header->entries; }
+  unsigned int sid(size_t idx) const { return table[idx].sid; }
+  /*! \brief Whether the histogram was calculated from data of this size and MD5 (hex) */
+  bool is_current(size_t idx, uint64_t data_size, const std::string &md5) const {
+    return table[idx].data_size == data_size && md5_hex(table[idx].md5) == md5;
+  }
+  Sparse_Histogram histogram(size_t idx) const {
+    const float *values = reinterpret_cast<const float *>(map + table[idx].offset);
+    Sparse_Histogram histo = { values, reinterpret_cast<const uint16_t *>(values + table[idx].size), table[idx].size };
+    return histo;
+  }
+  /*! \brief Find the row of a sid
+   *
+   * \return row index or size() if the sid is not in the cache
+   */
+  size_t find(unsigned int sid) const;
+};
+
+/*! \brief Write a histogram cache file
+ *
+ * The sids must be added in ascending order. The cache is written to a
+ * temporary file which is renamed on close().
+ */
+class Histogram_Cache_Writer {
+  Atomic_File out;
+  Histogram_Cache_Header header;
+  std::vector<Histogram_Cache_Row> table;
+  uint64_t offset;
+  std::vector<float> values;
+  std::vector<uint16_t> bins;
+
+public:
+  explicit Histogram_Cache_Writer(const std::string &fname);
+  Histogram_Cache_Writer(const Histogram_Cache_Writer &) = delete;
+  Histogram_Cache_Writer &operator=(const Histogram_Cache_Writer &) = delete;
+
+  /*! \brief Append the non-zero bins of the histogram of data */
+  void add(unsigned int sid, const Bigram_Histogram &histo, const uint8_t *data, size_t data_size);
+  /*! \brief Finish the cache and move it into place */
+  void close();
+  size_t size() const { return table.size(); }
+};
+
+#endif
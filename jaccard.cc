@@ -0,0 +1,222 @@
+#include <cstring>
+#include <string>
+#include "jaccard.hh"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JACCARD_X86 1
+#endif
+
+typedef Bitshred_Counts (*Jaccard_Kernel)(const uint8_t *, const uint8_t *, size_t);
+
+struct Jaccard_Implementation {
+  const char *name;
+  Jaccard_Kernel kernel;
+  bool (*supported)();
+};
+
+static bool always_supported() {
+  return true;
+}
+
+/*! \brief Portable version
+ *
+ * Uses __builtin_popcountll which becomes a hardware instruction if
+ * the compiler is allowed to (e.g. NEON on ARM boards).
+ */
+static Bitshred_Counts counts_scalar(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  return bitshred_counts_any(fst, snd, bytes);
+}
+
+#ifdef JACCARD_X86
+#define TARGET_POPCNT __attribute__((target("sse4.2,popcnt")))
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+
+static bool popcnt_supported() {
+  return __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2");
+}
+
+TARGET_POPCNT static Bitshred_Counts counts_popcnt(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  return bitshred_counts(fst, snd, bytes);
+}
+
+
+static bool avx2_supported() {
+  return __builtin_cpu_supports("avx2") && popcnt_supported();
+}
+
+/*! \brief Bit count of each 64-bit lane (Mula's nibble lookup) */
+TARGET_AVX2 static inline __m256i popcount256(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+					  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(v, low_mask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  __m256i total = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(total, _mm256_setzero_si256());
+}
+
+/*! \brief Carry save adder */
+TARGET_AVX2 static inline void csa(__m256i &h, __m256i &l, __m256i a, __m256i b, __m256i c) {
+  __m256i u = _mm256_xor_si256(a, b);
+  h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  l = _mm256_xor_si256(u, c);
+}
+
+/*! \brief Harley-Seal accumulator
+ *
+ * W. Mula, N. Kurz, D. Lemire, "Faster Population Counts Using AVX2
+ * Instructions", 2016. Sixteen vectors are reduced with carry save
+ * adders, so only one real bit count per 512 bytes is needed.
+ */
+struct Harley_Seal {
+  __m256i total, ones, twos, fours, eights, rest;
+
+  TARGET_AVX2 void clear() {
+    total = ones = twos = fours = eights = rest = _mm256_setzero_si256();
+  }
+  TARGET_AVX2 void add16(const __m256i *v) {
+    __m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b, sixteens;
+
+    csa(twos_a, ones, ones, v[0], v[1]);
+    csa(twos_b, ones, ones, v[2], v[3]);
+    csa(fours_a, twos, twos, twos_a, twos_b);
+    csa(twos_a, ones, ones, v[4], v[5]);
+    csa(twos_b, ones, ones, v[6], v[7]);
+    csa(fours_b, twos, twos, twos_a, twos_b);
+    csa(eights_a, fours, fours, fours_a, fours_b);
+    csa(twos_a, ones, ones, v[8], v[9]);
+    csa(twos_b, ones, ones, v[10], v[11]);
+    csa(fours_a, twos, twos, twos_a, twos_b);
+    csa(twos_a, ones, ones, v[12], v[13]);
+    csa(twos_b, ones, ones, v[14], v[15]);
+    csa(fours_b, twos, twos, twos_a, twos_b);
+    csa(eights_b, fours, fours, fours_a, fours_b);
+    csa(sixteens, eights, eights, eights_a, eights_b);
+    total = _mm256_add_epi64(total, popcount256(sixteens));
+  }
+  TARGET_AVX2 void add(__m256i v) {
+    rest = _mm256_add_epi64(rest, popcount256(v));
+  }
+  TARGET_AVX2 uint64_t sum() {
+    __m256i acc = _mm256_slli_epi64(total, 4);
+    acc = _mm256_add_epi64(acc, _mm256_slli_epi64(popcount256(eights), 3));
+    acc = _mm256_add_epi64(acc, _mm256_slli_epi64(popcount256(fours), 2));
+    acc = _mm256_add_epi64(acc, _mm256_slli_epi64(popcount256(twos), 1));
+    acc = _mm256_add_epi64(acc, popcount256(ones));
+    acc = _mm256_add_epi64(acc, rest);
+    return static_cast<uint64_t>(_mm256_extract_epi64(acc, 0)) + static_cast<uint64_t>(_mm256_extract_epi64(acc, 1))
+      + static_cast<uint64_t>(_mm256_extract_epi64(acc, 2)) + static_cast<uint64_t>(_mm256_extract_epi64(acc, 3));
+  }
+};
+
+TARGET_AVX2 static Bitshred_Counts counts_avx2(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  Harley_Seal intersection, unio;
+  __m256i vand[16], vor[16];
+  Bitshred_Counts counts;
+  size_t i = 0;
+
+  intersection.clear();
+  unio.clear();
+  for(; i + 16 * sizeof(__m256i) <= bytes; i += 16 * sizeof(__m256i)) {
+    for(int k = 0; k < 16; ++k) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(fst + i) + k);
+      __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(snd + i) + k);
+      vand[k] = _mm256_and_si256(x, y);
+      vor[k] = _mm256_or_si256(x, y);
+    }
+    intersection.add16(vand);
+    unio.add16(vor);
+  }
+  for(; i + sizeof(__m256i) <= bytes; i += sizeof(__m256i)) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(fst + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(snd + i));
+    intersection.add(_mm256_and_si256(x, y));
+    unio.add(_mm256_or_si256(x, y));
+  }
+  counts = bitshred_counts(fst + i, snd + i, bytes - i);
+  counts.intersection += intersection.sum();
+  counts.unio += unio.sum();
+  return counts;
+}
+
+
+static bool avx512_supported() {
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq") && popcnt_supported();
+}
+
+TARGET_AVX512 static inline uint64_t sum512(__m512i v) {
+  uint64_t lanes[8];
+
+  _mm512_storeu_si512(lanes, v);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+TARGET_AVX512 static Bitshred_Counts counts_avx512(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  __m512i intersection = _mm512_setzero_si512();
+  __m512i unio = _mm512_setzero_si512();
+  Bitshred_Counts counts;
+  size_t i = 0;
+
+  for(; i + sizeof(__m512i) <= bytes; i += sizeof(__m512i)) {
+    __m512i x = _mm512_loadu_si512(fst + i);
+    __m512i y = _mm512_loadu_si512(snd + i);
+    intersection = _mm512_add_epi64(intersection, _mm512_popcnt_epi64(_mm512_and_si512(x, y)));
+    unio = _mm512_add_epi64(unio, _mm512_popcnt_epi64(_mm512_or_si512(x, y)));
+  }
+  counts = bitshred_counts(fst + i, snd + i, bytes - i);
+  counts.intersection += sum512(intersection);
+  counts.unio += sum512(unio);
+  return counts;
+}
+#endif
+
+/*! \brief All implementations, best last */
+static const Jaccard_Implementation implementations[] = {
+  { "scalar", &counts_scalar, &always_supported },
+#ifdef JACCARD_X86
+  { "popcnt", &counts_popcnt, &popcnt_supported },
+  { "avx2", &counts_avx2, &avx2_supported },
+  { "avx512", &counts_avx512, &avx512_supported },
+#endif
+};
+
+static const Jaccard_Implementation *best_implementation() {
+  const Jaccard_Implementation *best = &implementations[0];
+#ifdef JACCARD_X86
+  __builtin_cpu_init();
+#endif
+  for(auto &i : implementations) {
+    if(i.supported()) best = &i;
+  }
+  return best;
+}
+
+static const Jaccard_Implementation *selected = best_implementation();
+
+Bitshred_Counts jaccard_counts(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  return selected->kernel(fst, snd, bytes);
+}
+
+void jaccard_counts_many(const uint8_t *query, const uint8_t *rows, size_t stride, size_t bytes, size_t count, Bitshred_Counts *out) {
+  Jaccard_Kernel kernel = selected->kernel;
+
+  for(size_t i = 0; i < count; ++i) {
+    out[i] = kernel(query, rows + i * stride, bytes);
+  }
+}
+
+const char *jaccard_kernel_name() {
+  return selected->name;
+}
+
+bool jaccard_select_kernel(const char *name) {
+  for(auto &i : implementations) {
+    if(name == std::string(i.name)) {
+      if(!i.supported()) return false;
+      selected = &i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,56 @@
+#ifndef __JACCARD_HH_2017__
+#define __JACCARD_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include "bitshred.hh"
+
+/*! \brief Count intersection and union bits of two bitshreds
+ *
+ * Both counts are calculated in a single pass. The implementation
+ * (scalar, popcnt, avx2, avx512) is selected on first use by
+ * checking the CPU.
+ *
+ * \param fst first bitshred in bytea layout
+ * \param snd second bitshred in bytea layout
+ * \param bytes size of both bitshreds in bytes
+ * \return counts of the intersection and the union
+ */
+Bitshred_Counts jaccard_counts(const uint8_t *fst, const uint8_t *snd, size_t bytes);
+
+/*! \brief Compare one query against many bitshreds
+ *
+ * The bitshreds are stored one after another, row i starts at rows +
+ * i * stride. This is only a loop over the selected pair kernel, the
+ * dispatch is resolved once. The query is not kept in registers, a
+ * bitshred of 8192 bits needs 32 AVX2 registers, but it stays in the
+ * L1 cache while the rows are streamed.
+ *
+ * \param query query bitshred
+ * \param rows first bitshred to compare with
+ * \param stride distance between two bitshreds in bytes
+ * \param bytes size of each bitshred in bytes
+ * \param count number of bitshreds
+ * \param out array of count results
+ */
+void jaccard_counts_many(const uint8_t *query, const uint8_t *rows, size_t stride, size_t bytes, size_t count, Bitshred_Counts *out);
+
+/*! \brief Jaccard distance from the counts
+ *
+ * Two empty bitshreds have the distance zero.
+ */
+inline double jaccard_distance(const Bitshred_Counts &counts) {
+  if(counts.unio == 0) return 0.0;
+  return 1.0 - static_cast<double>(counts.intersection) / counts.unio;
+}
+
+/*! \brief Name of the selected implementation */
+const char *jaccard_kernel_name();
+
+/*! \brief Force an implementation
+ *
+ * \param name one of scalar, popcnt, avx2, avx512
+ * \return false if the implementation is not available on this CPU
+ */
+bool jaccard_select_kernel(const char *name);
+
+#endif
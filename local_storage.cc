@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "local_storage.hh"
+#include "psid.hh"
+#include "corpus_archive.hh"
+#include "metrics.hh"
+#include "mapped_file.hh"
+
+/*! \brief Read a whole file, false if it does not exist */
+static bool read_file(const std::string &fname, std::string &data) {
+  std::ifstream in(fname, std::ios::binary);
+
+  if(!in) return false;
+  data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  if(in.bad()) throw system_error("can not read", fname);
+  return true;
+}
+
+static uint32_t load_u32(const uint8_t *pos) {
+  uint32_t value;
+
+  std::memcpy(&value, pos, sizeof(value));
+  return value;
+}
+
+/*! \brief Header of a fingerprint file of the kind */
+static std::string fingerprint_header(const std::string &kind) {
+  uint32_t fields[2] = { LOCAL_FINGERPRINT_VERSION, static_cast<uint32_t>(kind.size()) };
+  std::string header(LOCAL_FINGERPRINT_MAGIC);
+
+  header.append(reinterpret_cast<const char *>(fields), sizeof(fields));
+  return header + kind;
+}
+
+/*! \brief All records of a fingerprint file, mapped
+ *
+ * The records are ordered by SID, only the last record of a SID is
+ * kept. A truncated record at the end is ignored, end is the offset
+ * behind the last complete record.
+ */
+struct Fingerprint_Records {
+  std::unique_ptr<Mapped_File> file;
+  /*! \brief SID and offset of the value */
+  std::vector<std::pair<unsigned int, size_t> > records;
+  size_t end;
+
+  const uint8_t *data(size_t i) const { return file->data() + records[i].second; }
+  size_t size(size_t i) const { return load_u32(data(i) - sizeof(uint32_t)); }
+  /*! \brief Size of the file when it was read, 0 if it does not exist */
+  size_t file_size() const { return file ? file->size() : 0; }
+
+  Fingerprint_Records(const std::string &fname, const std::string &kind) : end(0) {
+    std::string header(fingerprint_header(kind));
+    std::vector<std::pair<unsigned int, size_t> > all;
+    struct stat st;
+    size_t pos;
+
+    if(stat(fname.c_str(), &st) != 0) {
+      if(errno == ENOENT) return;
+      throw system_error("can not stat fingerprints", fname);
+    }
+    file.reset(new Mapped_File(fname, "fingerprints", 0));
+    const uint8_t *buffer = file->data();
+    const size_t size = file->size();
+    //The header itself may have been cut off.
+    if(size < header.size()) {
+      if(size > 0 && std::memcmp(buffer, header.data(), size) != 0) throw std::runtime_error("invalid fingerprint file: " + fname);
+      return;
+    }
+    if(!file->has_header(LOCAL_FINGERPRINT_MAGIC, LOCAL_FINGERPRINT_VERSION)) throw std::runtime_error("invalid fingerprint file: " + fname);
+    if(std::memcmp(buffer, header.data(), header.size()) != 0) throw std::runtime_error("fingerprint file '" + fname + "' is not of kind " + kind);
+    pos = header.size();
+    while(pos + 2 * sizeof(uint32_t) <= size) {
+      uint32_t value_size = load_u32(buffer + pos + sizeof(uint32_t));
+      if(value_size > size - pos - 2 * sizeof(uint32_t)) break;
+      all.push_back(std::make_pair(load_u32(buffer + pos), pos + 2 * sizeof(uint32_t)));
+      pos += 2 * sizeof(uint32_t) + value_size;
+    }
+    end = pos;
+    std::stable_sort(all.begin(), all.end(), [](const std::pair<unsigned int, size_t> &x, const std::pair<unsigned int, size_t> &y) { return x.first < y.first; });
+    for(size_t i = 0; i < all.size(); ++i) {
+      if(i + 1 < all.size() && all[i + 1].first == all[i].first) continue;
+      records.push_back(all[i]);
+    }
+  }
+};
+
+/*! \brief SIDs listed in a failure file */
+static void read_failures(const std::string &fname, std::unordered_set<unsigned int> &sids) {
+  std::ifstream in(fname);
+  std::string line;
+
+  while(std::getline(in, line)) {
+    try {
+      sids.insert(std::stoul(line));
+    }
+    catch(const std::exception &) {
+    }
+  }
+}
+
+
+/*! \brief Files without fingerprints, the done SIDs are read once
+ *
+ * The files of an archive are handed out mapped, others are read.
+ */
+class Local_File_Source : public File_Source {
+  std::string root;
+  std::vector<std::pair<unsigned int, std::string> > files;
+  const Corpus_Archive *archive;
+  std::vector<std::unordered_set<unsigned int> > done;
+  size_t min_size;
+
+public:
+  Local_File_Source(const Local_Storage &storage, const std::string &root, const std::vector<std::pair<unsigned int, std::string> > &files, const Corpus_Archive *archive, const std::vector<std::string> &kinds, size_t min_size)
+    : root(root), files(files), archive(archive), done(kinds.size()), min_size(min_size) {
+    for(size_t i = 0; i < kinds.size(); ++i) {
+      Fingerprint_Records fingerprints(storage.fingerprint_file(kinds[i]), kinds[i]);
+      for(auto &record : fingerprints.records) done[i].insert(record.first);
+      read_failures(storage.failure_file(kinds[i]), done[i]);
+    }
+  }
+
+  std::vector<Sid_Data> next(unsigned long after, size_t maxs) {
+    std::vector<Sid_Data> result;
+    auto file = std::upper_bound(files.begin(), files.end(), after, [](unsigned long sid, const std::pair<unsigned int, std::string> &x) { return sid < x.first; });
+    Metrics_Scope scope(metrics().timer("fetch"));
+    Metrics_Counter &fetched(metrics().counter("fetched_bytes"));
+
+    for(; file != files.end() && (maxs == 0 || result.size() < maxs); ++file) {
+      Sid_Data sid_data = { file->first, std::string(), std::vector<bool>(done.size()), NULL, 0 };
+      bool any = false;
+      for(size_t i = 0; i < done.size(); ++i) {
+	sid_data.missing[i] = done[i].count(file->first) == 0;
+	any = any || sid_data.missing[i];
+      }
+      if(!any) continue;
+      if(archive) {
+	size_t idx = archive->find(file->first);
+	sid_data.mapped = archive->data(idx);
+	sid_data.mapped_size = archive->data_size(idx);
+      } else if(!read_file(root + '/' + file->second, sid_data.data)) {
+	std::cerr << "can not read '" << file->second << "'" << std::endl;
+	continue;
+      }
+      if(sid_data.size() < min_size) continue;
+      fetched.add(sid_data.size());
+      result.push_back(std::move(sid_data));
+    }
+    return result;
+  }
+};
+
+
+/*! \brief Appends the fingerprints to the files of their kinds
+ *
+ * The files are flushed after batch_size fingerprints or flush_interval
+ * seconds.
+ */
+class Local_Fingerprint_Writer : public Fingerprint_Writer {
+  std::vector<std::string> kinds;
+  std::vector<std::string> failure_files;
+  std::vector<FILE *> outs;
+  size_t batch_size;
+  std::chrono::duration<double> flush_interval;
+  std::chrono::steady_clock::time_point started;
+  size_t pending;
+
+  void put(FILE *out, const void *data, size_t size, const std::string &kind) {
+    if(fwrite(data, 1, size, out) != size) throw std::runtime_error("can not write fingerprints of " + kind + ": " + std::strerror(errno));
+  }
+
+public:
+  Local_Fingerprint_Writer(const Local_Storage &storage, const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan)
+    : kinds(kinds), batch_size(batch_size), flush_interval(flush_interval), pending(0) {
+    for(auto &kind : kinds) {
+      std::string fname(storage.fingerprint_file(kind));
+      size_t end, size;
+      failure_files.push_back(storage.failure_file(kind));
+      if(rescan && std::remove(failure_files.back().c_str()) != 0 && errno != ENOENT) throw system_error("can not remove", failure_files.back());
+      {
+	Fingerprint_Records existing(fname, kind);
+	end = existing.end;
+	size = existing.file_size();
+      }
+      //A record cut off by a crash would swallow the next one.
+      if(size > end && truncate(fname.c_str(), end) != 0) throw system_error("can not truncate fingerprints", fname);
+      FILE *out = fopen(fname.c_str(), "ab");
+      if(!out) throw system_error("can not open fingerprints", fname);
+      outs.push_back(out);
+      if(fseek(out, 0, SEEK_END) != 0) throw system_error("can not seek", fname);
+      if(ftell(out) == 0) {
+	std::string header(fingerprint_header(kind));
+	put(out, header.data(), header.size(), kind);
+	fflush(out);
+      }
+    }
+  }
+  ~Local_Fingerprint_Writer() {
+    for(auto out : outs) fclose(out);
+  }
+
+  unsigned long start() const { return 0; }
+  void issue(unsigned long) {}
+
+  void write(unsigned long sid, size_t kind, const uint8_t *data, size_t size) {
+    uint32_t header[2] = { static_cast<uint32_t>(sid), static_cast<uint32_t>(size) };
+
+    if(pending++ == 0) started = std::chrono::steady_clock::now();
+    put(outs[kind], header, sizeof(header), kinds[kind]);
+    put(outs[kind], data, size, kinds[kind]);
+    if((batch_size > 0 && pending >= batch_size) || (flush_interval.count() > 0 && std::chrono::steady_clock::now() - started >= flush_interval)) flush();
+  }
+
+  void failed(unsigned long sid, size_t kind, const std::string &reason) {
+    std::ofstream out(failure_files[kind], std::ios::app);
+    std::string line(reason);
+
+    std::replace(line.begin(), line.end(), '\n', ' ');
+    out << sid << '\t' << line << '\n';
+    if(!out) throw system_error("can not write", failure_files[kind]);
+  }
+
+  void done(unsigned long) {}
+  void checkpoint() {}
+
+  void flush() {
+    for(size_t i = 0; i < outs.size(); ++i) {
+      if(fflush(outs[i]) != 0) throw std::runtime_error("can not write fingerprints of " + kinds[i] + ": " + std::strerror(errno));
+    }
+    pending = 0;
+  }
+};
+
+
+Local_Storage::Local_Storage(const std::string &root) : root(root) {
+  struct stat st;
+  std::vector<std::string> found;
+  std::set<std::string> known;
+  unsigned int last;
+  size_t cataloged;
+
+  if(stat(root.c_str(), &st) != 0) throw system_error("can not stat", root);
+  if(S_ISREG(st.st_mode)) {
+    archive.reset(new Corpus_Archive(root));
+    store = root + LOCAL_STORAGE_DIR;
+    if(mkdir(store.c_str(), 0777) != 0 && errno != EEXIST) throw system_error("can not create", store);
+    for(size_t i = 0; i < archive->size(); ++i) files.push_back(std::make_pair(archive->sid(i), std::string(archive->filename(i))));
+    return;
+  }
+  store = root + "/" LOCAL_STORAGE_DIR;
+  if(mkdir(store.c_str(), 0777) != 0 && errno != EEXIST) throw system_error("can not create", store);
+  read_catalog();
+  last = files.empty() ? 0 : files.back().first;
+  cataloged = files.size();
+  for(auto &file : files) known.insert(file.second);
+  find_sid_files(root, false, found);
+  for(auto &path : found) {
+    std::string relative(path.substr(root.size() + (root.back() == '/' ? 0 : 1)));
+    if(known.insert(relative).second) files.push_back(std::make_pair(++last, relative));
+  }
+  if(files.size() > cataloged) write_catalog();
+}
+
+Local_Storage::~Local_Storage() {
+}
+
+void Local_Storage::read_catalog() {
+  std::ifstream in(store + "/files");
+  std::string line;
+
+  while(std::getline(in, line)) {
+    size_t tab = line.find('\t');
+    if(tab == std::string::npos) throw std::runtime_error("invalid catalog line: " + line);
+    files.push_back(std::make_pair(std::stoul(line.substr(0, tab)), line.substr(tab + 1)));
+  }
+  std::sort(files.begin(), files.end());
+}
+
+/*! \brief Write the catalog, it is replaced atomically */
+void Local_Storage::write_catalog() const {
+  Atomic_File out(store + "/files", "catalog");
+  std::ostringstream lines;
+
+  for(auto &file : files) lines << file.first << '\t' << file.second << '\n';
+  std::string text(lines.str());
+  out.write(text.data(), text.size());
+  out.commit();
+}
+
+std::string Local_Storage::fingerprint_file(const std::string &kind) const {
+  std::string name(kind);
+
+  std::replace_if(name.begin(), name.end(), [](char c) { return !isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-'; }, '_');
+  return store + '/' + name + ".fp";
+}
+
+std::string Local_Storage::failure_file(const std::string &kind) const {
+  std::string fname(fingerprint_file(kind));
+
+  return fname.substr(0, fname.size() - 3) + ".failed";
+}
+
+std::unique_ptr<File_Source> Local_Storage::files_without(const std::vector<std::string> &kinds, size_t min_size) {
+  return std::unique_ptr<File_Source>(new Local_File_Source(*this, root, files, archive.get(), kinds, min_size));
+}
+
+std::unique_ptr<Fingerprint_Writer> Local_Storage::writer(const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan) {
+  return std::unique_ptr<Fingerprint_Writer>(new Local_Fingerprint_Writer(*this, kinds, batch_size, flush_interval, rescan));
+}
+
+/*! \brief The records of a kind, mapped again only if the file changed
+ *
+ * The files are only appended to or truncated, so their size tells.
+ */
+const Fingerprint_Records &Local_Storage::records(const std::string &kind) {
+  std::string fname(fingerprint_file(kind));
+  std::unique_ptr<Fingerprint_Records> &cached(fingerprints[kind]);
+  struct stat st;
+  size_t size = 0;
+
+  if(stat(fname.c_str(), &st) == 0) size = st.st_size;
+  if(!cached || cached->file_size() != size) {
+    cached.reset();
+    cached.reset(new Fingerprint_Records(fname, kind));
+  }
+  return *cached;
+}
+
+void Local_Storage::scan(const std::string &kind, const Fingerprint_Callback &fn) {
+  const Fingerprint_Records &fingerprints(records(kind));
+
+  for(size_t i = 0; i < fingerprints.records.size(); ++i) fn(fingerprints.records[i].first, fingerprints.data(i), fingerprints.size(i));
+}
+
+std::vector<std::pair<unsigned int, std::string> > Local_Storage::get(const std::string &kind, const std::vector<unsigned int> &sids) {
+  std::vector<std::pair<unsigned int, std::string> > values;
+  const Fingerprint_Records &fingerprints(records(kind));
+  auto &records(fingerprints.records);
+
+  for(auto sid : sids) {
+    auto pos = std::lower_bound(records.begin(), records.end(), std::make_pair(sid, static_cast<size_t>(0)));
+    if(pos == records.end() || pos->first != sid) continue;
+    size_t i = pos - records.begin();
+    values.push_back(std::make_pair(sid, std::string(reinterpret_cast<const char *>(fingerprints.data(i)), fingerprints.size(i))));
+  }
+  return values;
+}
+
+std::vector<Sid_Entry> Local_Storage::entries(const std::vector<unsigned int> &sids) {
+  std::vector<Sid_Entry> entries;
+  std::set<unsigned int> wanted(sids.begin(), sids.end());
+
+  for(auto &file : files) {
+    if(wanted.count(file.first) == 0) continue;
+    Sid_Entry entry = { file.first, std::string(), std::string(), std::string(), file.second, 0 };
+    std::string data;
+    if(archive) {
+      size_t idx = archive->find(file.first);
+      entry.name = archive->name(idx);
+      entry.author = archive->author(idx);
+      entry.released = archive->released(idx);
+      entry.size = archive->data_size(idx);
+    } else if(read_file(root + '/' + file.second, data)) {
+      entry.size = data.size();
+      try {
+	Psid_Header header(parse_psid(reinterpret_cast<const uint8_t *>(data.data()), data.size()));
+	entry.name = header.name;
+	entry.author = header.author;
+	entry.released = header.released;
+      }
+      catch(const std::exception &) {
+      }
+    }
+    entries.push_back(entry);
+  }
+  return entries;
+}
@@ -0,0 +1,75 @@
+#ifndef __LOCAL_STORAGE_HH_2017__
+#define __LOCAL_STORAGE_HH_2017__
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "storage.hh"
+
+/*
+ * A directory of SID files used without a database, e.g. on a machine
+ * without network. The SIDs are numbered in the catalog
+ * .sidabaeus/files (lines of sid TAB path), files found below the
+ * directory which are not in the catalog get the next numbers.
+ *
+ * The fingerprints of every kind are appended to their own file in
+ * .sidabaeus, in host byte order like the bitshred index:
+ *
+ *   header:  magic, uint32 version, uint32 length of the kind, the kind
+ *   records: uint32 sid, uint32 size, size bytes of the value
+ *
+ * A truncated record at the end, e.g. after a crash, is ignored and
+ * cut off before new fingerprints are appended. Of several records of
+ * a SID the last one counts. SIDs which failed
+ * are listed in a .failed file next to it as sid TAB reason lines.
+ *
+ * Instead of a directory a corpus archive can be given. The files are
+ * then mapped from the archive with the SIDs stored in it and the
+ * fingerprints are kept in the directory <archive>.sidabaeus.
+ */
+
+#define LOCAL_STORAGE_DIR ".sidabaeus"
+#define LOCAL_FINGERPRINT_MAGIC "SIDFPRNT"
+#define LOCAL_FINGERPRINT_VERSION 1
+
+class Corpus_Archive;
+struct Fingerprint_Records;
+
+class Local_Storage : public Sid_Storage {
+  std::string root;
+  std::string store;
+  /*! \brief Catalog ordered by SID, paths relative to root */
+  std::vector<std::pair<unsigned int, std::string> > files;
+  std::unique_ptr<Corpus_Archive> archive;
+  /*! \brief Mapped fingerprint files by kind */
+  std::map<std::string, std::unique_ptr<Fingerprint_Records> > fingerprints;
+
+  void read_catalog();
+  void write_catalog() const;
+  const Fingerprint_Records &records(const std::string &kind);
+
+public:
+  /*!
+   * \param root directory with the SID files, the catalog is updated,
+   *        or a corpus archive
+   */
+  explicit Local_Storage(const std::string &root);
+  ~Local_Storage();
+
+  /*! \brief File with the fingerprints of a kind */
+  std::string fingerprint_file(const std::string &kind) const;
+  /*! \brief File with the failed SIDs of a kind */
+  std::string failure_file(const std::string &kind) const;
+
+  std::unique_ptr<File_Source> files_without(const std::vector<std::string> &kinds, size_t min_size);
+  /*! \brief The fingerprints are appended, there is no resume position */
+  std::unique_ptr<Fingerprint_Writer> writer(const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan);
+
+  void scan(const std::string &kind, const Fingerprint_Callback &fn);
+  std::vector<std::pair<unsigned int, std::string> > get(const std::string &kind, const std::vector<unsigned int> &sids);
+  /*! \brief Name, author, and released are taken from the PSID header or the archive */
+  std::vector<Sid_Entry> entries(const std::vector<unsigned int> &sids);
+};
+
+#endif
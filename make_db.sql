@@ -27,6 +27,8 @@ CREATE INDEX IF NOT EXISTS files_length_data ON files (length(data));
 -- file. Only a single unique tuple of the storage id, first byte,
 -- second byte, and count is allowed. Count has to be greater than or
 -- equal to zero, of course.
+-- The table is not filled any more (3.4 GB), calc_bigram_distances
+-- counts the bigrams directly from files.data.
 CREATE TABLE IF NOT EXISTS bigram_counts (sid INTEGER NOT NULL REFERENCES files ON DELETE CASCADE, fst SMALLINT NOT NULL, snd SMALLINT NOT NULL, count INTEGER NOT NULL, UNIQUE(sid,fst,snd,count), CHECK (count >= 0));
 -- The next table stores the normalised distances of two bigram
 -- counts. For this first the counts are taken from the bigram_counts
@@ -66,6 +68,19 @@ CREATE TABLE IF NOT EXISTS fuzzy_tlsh (sid INTEGER NOT NULL REFERENCES files ON
 CREATE TABLE IF NOT EXISTS fuzzy_ssdeep (sid INTEGER NOT NULL REFERENCES files ON DELETE CASCADE, blocksize INTEGER NOT NULL, hash TEXT NOT NULL, CHECK(blocksize > 0), PRIMARY KEY (sid));
 CREATE INDEX IF NOT EXISTS fuzzy_ssdeep_blocksize ON fuzzy_ssdeep (blocksize);
 CREATE INDEX IF NOT EXISTS fuzzy_ssdeep_hash ON fuzzy_ssdeep (hash);
+-- Keys of the 7-grams of the ssdeep signatures with their blocksizes,
+-- see ssdeep_ngrams.hh. Only hashes sharing a key are compared.
+CREATE TABLE IF NOT EXISTS fuzzy_ssdeep_ngrams (sid INTEGER NOT NULL REFERENCES fuzzy_ssdeep ON DELETE CASCADE, ngrams BIGINT[] NOT NULL, PRIMARY KEY (sid));
+CREATE INDEX IF NOT EXISTS fuzzy_ssdeep_ngrams_idx ON fuzzy_ssdeep_ngrams USING GIN (ngrams);
+
+
+-- The calculators scan the files by ascending sid. For each task (a
+-- bitshred configuration like 'bitshred 8192:5:djb2', 'fuzzy_tlsh', or
+-- 'fuzzy_ssdeep') all files up to last_sid have been handled, a
+-- restarted calculator continues there.
+CREATE TABLE IF NOT EXISTS calc_progress (task TEXT PRIMARY KEY, last_sid INTEGER NOT NULL);
+-- Files which could not be hashed by a task, they are skipped.
+CREATE TABLE IF NOT EXISTS calc_failures (task TEXT NOT NULL, sid INTEGER NOT NULL REFERENCES files ON DELETE CASCADE, reason TEXT, PRIMARY KEY (task, sid));
 
 
 -- Very slow?
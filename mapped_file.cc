@@ -0,0 +1,111 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.hh"
+
+std::runtime_error system_error(const std::string &what, const std::string &fname) {
+  return std::runtime_error(what + " '" + fname + "': " + std::strerror(errno));
+}
+
+std::runtime_error system_error(const std::string &what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+Mapped_File::Mapped_File(const std::string &fname, const std::string &what, size_t min_size) : map(NULL), map_size(0) {
+  struct stat st;
+  int fd = open(fname.c_str(), O_RDONLY);
+
+  if(fd < 0) throw system_error("can not open " + what, fname);
+  if(fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw system_error("can not stat " + what, fname);
+  }
+  map_size = st.st_size;
+  if(map_size < min_size) {
+    ::close(fd);
+    throw std::runtime_error(what + " too short: " + fname);
+  }
+  if(map_size == 0) {
+    ::close(fd);
+    return;
+  }
+  void *ptr = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(ptr == MAP_FAILED) throw system_error("can not map " + what, fname);
+  map = static_cast<const uint8_t *>(ptr);
+}
+
+Mapped_File::~Mapped_File() {
+  if(map) munmap(const_cast<uint8_t *>(map), map_size);
+}
+
+bool Mapped_File::has_header(const char *magic, uint32_t version) const {
+  uint32_t stored;
+
+  if(map_size < 8 + sizeof(stored) || std::memcmp(map, magic, 8) != 0) return false;
+  std::memcpy(&stored, map + 8, sizeof(stored));
+  return stored == version;
+}
+
+void Mapped_File::advise(int advice) const {
+  if(map) madvise(const_cast<uint8_t *>(map), map_size, advice);
+}
+
+
+Atomic_File::Atomic_File(const std::string &fname, const std::string &what) : fname(fname), tmpname(fname + ".tmp"), what(what), out(NULL) {
+  out = fopen(tmpname.c_str(), "wb");
+  if(!out) throw system_error("can not create " + what, tmpname);
+}
+
+Atomic_File::~Atomic_File() {
+  if(out) discard();
+}
+
+void Atomic_File::discard() {
+  fclose(out);
+  out = NULL;
+  unlink(tmpname.c_str());
+}
+
+void Atomic_File::write(const void *data, size_t size) {
+  if(!out) throw std::logic_error(what + " already committed: " + fname);
+  if(size > 0 && fwrite(data, 1, size, out) != size) throw system_error("can not write " + what, tmpname);
+}
+
+void Atomic_File::pad(size_t size) {
+  static const uint8_t zeros[256] = { 0 };
+
+  while(size > 0) {
+    size_t chunk = size < sizeof(zeros) ? size : sizeof(zeros);
+    write(zeros, chunk);
+    size -= chunk;
+  }
+}
+
+void Atomic_File::seek(uint64_t offset) {
+  if(!out) throw std::logic_error(what + " already committed: " + fname);
+  if(fseeko(out, offset, SEEK_SET) != 0) throw system_error("can not write " + what, tmpname);
+}
+
+void Atomic_File::commit() {
+  bool ok;
+
+  if(!out) throw std::logic_error(what + " already committed: " + fname);
+  ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+  if(fclose(out) != 0) ok = false;
+  out = NULL;
+  if(!ok) {
+    std::runtime_error error(system_error("can not write " + what, tmpname));
+    unlink(tmpname.c_str());
+    throw error;
+  }
+  if(rename(tmpname.c_str(), fname.c_str()) != 0) {
+    std::runtime_error error(system_error("can not rename " + what, fname));
+    unlink(tmpname.c_str());
+    throw error;
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef __MAPPED_FILE_HH_2017__
+#define __MAPPED_FILE_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+/*
+ * The binary files of the tools (bitshred and LSH indexes, histogram
+ * cache, corpus archive, local fingerprints) are memory mapped for
+ * reading. They are written under a temporary name and renamed when
+ * complete, so a reader never sees a half written file. All of them
+ * start with an eight byte magic followed by a uint32 version.
+ */
+
+/*! \brief Exception with the file name and the message of errno */
+std::runtime_error system_error(const std::string &what, const std::string &fname);
+/*! \brief Exception with the message of errno */
+std::runtime_error system_error(const std::string &what);
+
+/*! \brief Read only memory map of a whole file
+ */
+class Mapped_File {
+  const uint8_t *map;
+  size_t map_size;
+
+public:
+  /*!
+   * \param fname file to map
+   * \param what description of the file for the error messages
+   * \param min_size shorter files are rejected, an empty file is not
+   *        mapped if 0
+   */
+  Mapped_File(const std::string &fname, const std::string &what, size_t min_size);
+  ~Mapped_File();
+  Mapped_File(const Mapped_File &) = delete;
+  Mapped_File &operator=(const Mapped_File &) = delete;
+
+  const uint8_t *data() const { return map; }
+  size_t size() const { return map_size; }
+  /*! \brief True if the file starts with the magic and the version */
+  bool has_header(const char *magic, uint32_t version) const;
+  /*! \brief madvise() the whole mapping */
+  void advise(int advice) const;
+};
+
+/*! \brief File written under a temporary name and moved into place
+ *
+ * commit() syncs the data to disk before the rename, so after a crash
+ * either the old or the complete new file is found. Without commit()
+ * the temporary file is removed.
+ */
+class Atomic_File {
+  std::string fname;
+  std::string tmpname;
+  std::string what;
+  FILE *out;
+
+  void discard();
+
+public:
+  /*!
+   * \param fname final name of the file
+   * \param what description of the file for the error messages
+   */
+  Atomic_File(const std::string &fname, const std::string &what);
+  ~Atomic_File();
+  Atomic_File(const Atomic_File &) = delete;
+  Atomic_File &operator=(const Atomic_File &) = delete;
+
+  void write(const void *data, size_t size);
+  /*! \brief Write size zero bytes */
+  void pad(size_t size);
+  /*! \brief Position of the next write, e.g. to rewrite a placeholder header */
+  void seek(uint64_t offset);
+  /*! \brief Sync, close, and rename the file */
+  void commit();
+};
+
+#endif
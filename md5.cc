@@ -0,0 +1,83 @@
+#include <cstring>
+#include "md5.hh"
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned int md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_block(const uint8_t *block, uint32_t *state) {
+  uint32_t w[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+  for(int i = 0; i < 16; ++i) {
+    w[i] = block[4 * i] | block[4 * i + 1] << 8 | block[4 * i + 2] << 16 | static_cast<uint32_t>(block[4 * i + 3]) << 24;
+  }
+  for(int i = 0; i < 64; ++i) {
+    uint32_t f;
+    int g;
+    if(i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if(i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if(i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    f += a + md5_k[i] + w[g];
+    a = d;
+    d = c;
+    c = b;
+    b += f << md5_r[i] | f >> (32 - md5_r[i]);
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void md5(const uint8_t *data, size_t size, uint8_t *digest) {
+  uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  uint8_t tail[128];
+  size_t full = size / 64 * 64, rest = size - full;
+  size_t tail_size = rest < 56 ? 64 : 128;
+  uint64_t bits = static_cast<uint64_t>(size) * 8;
+
+  for(size_t i = 0; i < full; i += 64) md5_block(data + i, state);
+  //The rest, 0x80, zeros and the length in bits fill one or two blocks.
+  std::memset(tail, 0, sizeof(tail));
+  if(rest > 0) std::memcpy(tail, data + full, rest);
+  tail[rest] = 0x80;
+  for(int i = 0; i < 8; ++i) tail[tail_size - 8 + i] = bits >> (8 * i);
+  for(size_t i = 0; i < tail_size; i += 64) md5_block(tail + i, state);
+  for(int i = 0; i < 16; ++i) digest[i] = state[i / 4] >> (8 * (i % 4));
+}
+
+std::string md5_hex(const uint8_t *digest) {
+  static const char hex[] = "0123456789abcdef";
+  std::string result;
+
+  for(int i = 0; i < MD5_DIGEST_SIZE; ++i) {
+    result += hex[digest[i] >> 4];
+    result += hex[digest[i] & 15];
+  }
+  return result;
+}
@@ -0,0 +1,27 @@
+#ifndef __MD5_HH_2017__
+#define __MD5_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/*
+ * MD5 (RFC 1321) of a buffer. It is not used for security: the
+ * histogram cache stores the digest of the data of each file and
+ * compares it with md5(data) computed by the database, so a changed
+ * file is noticed without fetching it.
+ */
+
+#define MD5_DIGEST_SIZE 16
+
+/*! \brief Digest of the data
+ *
+ * \param data data to hash
+ * \param size size of the data in bytes
+ * \param digest MD5_DIGEST_SIZE bytes for the result
+ */
+void md5(const uint8_t *data, size_t size, uint8_t *digest);
+
+/*! \brief Digest as lower case hex, as returned by PostgreSQL md5() */
+std::string md5_hex(const uint8_t *digest);
+
+#endif
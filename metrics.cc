@@ -0,0 +1,168 @@
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <boost/format.hpp>
+#include "metrics.hh"
+#include "mapped_file.hh"
+
+Metrics_Timer::Metrics_Timer() : count(0), nanoseconds(0) {
+  for(auto &i : buckets) i.store(0, std::memory_order_relaxed);
+}
+
+void Metrics_Timer::record(uint64_t ns) {
+  uint64_t us = ns / 1000;
+  size_t idx = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+  count.fetch_add(1, std::memory_order_relaxed);
+  nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+  buckets[idx < METRICS_BUCKETS ? idx : METRICS_BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+}
+
+double Metrics_Timer::bound(size_t i) {
+  if(i + 1 >= METRICS_BUCKETS) return std::numeric_limits<double>::infinity();
+  return std::ldexp(1e-6, i);
+}
+
+
+Metrics::Metrics() : started(std::chrono::steady_clock::now()) {
+}
+
+Metrics_Counter &Metrics::counter(const std::string &name) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::unique_ptr<Metrics_Counter> &entry(counters[name]);
+
+  if(!entry) entry.reset(new Metrics_Counter);
+  return *entry;
+}
+
+Metrics_Timer &Metrics::timer(const std::string &stage) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::unique_ptr<Metrics_Timer> &entry(timers[stage]);
+
+  if(!entry) entry.reset(new Metrics_Timer);
+  return *entry;
+}
+
+std::string Metrics::json() const {
+  std::lock_guard<std::mutex> guard(lock);
+  std::ostringstream out;
+  bool first = true;
+
+  out << "{\n  \"timestamp\": " << std::time(NULL)
+      << ",\n  \"uptime\": " << boost::format("%.3f") % std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count()
+      << ",\n  \"counters\": {";
+  for(auto &i : counters) {
+    out << (first ? "\n" : ",\n") << "    \"" << i.first << "\": " << i.second->get();
+    first = false;
+  }
+  out << "\n  },\n  \"stages\": {";
+  first = true;
+  for(auto &i : timers) {
+    const Metrics_Timer &timer(*i.second);
+    uint64_t cumulative = 0;
+    out << (first ? "\n" : ",\n") << "    \"" << i.first << "\": { \"count\": " << timer.calls()
+	<< ", \"seconds\": " << boost::format("%.9g") % timer.seconds()
+	<< ", \"buckets\": [";
+    //Only the buckets up to the longest call are listed.
+    size_t last = 0;
+    for(size_t b = 0; b < METRICS_BUCKETS; ++b) {
+      if(timer.bucket(b) > 0) last = b;
+    }
+    for(size_t b = 0; b <= last && timer.calls() > 0; ++b) {
+      cumulative += timer.bucket(b);
+      out << (b == 0 ? "" : ", ") << "[" << (b + 1 < METRICS_BUCKETS ? (boost::format("%.9g") % Metrics_Timer::bound(b)).str() : std::string("null")) << ", " << cumulative << "]";
+    }
+    out << "] }";
+    first = false;
+  }
+  out << "\n  }\n}\n";
+  return out.str();
+}
+
+std::string Metrics::prometheus(const std::string &tool) const {
+  std::lock_guard<std::mutex> guard(lock);
+  std::ostringstream out;
+  std::string job("job=\"" + tool + "\"");
+
+  out << "# HELP sidabaeus_uptime_seconds Seconds since the start of the tool.\n"
+      << "# TYPE sidabaeus_uptime_seconds gauge\n"
+      << "sidabaeus_uptime_seconds{" << job << "} " << boost::format("%.3f") % std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() << '\n';
+  for(auto &i : counters) {
+    out << "# TYPE sidabaeus_" << i.first << "_total counter\n"
+	<< "sidabaeus_" << i.first << "_total{" << job << "} " << i.second->get() << '\n';
+  }
+  if(!timers.empty()) {
+    out << "# HELP sidabaeus_stage_seconds Duration of the calls of a stage.\n"
+	<< "# TYPE sidabaeus_stage_seconds histogram\n";
+  }
+  for(auto &i : timers) {
+    const Metrics_Timer &timer(*i.second);
+    std::string labels(job + ",stage=\"" + i.first + "\"");
+    uint64_t cumulative = 0;
+    for(size_t b = 0; b < METRICS_BUCKETS; ++b) {
+      cumulative += timer.bucket(b);
+      out << "sidabaeus_stage_seconds_bucket{" << labels << ",le=\"";
+      if(b + 1 < METRICS_BUCKETS) {
+	out << boost::format("%.9g") % Metrics_Timer::bound(b);
+      } else {
+	out << "+Inf";
+      }
+      out << "\"} " << cumulative << '\n';
+    }
+    out << "sidabaeus_stage_seconds_sum{" << labels << "} " << boost::format("%.9g") % timer.seconds() << '\n'
+	<< "sidabaeus_stage_seconds_count{" << labels << "} " << timer.calls() << '\n';
+  }
+  return out.str();
+}
+
+Metrics &metrics() {
+  static Metrics registry;
+
+  return registry;
+}
+
+
+Metrics_Exporter::Metrics_Exporter(const std::string &fname, const std::string &tool, double interval) : fname(fname), tool(tool), interval(interval), stopping(false) {
+  if(fname.empty()) return;
+  if(interval > 0) exporter = std::thread([this]() { run(); });
+}
+
+Metrics_Exporter::~Metrics_Exporter() {
+  if(exporter.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    exporter.join();
+  }
+  if(!fname.empty()) export_now();
+}
+
+void Metrics_Exporter::run() {
+  std::unique_lock<std::mutex> guard(lock);
+
+  while(!wakeup.wait_for(guard, interval, [this] { return stopping; })) {
+    guard.unlock();
+    export_now();
+    guard.lock();
+  }
+}
+
+void Metrics_Exporter::export_now() {
+  bool prom = fname.size() >= 5 && fname.compare(fname.size() - 5, 5, ".prom") == 0;
+  std::string text(prom ? metrics().prometheus(tool) : metrics().json());
+
+  //The tool keeps running if the metrics can not be written.
+  try {
+    Atomic_File out(fname, "metrics");
+    out.write(text.data(), text.size());
+    out.commit();
+  }
+  catch(const std::exception &excp) {
+    std::cerr << excp.what() << std::endl;
+  }
+}
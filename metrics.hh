@@ -0,0 +1,133 @@
+#ifndef __METRICS_HH_2017__
+#define __METRICS_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Counters and stage timers of the hot paths, cheap enough to stay
+ * enabled in production. The stages are named after what they do:
+ *
+ *   fetch    reading files or fingerprints from the storage
+ *   decode   converting the database values (bytea) into bytes
+ *   hash     calculating fingerprints
+ *   compare  calculating distances
+ *   select   picking the closest results
+ *   write    storing results
+ *   commit   completing a COPY into the database
+ *   request  answering a request of the query daemon
+ *
+ * A timer counts the calls, sums their duration, and sorts them into a
+ * latency histogram with power of two buckets from 1 us up. All updates
+ * are relaxed atomics, so any thread may record without a lock. The
+ * registry is exported periodically by a Metrics_Exporter.
+ */
+
+/*! \brief Buckets of the latency histogram, the last one is unbounded */
+#define METRICS_BUCKETS 28
+
+class Metrics_Counter {
+  std::atomic<uint64_t> value;
+
+public:
+  Metrics_Counter() : value(0) {}
+  void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+class Metrics_Timer {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> nanoseconds;
+  std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+
+public:
+  Metrics_Timer();
+  /*! \brief Record a call, bucket i holds the calls shorter than 2^i us */
+  void record(uint64_t ns);
+  uint64_t calls() const { return count.load(std::memory_order_relaxed); }
+  double seconds() const { return nanoseconds.load(std::memory_order_relaxed) * 1e-9; }
+  uint64_t bucket(size_t i) const { return buckets[i].load(std::memory_order_relaxed); }
+  /*! \brief Upper bound of a bucket in seconds, infinite for the last */
+  static double bound(size_t i);
+};
+
+/*! \brief Times the scope it lives in */
+class Metrics_Scope {
+  Metrics_Timer &timer;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  explicit Metrics_Scope(Metrics_Timer &timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+  ~Metrics_Scope() { timer.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()); }
+  Metrics_Scope(const Metrics_Scope &) = delete;
+  Metrics_Scope &operator=(const Metrics_Scope &) = delete;
+};
+
+/*! \brief Named counters and timers of the process
+ *
+ * The references returned stay valid for the lifetime of the process,
+ * so hot loops look them up once.
+ */
+class Metrics {
+  mutable std::mutex lock;
+  std::map<std::string, std::unique_ptr<Metrics_Counter> > counters;
+  std::map<std::string, std::unique_ptr<Metrics_Timer> > timers;
+  std::chrono::steady_clock::time_point started;
+
+public:
+  Metrics();
+  Metrics_Counter &counter(const std::string &name);
+  Metrics_Timer &timer(const std::string &stage);
+  /*! \brief Current values as a JSON object */
+  std::string json() const;
+  /*! \brief Current values in the Prometheus text format
+   *
+   * The timers are the histogram sidabaeus_stage_seconds with the
+   * label stage, the counters are sidabaeus_<name>_total.
+   */
+  std::string prometheus(const std::string &tool) const;
+};
+
+/*! \brief Registry of the process */
+Metrics &metrics();
+
+/*! \brief Write the metrics to a file every interval seconds
+ *
+ * The file is replaced with rename, so a reader like the textfile
+ * collector of the node_exporter never sees a partial file. A name
+ * ending in .prom selects the Prometheus format, otherwise JSON is
+ * written. The last export is done by the destructor.
+ */
+class Metrics_Exporter {
+  std::string fname;
+  std::string tool;
+  std::chrono::duration<double> interval;
+  std::mutex lock;
+  std::condition_variable wakeup;
+  bool stopping;
+  std::thread exporter;
+
+  void run();
+
+public:
+  /*!
+   * \param fname output file, nothing is exported if empty
+   * \param tool name of the tool, the label job in Prometheus
+   * \param interval seconds between exports
+   */
+  Metrics_Exporter(const std::string &fname, const std::string &tool, double interval);
+  ~Metrics_Exporter();
+  Metrics_Exporter(const Metrics_Exporter &) = delete;
+  Metrics_Exporter &operator=(const Metrics_Exporter &) = delete;
+  /*! \brief Write the file now */
+  void export_now();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <stdexcept>
+#include "minhash.hh"
+#include "hash.hh"
+
+/*! \brief splitmix32 step, used to derive the hash functions */
+static uint32_t next_seed(uint32_t &state) {
+  state += 0x9E3779B9u;
+  return hash_fmix32(state);
+}
+
+Minhasher::Minhasher(unsigned int bands, unsigned int rows) : bands(bands), rows(rows) {
+  uint32_t state = 0;
+
+  if(bands == 0 || rows == 0) throw std::invalid_argument("LSH bands and rows must be positive");
+  for(unsigned int i = 0; i < bands * rows; ++i) {
+    mult.push_back(next_seed(state) | 1);
+    add.push_back(next_seed(state));
+  }
+}
+
+void Minhasher::signature(const uint8_t *data, size_t bytes, std::vector<uint32_t> &signature) const {
+  const size_t k = mult.size();
+
+  signature.assign(k, 0xFFFFFFFFu);
+  for(size_t i = 0; i < bytes; i += sizeof(uint64_t)) {
+    uint64_t word;
+    if(i + sizeof(uint64_t) <= bytes) {
+      word = bitshred_load_word(data + i);
+    } else {
+      word = 0;
+      std::memcpy(&word, data + i, bytes - i);
+    }
+    while(word) {
+      unsigned int t = __builtin_ctzll(word);
+      word &= word - 1;
+      //Bit t/8 of the word is byte t/8, bit 0 is the most significant.
+      uint32_t element = hash_fmix32((i + t / 8) * 8 + 7 - t % 8);
+      for(size_t j = 0; j < k; ++j) {
+	uint32_t h = element * mult[j] + add[j];
+	if(h < signature[j]) signature[j] = h;
+      }
+    }
+  }
+}
+
+uint32_t Minhasher::band_key(const std::vector<uint32_t> &signature, unsigned int band) const {
+  uint32_t key = band * 0x9E3779B9u;
+
+  for(unsigned int r = 0; r < rows; ++r) key = hash_fmix32(key ^ signature[band * rows + r]);
+  return key;
+}
+
+
+Minhash_Index::Minhash_Index(const std::string &fname) : file(fname, "LSH index", MINHASH_INDEX_HEADER), header(NULL), sids(NULL), buckets(NULL), hasher(1, 1) {
+  header = reinterpret_cast<const Minhash_Index_Header *>(file.data());
+  if(!file.has_header(MINHASH_INDEX_MAGIC, MINHASH_INDEX_VERSION)
+     || header->bands == 0 || header->rows == 0
+     || header->sids_offset + header->count * sizeof(uint32_t) > file.size()
+     || header->buckets_offset + header->bands * header->count * sizeof(Minhash_Bucket) > file.size()) {
+    throw std::runtime_error("invalid LSH index: " + fname);
+  }
+  sids = reinterpret_cast<const uint32_t *>(file.data() + header->sids_offset);
+  buckets = reinterpret_cast<const Minhash_Bucket *>(file.data() + header->buckets_offset);
+  hasher = Minhasher(header->bands, header->rows);
+}
+
+std::vector<unsigned int> Minhash_Index::candidates(const uint8_t *data, size_t bytes) const {
+  std::vector<uint32_t> signature;
+  std::vector<unsigned int> result;
+  auto cmp = [](const Minhash_Bucket &x, const Minhash_Bucket &y) { return x.key < y.key; };
+
+  hasher.signature(data, bytes, signature);
+  for(unsigned int band = 0; band < header->bands; ++band) {
+    const Minhash_Bucket *begin = buckets + band * header->count;
+    const Minhash_Bucket probe = { hasher.band_key(signature, band), 0 };
+    auto range = std::equal_range(begin, begin + header->count, probe, cmp);
+    for(auto i = range.first; i != range.second; ++i) result.push_back(sids[i->row]);
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+
+unsigned long write_minhash_index(const std::string &fname, const Bitshred_Block &block, unsigned int m, unsigned int n, const std::string &hash, unsigned int bands, unsigned int rows) {
+  Minhasher hasher(bands, rows);
+  Minhash_Index_Header header;
+  std::vector<Minhash_Bucket> buckets(static_cast<size_t>(bands) * block.count);
+  std::vector<uint32_t> signature;
+  Atomic_File out(fname, "LSH index");
+
+  if(hash.size() >= sizeof(header.hash)) throw std::invalid_argument("hash name too long for LSH index");
+  static_assert(sizeof(Minhash_Index_Header) <= MINHASH_INDEX_HEADER, "LSH index header too large");
+  for(size_t i = 0; i < block.count; ++i) {
+    hasher.signature(block.shred(i), block.bytes, signature);
+    for(unsigned int band = 0; band < bands; ++band) {
+      Minhash_Bucket bucket = { hasher.band_key(signature, band), static_cast<uint32_t>(i) };
+      buckets[band * block.count + i] = bucket;
+    }
+  }
+  for(unsigned int band = 0; band < bands; ++band) {
+    auto begin = buckets.begin() + band * block.count;
+    std::sort(begin, begin + block.count, [](const Minhash_Bucket &x, const Minhash_Bucket &y) { return x.key < y.key || (x.key == y.key && x.row < y.row); });
+  }
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MINHASH_INDEX_MAGIC, sizeof(header.magic));
+  std::memcpy(header.hash, hash.data(), hash.size());
+  header.version = MINHASH_INDEX_VERSION;
+  header.m = m;
+  header.n = n;
+  header.bands = bands;
+  header.rows = rows;
+  header.count = block.count;
+  header.sids_offset = MINHASH_INDEX_HEADER;
+  header.buckets_offset = (header.sids_offset + block.count * sizeof(uint32_t) + 7) / 8 * 8;
+
+  out.write(&header, sizeof(header));
+  out.pad(MINHASH_INDEX_HEADER - sizeof(header));
+  out.write(block.sids, block.count * sizeof(uint32_t));
+  out.pad(header.buckets_offset - header.sids_offset - block.count * sizeof(uint32_t));
+  out.write(buckets.data(), buckets.size() * sizeof(Minhash_Bucket));
+  out.commit();
+  return block.count;
+}
@@ -0,0 +1,115 @@
+#ifndef __MINHASH_HH_2017__
+#define __MINHASH_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bitshred.hh"
+#include "mapped_file.hh"
+
+/*
+ * Locality sensitive hashing of bitshreds. The set bits of a bitshred
+ * are the set whose Jaccard similarity is estimated by a MinHash
+ * signature of bands * rows values. The rows of each band are hashed
+ * into a bucket key; two bitshreds with similarity s share at least one
+ * bucket with probability 1 - (1 - s^rows)^bands. Only the bitshreds
+ * sharing a bucket with the query are compared exactly.
+ *
+ * The index file is in native byte order:
+ *
+ *   header   Minhash_Index_Header, padded to MINHASH_INDEX_HEADER bytes
+ *   sids     count * uint32_t, ascending
+ *   buckets  for each band count * Minhash_Bucket sorted by key
+ */
+
+#define MINHASH_INDEX_MAGIC "SIDBSLSH"
+#define MINHASH_INDEX_VERSION 1
+#define MINHASH_INDEX_HEADER 128
+/*! \brief Default number of bands */
+#define MINHASH_BANDS 32
+/*! \brief Default number of rows per band */
+#define MINHASH_ROWS 4
+
+struct Minhash_Index_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t m;
+  uint32_t n;
+  uint32_t bands;
+  uint32_t rows;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t sids_offset;
+  uint64_t buckets_offset;
+  char hash[16];
+};
+
+struct Minhash_Bucket {
+  uint32_t key;
+  uint32_t row;
+};
+
+/*! \brief MinHash signatures and band keys
+ *
+ * The hash functions are fixed, so signatures of different runs can be
+ * compared.
+ */
+class Minhasher {
+  unsigned int bands;
+  unsigned int rows;
+  std::vector<uint32_t> mult;
+  std::vector<uint32_t> add;
+
+public:
+  Minhasher(unsigned int bands, unsigned int rows);
+  unsigned int band_count() const { return bands; }
+  unsigned int row_count() const { return rows; }
+  /*! \brief Signature of the set bits of a bitshred in bytea layout
+   *
+   * \param signature bands * rows minima, all 0xFFFFFFFF if no bit is set
+   */
+  void signature(const uint8_t *data, size_t bytes, std::vector<uint32_t> &signature) const;
+  /*! \brief Bucket key of a band of the signature */
+  uint32_t band_key(const std::vector<uint32_t> &signature, unsigned int band) const;
+};
+
+/*! \brief Read only memory mapped LSH index
+ */
+class Minhash_Index {
+  Mapped_File file;
+  const Minhash_Index_Header *header;
+  const uint32_t *sids;
+  const Minhash_Bucket *buckets;
+  Minhasher hasher;
+
+public:
+  explicit Minhash_Index(const std::string &fname);
+  Minhash_Index(const Minhash_Index &) = delete;
+  Minhash_Index &operator=(const Minhash_Index &) = delete;
+
+  unsigned int m() const { return header->m; }
+  unsigned int n() const { return header->n; }
+  std::string hash() const { return std::string(header->hash, strnlen(header->hash, sizeof(header->hash))); }
+  unsigned int bands() const { return header->bands; }
+  unsigned int rows() const { return header->rows; }
+  size_t size() const { return header->count; }
+  unsigned int sid(size_t idx) const { return sids[idx]; }
+  /*! \brief SIDs sharing at least one bucket with the bitshred
+   *
+   * \param data bitshred in bytea layout
+   * \param bytes size of the bitshred
+   * \return ascending SIDs
+   */
+  std::vector<unsigned int> candidates(const uint8_t *data, size_t bytes) const;
+};
+
+/*! \brief Write an LSH index for all bitshreds of a block
+ *
+ * \param fname file name of the index, written via a temporary file
+ * \param block all bitshreds, ascending SIDs
+ * \return number of bitshreds in the index
+ */
+unsigned long write_minhash_index(const std::string &fname, const Bitshred_Block &block, unsigned int m, unsigned int n, const std::string &hash, unsigned int bands, unsigned int rows);
+
+#endif
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include "pg_storage.hh"
+#include "bulk_writer.hh"
+#include "sid_cursor.hh"
+#include "ssdeep_ngrams.hh"
+#include "binary_copy.hh"
+#include "metrics.hh"
+
+#define RESULT_STRIDE 89
+#define SCAN_STRIDE 1019
+#define INDEX_STRIDE 1021
+
+/*! \brief Table holding the fingerprints of a kind */
+static std::string kind_table(const std::string &kind) {
+  unsigned int m, n;
+  std::string hash;
+
+  if(parse_bitshred_kind(kind, m, n, hash)) return "bitshred";
+  if(kind == TLSH_KIND || kind == SSDEEP_KIND) return kind;
+  throw std::invalid_argument("unknown fingerprint kind: " + kind);
+}
+
+/*! \brief Condition selecting the rows of a kind in its table */
+static std::string kind_condition(pqxx::work &txn, const std::string &kind) {
+  unsigned int m, n;
+  std::string hash;
+  std::ostringstream condition;
+
+  if(!parse_bitshred_kind(kind, m, n, hash)) return "TRUE";
+  condition << "m = " << txn.quote(m)
+	    << " AND n = " << txn.quote(n)
+	    << " AND hash = " << txn.quote(hash);
+  return condition.str();
+}
+
+/*! \brief Columns after the sid which make up the value of a kind */
+static const char *kind_columns(const std::string &kind) {
+  if(kind == SSDEEP_KIND) return "blocksize, hash";
+  if(kind == TLSH_KIND) return "hash";
+  return "bitshred";
+}
+
+/*! \brief Hand the value of a row selected with kind_columns() to fn */
+static void row_fingerprint(const std::string &kind, const pqxx::result::tuple &row, const Fingerprint_Callback &fn) {
+  unsigned int sid = row[0].as<unsigned int>();
+
+  if(kind == SSDEEP_KIND) {
+    std::string hash(row[1].as<std::string>() + ':' + row[2].c_str());
+    fn(sid, reinterpret_cast<const uint8_t *>(hash.data()), hash.size());
+  } else {
+    pqxx::binarystring value(row[1]);
+    fn(sid, value.data(), value.size());
+  }
+}
+
+template<typename T> static void sid_list(std::ostream &out, const std::vector<T> &sids) {
+  std::copy(sids.begin(), sids.end() - 1, std::ostream_iterator<T>(out, ","));
+  out << sids.back();
+}
+
+
+/*! \brief Files without fingerprints, walks the files along the primary key */
+class Pg_File_Source : public File_Source {
+  pqxx::connection conn;
+  std::vector<std::string> kinds;
+  size_t min_size;
+  Metrics_Timer &fetch_timer;
+  Metrics_Timer &decode_timer;
+  Metrics_Counter &fetched;
+
+  /*! \brief Condition for files without a fingerprint of the kind
+   *
+   * Files for which the kind failed are skipped.
+   */
+  std::string missing(pqxx::work &txn, const std::string &kind) {
+    std::ostringstream condition;
+
+    condition << "(NOT EXISTS (SELECT 1 FROM " << kind_table(kind) << " h WHERE h.sid = files.sid"
+	      << " AND " << kind_condition(txn, kind)
+	      << ") AND " << Sid_Cursor::not_failed(txn, kind)
+	      << ")";
+    return condition.str();
+  }
+
+public:
+  Pg_File_Source(const std::string &connection_string, const std::vector<std::string> &kinds, size_t min_size) : conn(connection_string), kinds(kinds), min_size(min_size),
+    fetch_timer(metrics().timer("fetch")), decode_timer(metrics().timer("decode")), fetched(metrics().counter("fetched_bytes")) {}
+
+  std::vector<Sid_Data> next(unsigned long after, size_t maxs) {
+    std::vector<Sid_Data> files;
+    pqxx::work txn(conn, "get sids");
+    std::ostringstream query;
+    std::ostringstream any;
+
+    query << "SELECT sid, data";
+    for(size_t i = 0; i < kinds.size(); ++i) {
+      query << ", " << missing(txn, kinds[i]) << " AS missing" << i;
+      any << (i == 0 ? "" : " OR ") << missing(txn, kinds[i]);
+    }
+    query << " FROM files WHERE sid > " << after
+	  << " AND data NOTNULL AND (" << any.str() << ")";
+    if(min_size > 0) query << " AND length(data) >= " << min_size;
+    query << " ORDER BY sid";
+    if(maxs > 0) query << " LIMIT " << maxs;
+    pqxx::result result;
+    {
+      Metrics_Scope scope(fetch_timer);
+      result = txn.exec(query.str());
+    }
+    Metrics_Scope scope(decode_timer);
+    for(auto row : result) {
+      pqxx::binarystring binstr(row["data"]);
+      fetched.add(binstr.size());
+      Sid_Data file = { row["sid"].as<unsigned long>(), binstr.str(), std::vector<bool>(kinds.size()), NULL, 0 };
+      for(size_t i = 0; i < kinds.size(); ++i) file.missing[i] = row[static_cast<int>(i) + 2].as<bool>();
+      files.push_back(std::move(file));
+    }
+    return files;
+  }
+};
+
+
+/*! \brief Fingerprints streamed with COPY, the progress is kept in a Sid_Cursor
+ *
+ * All kinds have to be in the same table.
+ */
+class Pg_Fingerprint_Writer : public Fingerprint_Writer {
+  /*! \brief Columns of a bitshred kind before its value */
+  struct Bitshred_Columns {
+    bool bitshred;
+    unsigned int m;
+    unsigned int n;
+    std::string hash;
+  };
+
+  pqxx::connection conn;
+  std::vector<std::string> kinds;
+  std::vector<Bitshred_Columns> columns;
+  std::string table;
+  Bulk_Writer writer;
+  Sid_Cursor cursor;
+  unsigned long position;
+
+  static std::vector<std::string> table_columns(const std::string &table) {
+    if(table == "bitshred") return { "sid", "m", "n", "hash", "bitshred" };
+    if(table == SSDEEP_KIND) return { "sid", "blocksize", "hash" };
+    return { "sid", "hash" };
+  }
+
+  void save_cursor() {
+    pqxx::work txn(conn, "save cursor");
+    cursor.save(txn);
+    txn.commit();
+  }
+
+public:
+  Pg_Fingerprint_Writer(const std::string &connection_string, const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan)
+    : conn(connection_string), kinds(kinds), table(kinds.empty() ? std::string() : kind_table(kinds[0])),
+      writer(conn, table, table_columns(table), batch_size, flush_interval), cursor(kinds), position(0) {
+    for(auto &kind : kinds) {
+      Bitshred_Columns config = { false, 0, 0, std::string() };
+      if(kind_table(kind) != table) throw std::invalid_argument("fingerprint kinds in different tables: " + kinds[0] + ", " + kind);
+      config.bitshred = parse_bitshred_kind(kind, config.m, config.n, config.hash);
+      columns.push_back(config);
+    }
+    if(rescan) cursor.reset(conn);
+    position = cursor.load(conn);
+    writer.on_commit([this](pqxx::work &txn) { cursor.save(txn); });
+  }
+
+  unsigned long start() const { return position; }
+  void issue(unsigned long sid) { cursor.issue(sid); }
+
+  void write(unsigned long sid, size_t kind, const uint8_t *data, size_t size) {
+    Copy_Row row;
+
+    row << sid;
+    if(kinds[kind] == SSDEEP_KIND) {
+      Ssdeep_Hash hash(split_ssdeep_hash(std::string(reinterpret_cast<const char *>(data), size)));
+      row << hash.blocksize << hash.signatures;
+    } else {
+      if(columns[kind].bitshred) row << columns[kind].m << columns[kind].n << columns[kind].hash;
+      row.bytea(data, size);
+    }
+    writer.write(row);
+  }
+
+  void failed(unsigned long sid, size_t kind, const std::string &reason) { cursor.failed(sid, kinds[kind], reason); }
+  void done(unsigned long sid) { cursor.done(sid); }
+
+  /*! \brief The cursor is saved with the COPY or, if no COPY is open, in its own transaction */
+  void checkpoint() {
+    if(writer.size() == 0 && cursor.dirty()) save_cursor();
+  }
+
+  void flush() {
+    writer.flush();
+    if(cursor.dirty()) save_cursor();
+  }
+};
+
+
+Pg_Storage::Pg_Storage(const std::string &connection_string) : connection_string(connection_string), conn(connection_string) {
+}
+
+std::unique_ptr<File_Source> Pg_Storage::files_without(const std::vector<std::string> &kinds, size_t min_size) {
+  for(auto &kind : kinds) kind_table(kind);
+  return std::unique_ptr<File_Source>(new Pg_File_Source(connection_string, kinds, min_size));
+}
+
+std::unique_ptr<Fingerprint_Writer> Pg_Storage::writer(const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan) {
+  return std::unique_ptr<Fingerprint_Writer>(new Pg_Fingerprint_Writer(connection_string, kinds, batch_size, flush_interval, rescan));
+}
+
+void Pg_Storage::update_index(const std::string &kind, size_t batch_size, double flush_interval) {
+  if(kind != SSDEEP_KIND) return;
+  pqxx::connection fetch_conn(connection_string);
+  pqxx::connection store_conn(connection_string);
+  Bulk_Writer writer(store_conn, "fuzzy_ssdeep_ngrams", { "sid", "ngrams" }, batch_size, flush_interval);
+  unsigned long after = 0;
+
+  for(;;) {
+    std::ostringstream query;
+    pqxx::work txn(fetch_conn, "get unindexed");
+    query << "SELECT sid, blocksize, hash FROM fuzzy_ssdeep WHERE sid > " << after
+	  << " AND NOT EXISTS (SELECT 1 FROM fuzzy_ssdeep_ngrams n WHERE n.sid = fuzzy_ssdeep.sid)"
+	  << " ORDER BY sid LIMIT " << INDEX_STRIDE
+	  << ';';
+    pqxx::result result(txn.exec(query.str()));
+    if(result.empty()) break;
+    for(auto row : result) {
+      std::vector<int64_t> keys;
+      after = row["sid"].as<unsigned long>();
+      try {
+	keys = ssdeep_ngram_keys(row["blocksize"].as<unsigned long>(), row["hash"].as<std::string>());
+      }
+      catch(const std::exception &excp) {
+	std::cerr << boost::format("$%06lx not indexed: %s\n") % after % excp.what();
+      }
+      Copy_Row line;
+      line << after << ssdeep_ngram_array(keys);
+      writer.write(line);
+    }
+  }
+  writer.flush();
+}
+
+void Pg_Storage::scan(const std::string &kind, const Fingerprint_Callback &fn) {
+  std::ostringstream query;
+  std::string value;
+  bool ssdeep = kind == SSDEEP_KIND;
+
+  {
+    pqxx::work txn(conn, "scan fingerprints");
+    query << "SELECT sid, " << kind_columns(kind) << " FROM " << kind_table(kind)
+	  << " WHERE " << kind_condition(txn, kind)
+	  << " ORDER BY sid";
+  }
+  /*
+   * The rows are streamed with a binary COPY instead of a cursor: like
+   * the cursor it does not load the whole table into memory (RPi or
+   * Chip), and the values are handed out without decoding the text
+   * format.
+   */
+  Binary_Copy copy(connection_string);
+  copy.begin();
+  copy.copy(query.str(), ssdeep ? 3 : 2, [&](const Copy_Field *fields) {
+      if(ssdeep) {
+	value = std::to_string(fields[1].integer());
+	value += ':';
+	value.append(reinterpret_cast<const char *>(fields[2].data), fields[2].size);
+	fn(fields[0].integer(), reinterpret_cast<const uint8_t *>(value.data()), value.size());
+      } else {
+	fn(fields[0].integer(), fields[1].data, fields[1].size);
+      }
+    });
+  copy.commit();
+}
+
+std::vector<std::pair<unsigned int, std::string> > Pg_Storage::get(const std::string &kind, const std::vector<unsigned int> &sids) {
+  std::vector<std::pair<unsigned int, std::string> > values;
+  std::ostringstream query;
+  pqxx::result result;
+
+  if(sids.empty()) return values;
+  pqxx::work txn(conn, "get fingerprints");
+  query << "SELECT sid, " << kind_columns(kind) << " FROM " << kind_table(kind)
+	<< " WHERE " << kind_condition(txn, kind)
+	<< " AND sid IN (";
+  sid_list(query, sids);
+  query << ");";
+  pqxx::icursorstream cursor(txn, query.str(), "get fingerprints", SCAN_STRIDE);
+  while(cursor >> result) {
+    for(auto row : result) {
+      row_fingerprint(kind, row, [&values](unsigned int sid, const uint8_t *data, size_t size) {
+	  values.push_back(std::make_pair(sid, std::string(reinterpret_cast<const char *>(data), size)));
+	});
+    }
+  }
+  return values;
+}
+
+std::vector<Sid_Entry> Pg_Storage::entries(const std::vector<unsigned int> &sids) {
+  std::vector<Sid_Entry> entries;
+  std::ostringstream query;
+
+  if(sids.empty()) return entries;
+  pqxx::work txn(conn, "list entries");
+  query << "SELECT sid,name,author,released,filename,length(data) FROM songs NATURAL JOIN files WHERE sid IN (";
+  sid_list(query, sids);
+  query << ") ORDER BY sid;";
+  pqxx::result result(txn.exec(query.str()));
+  for(auto row : result) {
+    Sid_Entry entry = { row[0].as<unsigned int>(), row[1].c_str(), row[2].c_str(), row[3].c_str(), row[4].c_str(), row[5].is_null() ? 0 : row[5].as<size_t>() };
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+void Pg_Storage::scan_ssdeep_candidates(const std::string &hash, const std::vector<int64_t> &keys, const Fingerprint_Callback &fn) {
+  std::ostringstream query;
+  pqxx::result result;
+  Ssdeep_Hash split(split_ssdeep_hash(hash));
+
+  pqxx::work txn(conn, "ssdeep candidates");
+  query << "SELECT sid, blocksize, hash FROM fuzzy_ssdeep WHERE"
+	<< " (blocksize = " << txn.quote(split.blocksize) << " AND hash = " << txn.quote(split.signatures) << ')';
+  if(!keys.empty()) {
+    query << " OR sid IN (SELECT sid FROM fuzzy_ssdeep_ngrams WHERE ngrams && " << txn.quote(ssdeep_ngram_array(keys)) << "::BIGINT[])";
+  }
+  pqxx::icursorstream cursor(txn, query.str(), "cursor for ssdeep", RESULT_STRIDE);
+  while(cursor >> result) {
+    for(auto row : result) row_fingerprint(SSDEEP_KIND, row, fn);
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef __PG_STORAGE_HH_2017__
+#define __PG_STORAGE_HH_2017__
+#include <string>
+#include <pqxx/pqxx>
+#include "storage.hh"
+
+/*! \brief Files and fingerprints in the PostgreSQL database, see make_db.sql
+ *
+ * The queries use a lazy connection, so it is only opened when the
+ * database is really needed. Sources and writers open their own
+ * connections as they run in other threads.
+ */
+class Pg_Storage : public Sid_Storage {
+  std::string connection_string;
+  pqxx::lazyconnection conn;
+
+public:
+  explicit Pg_Storage(const std::string &connection_string);
+
+  std::unique_ptr<File_Source> files_without(const std::vector<std::string> &kinds, size_t min_size);
+  std::unique_ptr<Fingerprint_Writer> writer(const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan);
+  /*! \brief Store the n-gram keys of all ssdeep hashes without them
+   *
+   * Every hash gets a row, possibly without keys, so the missing ones
+   * are found with the primary key. This also fills the index for
+   * hashes calculated before it existed.
+   */
+  void update_index(const std::string &kind, size_t batch_size, double flush_interval);
+
+  /*! \brief Streams the fingerprints with a binary COPY on its own connection */
+  void scan(const std::string &kind, const Fingerprint_Callback &fn);
+  std::vector<std::pair<unsigned int, std::string> > get(const std::string &kind, const std::vector<unsigned int> &sids);
+  std::vector<Sid_Entry> entries(const std::vector<unsigned int> &sids);
+  /*! \brief Uses the GIN index on fuzzy_ssdeep_ngrams */
+  void scan_ssdeep_candidates(const std::string &hash, const std::vector<int64_t> &keys, const Fingerprint_Callback &fn);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "pipeline.hh"
+
+Work_Stealing_Pool::Work_Stealing_Pool(unsigned int threads, size_t capacity) : capacity(capacity > 0 ? capacity : 1), pending(0), queued(0), next_queue(0), closing(false) {
+  if(threads == 0) threads = std::thread::hardware_concurrency();
+  if(threads == 0) threads = 1;
+  for(unsigned int i = 0; i < threads; ++i) queues.emplace_back(new Worker_Queue);
+  try {
+    for(unsigned int i = 0; i < threads; ++i) workers.emplace_back(&Work_Stealing_Pool::work, this, i);
+  }
+  catch(...) {
+    //The destructor is not called, joinable threads would terminate.
+    join();
+    throw;
+  }
+}
+
+Work_Stealing_Pool::~Work_Stealing_Pool() {
+  join();
+}
+
+void Work_Stealing_Pool::submit(Task task) {
+  size_t idx;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    space_available.wait(guard, [this] { return pending < capacity || error; });
+    if(error) std::rethrow_exception(error);
+    ++pending;
+    idx = next_queue++ % queues.size();
+  }
+  {
+    std::lock_guard<std::mutex> guard(queues[idx]->lock);
+    queues[idx]->tasks.push_back(std::move(task));
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  ++queued;
+  work_available.notify_one();
+}
+
+bool Work_Stealing_Pool::take(unsigned int idx, Task &task) {
+  bool found = false;
+  {
+    std::lock_guard<std::mutex> guard(queues[idx]->lock);
+    if(!queues[idx]->tasks.empty()) {
+      task = std::move(queues[idx]->tasks.back());
+      queues[idx]->tasks.pop_back();
+      found = true;
+    }
+  }
+  for(size_t i = 1; !found && i < queues.size(); ++i) {
+    Worker_Queue &victim(*queues[(idx + i) % queues.size()]);
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if(!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      found = true;
+    }
+  }
+  if(found) {
+    std::lock_guard<std::mutex> guard(lock);
+    --queued;
+  }
+  return found;
+}
+
+void Work_Stealing_Pool::work(unsigned int idx) {
+  Task task;
+
+  for(;;) {
+    if(take(idx, task)) {
+      try {
+	task();
+      }
+      catch(...) {
+	std::lock_guard<std::mutex> guard(lock);
+	if(!error) error = std::current_exception();
+      }
+      task = Task();
+      std::lock_guard<std::mutex> guard(lock);
+      --pending;
+      space_available.notify_all();
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    work_available.wait(guard, [this] { return queued > 0 || closing; });
+    if(queued <= 0 && closing) return;
+  }
+}
+
+void Work_Stealing_Pool::join() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    closing = true;
+    work_available.notify_all();
+  }
+  for(auto &i : workers) {
+    if(i.joinable()) i.join();
+  }
+}
+
+void Work_Stealing_Pool::finish() {
+  join();
+  if(error) std::rethrow_exception(error);
+}
@@ -0,0 +1,212 @@
+#ifndef __PIPELINE_HH_2017__
+#define __PIPELINE_HH_2017__
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "metrics.hh"
+
+/*
+ * Three stage pipeline used by calculate_bitshred and
+ * calculate_fuzzy_hash:
+ *
+ *   fetch thread  ->  work stealing pool  ->  bounded queue  ->  writer
+ *
+ * The fetch and the writer stage use their own database connections,
+ * so the CPU hashes while the database delivers and stores. The work
+ * and the store stage are recorded as the stages hash and write.
+ */
+
+/*! \brief Blocking queue with a maximum size
+ */
+template<typename T> class Bounded_Queue {
+  std::mutex lock;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+
+public:
+  explicit Bounded_Queue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+  /*! \brief Add an item, blocks while the queue is full
+   *
+   * \return false if the queue was closed, the item is dropped
+   */
+  bool push(T item) {
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+    if(closed) return false;
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  /*! \brief Remove an item, blocks while the queue is empty
+   *
+   * \return false if the queue is closed and empty
+   */
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> guard(lock);
+    not_empty.wait(guard, [this] { return closed || !items.empty(); });
+    if(items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  /*! \brief No more items will be pushed, wakes all waiting threads */
+  void close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+};
+
+
+/*! \brief Thread pool with one task deque per worker
+ *
+ * Tasks are handed out round robin. A worker takes its newest task
+ * first and steals the oldest task of another worker when its own
+ * deque is empty, so a few large files do not stall the others.
+ */
+class Work_Stealing_Pool {
+public:
+  typedef std::function<void()> Task;
+
+  /*!
+   * \param threads number of workers, 0 = number of cores
+   * \param capacity maximum number of tasks not finished yet
+   */
+  Work_Stealing_Pool(unsigned int threads, size_t capacity);
+  ~Work_Stealing_Pool();
+  Work_Stealing_Pool(const Work_Stealing_Pool &) = delete;
+  Work_Stealing_Pool &operator=(const Work_Stealing_Pool &) = delete;
+
+  /*! \brief Add a task, blocks while capacity tasks are pending
+   *
+   * Throws the exception of a failed task.
+   */
+  void submit(Task task);
+  /*! \brief Wait for all tasks and stop the workers
+   *
+   * Throws the exception of the first failed task.
+   */
+  void finish();
+  unsigned int size() const { return workers.size(); }
+
+private:
+  struct Worker_Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Worker_Queue> > queues;
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable work_available;
+  std::condition_variable space_available;
+  size_t capacity;
+  size_t pending;
+  long queued;
+  size_t next_queue;
+  bool closing;
+  std::exception_ptr error;
+
+  bool take(unsigned int idx, Task &task);
+  void work(unsigned int idx);
+  void join();
+};
+
+
+/*! \brief Parameters of the pipeline
+ */
+struct Pipeline_Config {
+  unsigned int threads;
+  size_t queue_size;
+  size_t batch_size;
+};
+
+/*! \brief Run the fetch, work, and store stages
+ *
+ * \param fetch called once in the fetch thread with an emit function,
+ *        it must call emit(job) for every job and stop if emit returns
+ *        false
+ * \param work called in the pool for every job, returns the result
+ * \param store called in the calling thread with batches of results
+ * \return number of stored results
+ */
+template<typename JOB, typename RESULT, typename FETCH, typename WORK, typename STORE> unsigned long run_pipeline(const Pipeline_Config &config, FETCH fetch, WORK work, STORE store) {
+  Bounded_Queue<RESULT> results(config.queue_size);
+  Work_Stealing_Pool pool(config.threads, config.queue_size);
+  std::atomic<bool> stop(false);
+  std::exception_ptr fetch_error;
+  std::exception_ptr store_error;
+  std::vector<RESULT> batch;
+  unsigned long stored = 0;
+  RESULT result;
+  Metrics_Timer &work_timer(metrics().timer("hash"));
+  Metrics_Timer &store_timer(metrics().timer("write"));
+
+  std::thread fetcher([&]() {
+      try {
+	fetch([&](JOB &&job) -> bool {
+	    if(stop) return false;
+	    std::shared_ptr<JOB> shared(std::make_shared<JOB>(std::move(job)));
+	    pool.submit([&work, &results, &work_timer, shared]() {
+		RESULT done;
+		{
+		  Metrics_Scope scope(work_timer);
+		  done = work(*shared);
+		}
+		results.push(std::move(done));
+	      });
+	    return true;
+	  });
+	pool.finish();
+      }
+      catch(...) {
+	fetch_error = std::current_exception();
+	try {
+	  pool.finish();
+	}
+	catch(...) {
+	}
+      }
+      results.close();
+    });
+  try {
+    while(results.pop(result)) {
+      batch.push_back(std::move(result));
+      if(batch.size() >= config.batch_size) {
+	Metrics_Scope scope(store_timer);
+	store(batch);
+	stored += batch.size();
+	batch.clear();
+      }
+    }
+    if(!batch.empty()) {
+      Metrics_Scope scope(store_timer);
+      store(batch);
+      stored += batch.size();
+    }
+  }
+  catch(...) {
+    store_error = std::current_exception();
+    stop = true;
+    results.close();
+  }
+  fetcher.join();
+  if(store_error) std::rethrow_exception(store_error);
+  if(fetch_error) std::rethrow_exception(fetch_error);
+  return stored;
+}
+
+#endif
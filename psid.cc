@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "psid.hh"
+
+static uint16_t load_be16(const uint8_t *ptr) {
+  return ptr[0] << 8 | ptr[1];
+}
+
+static uint32_t load_be32(const uint8_t *ptr) {
+  return static_cast<uint32_t>(load_be16(ptr)) << 16 | load_be16(ptr + 2);
+}
+
+/*! \brief Unicode code point of an ISO-8859-15 character */
+static unsigned int latin9_code(uint8_t c) {
+  switch(c) {
+  case 0xA4: return 0x20AC;
+  case 0xA6: return 0x0160;
+  case 0xA8: return 0x0161;
+  case 0xB4: return 0x017D;
+  case 0xB8: return 0x017E;
+  case 0xBC: return 0x0152;
+  case 0xBD: return 0x0153;
+  case 0xBE: return 0x0178;
+  }
+  return c;
+}
+
+std::string psid_string(const uint8_t *data, size_t size) {
+  std::string result;
+  size_t begin = 0;
+
+  while(begin < size && data[begin] == 0) ++begin;
+  while(size > begin && data[size - 1] == 0) --size;
+  for(size_t i = begin; i < size; ++i) {
+    unsigned int code = latin9_code(data[i]);
+    //PostgreSQL text can not contain NUL.
+    if(code == 0) continue;
+    if(code < 0x80) {
+      result += static_cast<char>(code);
+    } else if(code < 0x800) {
+      result += static_cast<char>(0xC0 | code >> 6);
+      result += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      result += static_cast<char>(0xE0 | code >> 12);
+      result += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+      result += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+  return result;
+}
+
+Psid_Header parse_psid(const uint8_t *data, size_t size) {
+  Psid_Header header;
+
+  if(size < PSID_HEADER_SIZE) throw std::runtime_error("SID file too short");
+  header.magic = load_be32(data);
+  if(header.magic != PSID_MAGIC && header.magic != RSID_MAGIC) {
+    throw std::runtime_error((boost::format("wrong magic $%08X for SID") % header.magic).str());
+  }
+  header.version = load_be16(data + 4);
+  header.data_offset = load_be16(data + 6);
+  header.load_address = load_be16(data + 8);
+  header.init_address = load_be16(data + 10);
+  header.play_address = load_be16(data + 12);
+  header.songs = load_be16(data + 14);
+  header.start_song = load_be16(data + 16);
+  header.speed = load_be32(data + 18);
+  header.name = psid_string(data + 22, PSID_STRING_SIZE);
+  header.author = psid_string(data + 22 + PSID_STRING_SIZE, PSID_STRING_SIZE);
+  header.released = psid_string(data + 22 + 2 * PSID_STRING_SIZE, PSID_STRING_SIZE);
+  return header;
+}
+
+
+static bool is_sid_name(const std::string &name) {
+  if(name.size() < 4) return false;
+  std::string ext(name.substr(name.size() - 4));
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".sid";
+}
+
+void find_sid_files(const std::string &path, bool given, std::vector<std::string> &files) {
+  struct stat st;
+
+  if(stat(path.c_str(), &st) != 0) {
+    std::cerr << "can not stat '" << path << "': " << std::strerror(errno) << std::endl;
+    return;
+  }
+  if(S_ISDIR(st.st_mode)) {
+    std::vector<std::string> entries;
+    DIR *dir = opendir(path.c_str());
+    if(!dir) {
+      std::cerr << "can not read '" << path << "': " << std::strerror(errno) << std::endl;
+      return;
+    }
+    while(struct dirent *entry = readdir(dir)) {
+      std::string name(entry->d_name);
+      if(name != "." && name != "..") entries.push_back(name);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+    std::string prefix(path.back() == '/' ? path : path + '/');
+    for(auto &name : entries) find_sid_files(prefix + name, false, files);
+  } else if(S_ISREG(st.st_mode) && (given || is_sid_name(path))) {
+    files.push_back(path);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef __PSID_HH_2017__
+#define __PSID_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Header of PSID and RSID files, see sidformat.py. All values are big
+ * endian; the strings are ISO-8859-15 and padded with NUL bytes.
+ */
+
+#define PSID_MAGIC 0x50534944
+#define RSID_MAGIC 0x52534944
+/*! \brief Bytes needed to parse the header, the size of version 1 */
+#define PSID_HEADER_SIZE 0x76
+#define PSID_STRING_SIZE 32
+
+/*! \brief Parsed PSID or RSID header */
+struct Psid_Header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t data_offset;
+  uint16_t load_address;
+  uint16_t init_address;
+  uint16_t play_address;
+  uint16_t songs;
+  uint16_t start_song;
+  uint32_t speed;
+  /*! \brief Name, author, and released as UTF-8 */
+  std::string name;
+  std::string author;
+  std::string released;
+};
+
+/*! \brief Parse the header of a SID file
+ *
+ * Throws std::runtime_error if the data is too short or the magic is
+ * wrong.
+ */
+Psid_Header parse_psid(const uint8_t *data, size_t size);
+
+/*! \brief Convert a NUL padded ISO-8859-15 string to UTF-8
+ *
+ * Leading and trailing NUL bytes are stripped like in sidformat.py,
+ * others are dropped.
+ */
+std::string psid_string(const uint8_t *data, size_t size);
+
+/*! \brief Collect the SID files of a tree
+ *
+ * Files given directly are always taken, in directories only the
+ * *.sid files. The entries are sorted, so the files are in the order
+ * of the tree. Unreadable paths are reported on stderr and skipped.
+ *
+ * \param given path was given directly, e.g. on the command line
+ */
+void find_sid_files(const std::string &path, bool given, std::vector<std::string> &files);
+
+#endif
@@ -0,0 +1,87 @@
+#include <climits>
+#include <sstream>
+#include <stdexcept>
+#include "shred.hh"
+
+struct Bitshred_Hash_Entry {
+  const char *name;
+  Bitshred_Function shred;
+  Ngram_Hash_Function hashes;
+};
+
+#define BITSHRED_HASH(name, hasher) { name, &shred_with<hasher>, &ngram_hashes_with<hasher> }
+
+static const Bitshred_Hash_Entry bitshred_hashes[] = {
+  BITSHRED_HASH("jenkins", Batch_Hasher<jenkins_hash_windows>),
+  BITSHRED_HASH("djb2", Batch_Hasher<djb2_hash_windows>),
+  BITSHRED_HASH("djb2xor", Batch_Hasher<djb2xor_hash_windows>),
+  BITSHRED_HASH("sbox", Batch_Hasher<sbox_hash_windows>),
+  BITSHRED_HASH("rabinkarp", Rabinkarp_Rolling),
+  BITSHRED_HASH("buzhash", Buzhash_Rolling),
+};
+
+static const Bitshred_Hash_Entry &find_hash(const std::string &hash) {
+  std::ostringstream error;
+  bool first = true;
+
+  for(auto &i : bitshred_hashes) {
+    if(hash == i.name) return i;
+  }
+  //Count not find the selected hash.
+  for(auto &i : bitshred_hashes) {
+    if(first) {
+      error << "unknown hash, valid are: " << i.name;
+      first = false;
+    } else {
+      error << ", " << i.name;
+    }
+  }
+  throw std::runtime_error(error.str());
+}
+
+Bitshred_Function bitshred_function(const std::string &hash) {
+  return find_hash(hash).shred;
+}
+
+Ngram_Hash_Function ngram_hash_function(const std::string &hash) {
+  return find_hash(hash).hashes;
+}
+
+BitshredType bitshred_from_hashes(const std::vector<uint32_t> &hashes, unsigned int m) {
+  BitshredType bitshred(m);
+
+  if(m == 0) throw std::invalid_argument("bitshred size must not be zero");
+  if((m & (m - 1)) == 0) {
+    Mask_Reduce reduce = { m - 1 };
+    for(uint32_t hash : hashes) bitshred.set(reduce(hash));
+  } else {
+    Modulo_Reduce reduce = { m };
+    for(uint32_t hash : hashes) bitshred.set(reduce(hash));
+  }
+  return bitshred;
+}
+
+std::vector<std::string> bitshred_hash_names() {
+  std::vector<std::string> names;
+
+  for(auto &i : bitshred_hashes) names.push_back(i.name);
+  return names;
+}
+
+Bitshred_Config parse_bitshred_config(const std::string &arg) {
+  Bitshred_Config config;
+  std::istringstream input(arg);
+  long long m, n;
+  char sep1, sep2;
+
+  //Signed, an unsigned read would wrap a negative size.
+  if(!(input >> m >> sep1 >> n >> sep2) || sep1 != ':' || sep2 != ':' || !std::getline(input, config.hash) || config.hash.empty()) {
+    throw std::invalid_argument("bitshred configuration must be m:n:hash: " + arg);
+  }
+  //The other tools take m and n as int options and the columns are integers.
+  if(m < 1 || m > INT_MAX) throw std::invalid_argument("bitshred size m must be between 1 and " + std::to_string(INT_MAX) + ": " + arg);
+  if(n < 1 || n > INT_MAX) throw std::invalid_argument("bitshred n-gram size n must be between 1 and " + std::to_string(INT_MAX) + ": " + arg);
+  config.m = m;
+  config.n = n;
+  return config;
+}
@@ -0,0 +1,145 @@
+#ifndef __SHRED_HH_2017__
+#define __SHRED_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bitshred.hh"
+#include "hash.hh"
+
+/*! \brief Reduce a hash to a bit position with a division */
+struct Modulo_Reduce {
+  uint32_t m;
+  uint32_t operator()(uint32_t hash) const { return hash % m; }
+};
+
+/*! \brief Reduce a hash to a bit position if m is a power of two
+ *
+ * Gives the same bit as Modulo_Reduce.
+ */
+struct Mask_Reduce {
+  uint32_t mask;
+  uint32_t operator()(uint32_t hash) const { return hash & mask; }
+};
+
+/*! \brief Number of n-gram windows shredded for data of size bytes
+ *
+ * The last window is not used. This is kept as it is so that the
+ * bitshreds already stored in the database stay valid.
+ */
+inline size_t ngram_windows(size_t size, size_t n) {
+  return size > n ? size - n : 0;
+}
+
+/*! \brief Windows hashed by a Batch_Hasher before they are passed on */
+#define NGRAM_BLOCK 256
+
+/*! \brief Loop over the windows with first() and next() */
+template<typename HASHER> struct Ngram_Loop {
+  template<typename FUN> static void run(const uint8_t *data, size_t windows, size_t n, FUN &fun) {
+    HASHER hasher(n);
+
+    fun(hasher.first(data));
+    for(size_t i = 1; i < windows; ++i) fun(hasher.next(data + i));
+  }
+};
+
+/*! \brief Loop over blocks of windows hashed at once */
+template<Hash_Windows_Function WINDOWS> struct Ngram_Loop<Batch_Hasher<WINDOWS> > {
+  template<typename FUN> static void run(const uint8_t *data, size_t windows, size_t n, FUN &fun) {
+    Batch_Hasher<WINDOWS> hasher(n);
+    uint32_t hashes[NGRAM_BLOCK];
+
+    for(size_t begin = 0; begin < windows; begin += NGRAM_BLOCK) {
+      size_t count = std::min<size_t>(NGRAM_BLOCK, windows - begin);
+      hasher.windows(data + begin, count, hashes);
+      for(size_t i = 0; i < count; ++i) fun(hashes[i]);
+    }
+  }
+};
+
+/*! \brief Call fun with the hash of every n-gram window
+ *
+ * \param HASHER n-gram hasher, e.g. Djb2_Rolling
+ */
+template<typename HASHER, typename FUN> inline void for_each_ngram_hash(const uint8_t *data, size_t size, size_t n, FUN fun) {
+  size_t windows = ngram_windows(size, n);
+
+  if(windows == 0) return;
+  Ngram_Loop<HASHER>::run(data, windows, n, fun);
+}
+
+/*! \brief Calculate a bitshred with a hasher known at compile time
+ *
+ * \param data data to shred
+ * \param size size of the data in bytes
+ * \param m bitshred size in bits
+ * \param n n-gram selection
+ */
+template<typename HASHER> BitshredType shred_with(const uint8_t *data, size_t size, unsigned int m, unsigned int n) {
+  BitshredType bitshred(m);
+
+  if(m == 0) throw std::invalid_argument("bitshred size must not be zero");
+  if((m & (m - 1)) == 0) {
+    Mask_Reduce reduce = { m - 1 };
+    for_each_ngram_hash<HASHER>(data, size, n, [&](uint32_t hash) { bitshred.set(reduce(hash)); });
+  } else {
+    Modulo_Reduce reduce = { m };
+    for_each_ngram_hash<HASHER>(data, size, n, [&](uint32_t hash) { bitshred.set(reduce(hash)); });
+  }
+  return bitshred;
+}
+
+/*! \brief Hashes of all n-gram windows
+ *
+ * \param HASHER n-gram hasher, e.g. Djb2_Rolling
+ * \param hashes output, resized to the number of windows
+ */
+template<typename HASHER> void ngram_hashes_with(const uint8_t *data, size_t size, unsigned int n, std::vector<uint32_t> &hashes) {
+  hashes.clear();
+  hashes.reserve(ngram_windows(size, n));
+  for_each_ngram_hash<HASHER>(data, size, n, [&](uint32_t hash) { hashes.push_back(hash); });
+}
+
+/*! \brief Calculate a bitshred from precalculated n-gram hashes
+ *
+ * Used to calculate several m from the same hashes. The result is the
+ * same as calling the Bitshred_Function of the hash.
+ */
+BitshredType bitshred_from_hashes(const std::vector<uint32_t> &hashes, unsigned int m);
+
+typedef BitshredType (*Bitshred_Function)(const uint8_t *data, size_t size, unsigned int m, unsigned int n);
+
+/*! \brief Get the bitshred function for a hash name
+ *
+ * \param hash hash name (jenkins, djb2, djb2xor, sbox, rabinkarp, buzhash)
+ * \return shred function, throws std::runtime_error for unknown hashes
+ */
+Bitshred_Function bitshred_function(const std::string &hash);
+
+typedef void (*Ngram_Hash_Function)(const uint8_t *data, size_t size, unsigned int n, std::vector<uint32_t> &hashes);
+
+/*! \brief Get the n-gram hash function for a hash name
+ *
+ * \param hash hash name, see bitshred_function()
+ * \return function, throws std::runtime_error for unknown hashes
+ */
+Ngram_Hash_Function ngram_hash_function(const std::string &hash);
+
+/*! \brief Names of all hashes usable for bitshreds */
+std::vector<std::string> bitshred_hash_names();
+
+/*! \brief One bitshred parameter set
+ */
+struct Bitshred_Config {
+  unsigned int m;
+  unsigned int n;
+  std::string hash;
+};
+
+/*! \brief Parse a configuration given as m:n:hash
+ */
+Bitshred_Config parse_bitshred_config(const std::string &arg);
+
+#endif
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <boost/format.hpp>
+#include <pqxx/pqxx>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "sid_archive.cmdline.h"
+#include "corpus_archive.hh"
+#include "bulk_writer.hh"
+
+/*
+ * Sync a corpus archive with the files and songs tables. The export
+ * writes all files with data, the import only adds the files whose SID
+ * and file name are both unknown, so an archive can be moved to another
+ * database keeping the SIDs of the fingerprints calculated from it.
+ */
+
+#define RESULT_STRIDE 89
+
+/*! \brief Write all files of the database into an archive
+ *
+ * The header fields are parsed from the data, the strings of the songs
+ * table take precedence as they may have been corrected.
+ */
+unsigned long export_archive(pqxx::connection &conn, const std::string &fname) {
+  Corpus_Archive_Writer archive(fname);
+  pqxx::work txn(conn, "export_archive");
+  pqxx::icursorstream cursor(txn, "SELECT f.sid, f.filename, f.data, s.name, s.author, s.released FROM files AS f LEFT JOIN songs AS s USING (sid) WHERE f.data NOTNULL ORDER BY f.sid", "cursor for export", RESULT_STRIDE);
+  pqxx::result result;
+
+  while(cursor >> result) {
+    for(auto row : result) {
+      pqxx::binarystring data(row["data"]);
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+      Psid_Header header;
+      bool parsed = true;
+      try {
+	header = parse_psid(bytes, data.size());
+      }
+      catch(const std::runtime_error &) {
+	parsed = false;
+      }
+      if(!row["name"].is_null()) {
+	if(!parsed) header = Psid_Header();
+	header.name = row["name"].as<std::string>();
+	header.author = row["author"].as<std::string>();
+	header.released = row["released"].as<std::string>();
+	parsed = true;
+      }
+      archive.add(row["sid"].as<unsigned int>(), row["filename"].as<std::string>(), bytes, data.size(), parsed ? &header : NULL);
+    }
+  }
+  archive.close();
+  return archive.size();
+}
+
+/*! \brief Store the files of the archive missing in the database
+ *
+ * The songs are copied in the transaction of their files. Afterwards
+ * the sequence of files is moved behind the largest SID, so files
+ * imported later do not collide with the archive.
+ */
+unsigned long import_archive(pqxx::connection &conn, const std::string &fname, const gengetopt_args_info &args) {
+  Corpus_Archive archive(fname);
+  std::unordered_set<unsigned int> known_sids;
+  std::unordered_set<std::string> known_files;
+  std::vector<Copy_Row> songs;
+  unsigned long skipped = 0;
+
+  {
+    pqxx::work txn(conn, "get_known_files");
+    pqxx::result query(txn.exec("SELECT sid, filename FROM files"));
+    for(auto row : query) {
+      known_sids.insert(row[0].as<unsigned int>());
+      known_files.insert(row[1].as<std::string>());
+    }
+  }
+  Bulk_Writer writer(conn, "files", { "sid", "filename", "data" }, args.copy_batch_arg, args.flush_interval_arg);
+  writer.on_commit([&songs](pqxx::work &txn) {
+      copy_rows(txn, "songs", { "sid", "name", "author", "released" }, songs);
+      songs.clear();
+    });
+  for(size_t i = 0; i < archive.size(); ++i) {
+    if(known_sids.count(archive.sid(i)) > 0 || known_files.count(archive.filename(i)) > 0) {
+      ++skipped;
+      continue;
+    }
+    Copy_Row row;
+    if(archive.has_song(i)) {
+      Copy_Row song;
+      song << archive.sid(i) << std::string(archive.name(i)) << std::string(archive.author(i)) << std::string(archive.released(i));
+      songs.push_back(song);
+    }
+    row << archive.sid(i) << std::string(archive.filename(i));
+    row.bytea(archive.data(i), archive.data_size(i));
+    writer.write(row);
+  }
+  writer.flush();
+  {
+    pqxx::work txn(conn, "update_sequence");
+    txn.exec("SELECT setval(pg_get_serial_sequence('files', 'sid'), max(sid)) FROM files HAVING max(sid) NOTNULL");
+    txn.commit();
+  }
+  std::cout << boost::format("Files skipped, already in the database: %u\n") % skipped;
+  return writer.written();
+}
+
+void list_archive(const std::string &fname) {
+  Corpus_Archive archive(fname);
+
+  for(size_t i = 0; i < archive.size(); ++i) {
+    std::cout << boost::format("%6u %7u %s\t%s\t%s\t%s\n") % archive.sid(i) % archive.data_size(i) % archive.filename(i) % archive.name(i) % archive.author(i) % archive.released(i);
+  }
+}
+
+int run(const std::string &connection_string, const gengetopt_args_info &args) {
+  if(args.export_given + args.import_given + args.list_given != 1) throw std::invalid_argument("exactly one of --export, --import, and --list is needed");
+  if(args.list_given) {
+    list_archive(args.list_arg);
+    return 0;
+  }
+  pqxx::connection conn(connection_string);
+  if(args.export_given) {
+    std::cout << "Files exported: " << export_archive(conn, args.export_arg) << std::endl;
+  } else {
+    std::cout << "Files imported: " << import_archive(conn, args.import_arg, args) << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  std::ostringstream connection_string;
+  int retval = -1;
+  gengetopt_args_info args;
+
+  if(cmdline_parser(argc, argv, &args) != 0) return 1;
+  try {
+    connection_string << "dbname=" << args.dbname_arg << " user=" << args.dbuser_arg;
+    if(args.dbhost_given) connection_string << " host=" << args.dbhost_arg;
+    if(args.dbpass_given) connection_string << " password=" << args.dbpass_arg;
+    retval = run(connection_string.str(), args);
+  }
+  catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return retval;
+  }
+  return retval;
+}
@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <boost/format.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tlsh.h>
+#include <fuzzy.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "sid_bench.cmdline.h"
+#include "synthetic_sid.hh"
+#include "hash.hh"
+#include "shred.hh"
+#include "jaccard.hh"
+#include "bigram.hh"
+#include "histogram_cache.hh"
+#include "tlsh_index.hh"
+#include "bulk_writer.hh"
+
+/*
+ * Repeatable micro-benchmarks of the kernels on a synthetic corpus, no
+ * database is needed. Every kernel is run until a measurement takes at
+ * least --min-time seconds, of --repeat measurements the fastest is
+ * reported. The results are written as JSON, one object per kernel:
+ *
+ *   name, iterations, seconds (per iteration), bytes and ops (per
+ *   iteration), bytes_per_second, ops_per_second, cycles_per_byte,
+ *   cycles_per_op
+ *
+ * The cycles are those of the time stamp counter, i.e. at the nominal
+ * clock; they are null on other architectures. An op is a hash, a
+ * comparison, or a query depending on the kernel.
+ */
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+struct Bench_Result {
+  std::string name;
+  unsigned long iterations;
+  double seconds;
+  double cycles;
+  double bytes;
+  double ops;
+};
+
+typedef std::function<uint64_t()> Bench_Kernel;
+
+/*! \brief Results are summed into this so nothing is optimised away */
+static volatile uint64_t bench_sink;
+
+static uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+class Bench_Runner {
+  const gengetopt_args_info &args;
+
+public:
+  std::vector<Bench_Result> results;
+
+  explicit Bench_Runner(const gengetopt_args_info &args) : args(args) {}
+
+  bool wanted(const std::string &name) const {
+    if(args.filter_given == 0) return true;
+    for(unsigned int i = 0; i < args.filter_given; ++i) {
+      if(name.find(args.filter_arg[i]) != std::string::npos) return true;
+    }
+    return false;
+  }
+
+  /*!
+   * \param bytes bytes processed by one call of the kernel
+   * \param ops operations of one call of the kernel
+   */
+  void run(const std::string &name, double bytes, double ops, const Bench_Kernel &kernel) {
+    Bench_Result result = { name, 1, 0.0, 0.0, bytes, ops };
+    typedef std::chrono::steady_clock Clock;
+
+    if(!wanted(name)) return;
+    bench_sink += kernel();
+    for(;;) {
+      auto start = Clock::now();
+      for(unsigned long i = 0; i < result.iterations; ++i) bench_sink += kernel();
+      if(std::chrono::duration<double>(Clock::now() - start).count() >= args.min_time_arg) break;
+      result.iterations *= 2;
+    }
+    result.seconds = -1.0;
+    for(int rep = 0; rep < std::max(args.repeat_arg, 1); ++rep) {
+      auto start = Clock::now();
+      uint64_t cycles = read_cycles();
+      for(unsigned long i = 0; i < result.iterations; ++i) bench_sink += kernel();
+      cycles = read_cycles() - cycles;
+      double seconds = std::chrono::duration<double>(Clock::now() - start).count() / result.iterations;
+      if(result.seconds < 0 || seconds < result.seconds) {
+	result.seconds = seconds;
+	result.cycles = static_cast<double>(cycles) / result.iterations;
+      }
+    }
+    std::cerr << boost::format("%-24s %12.4g s %12.4g B/s %12.4g op/s\n") % name % result.seconds % (bytes / result.seconds) % (ops / result.seconds);
+    results.push_back(result);
+  }
+};
+
+/*! \brief JSON number, null if there is no value */
+static std::string json_number(double value, bool valid) {
+  if(!valid) return "null";
+  return (boost::format("%.6g") % value).str();
+}
+
+static void write_json(std::ostream &out, const gengetopt_args_info &args, size_t corpus_bytes, const std::vector<Bench_Result> &results) {
+  bool cycles = read_cycles() != 0;
+
+  out << "{\n"
+      << "  \"version\": \"" << BENCH_VERSION << "\",\n"
+      << "  \"compiler\": \"" << __VERSION__ << "\",\n"
+      << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n"
+      << "  \"corpus\": { \"seed\": " << args.seed_arg
+      << ", \"files\": " << args.files_arg
+      << ", \"median_size\": " << json_number(args.median_size_arg, true)
+      << ", \"size_sigma\": " << json_number(args.size_sigma_arg, true)
+      << ", \"files_per_player\": " << args.files_per_player_arg
+      << ", \"bytes\": " << corpus_bytes << " },\n"
+      << "  \"bitshred\": { \"m\": " << args.size_arg << ", \"n\": " << args.ngram_arg << " },\n"
+      << "  \"results\": [";
+  for(size_t i = 0; i < results.size(); ++i) {
+    const Bench_Result &r(results[i]);
+    out << (i == 0 ? "\n" : ",\n")
+	<< "    { \"name\": \"" << r.name << "\""
+	<< ", \"iterations\": " << r.iterations
+	<< ", \"seconds\": " << json_number(r.seconds, true)
+	<< ", \"bytes\": " << json_number(r.bytes, true)
+	<< ", \"ops\": " << json_number(r.ops, true)
+	<< ", \"bytes_per_second\": " << json_number(r.bytes / r.seconds, r.bytes > 0)
+	<< ", \"ops_per_second\": " << json_number(r.ops / r.seconds, r.ops > 0)
+	<< ", \"cycles_per_byte\": " << json_number(r.cycles / r.bytes, cycles && r.bytes > 0)
+	<< ", \"cycles_per_op\": " << json_number(r.cycles / r.ops, cycles && r.ops > 0)
+	<< " }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+
+/*! \brief Whole file hashes of hash.hh */
+static void bench_hashes(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes) {
+  static const struct {
+    const char *name;
+    uint32_t (*fun)(const uint8_t *, size_t);
+  } hashes[] = {
+    { "jenkins", jenkins_one_at_a_time_hash },
+    { "djb2", djb2_hash },
+    { "djb2xor", djb2xor_hash },
+    { "sbox", sbox_hash },
+    { "rabinkarp", rabinkarp_hash },
+    { "buzhash", buzhash_hash },
+  };
+
+  for(auto &hash : hashes) {
+    auto fun = hash.fun;
+    runner.run(std::string("hash/") + hash.name, bytes, corpus.size(), [&corpus, fun]() {
+	uint64_t sum = 0;
+	for(auto &file : corpus) sum += fun(reinterpret_cast<const uint8_t *>(file.data()), file.size());
+	return sum;
+      });
+  }
+}
+
+/*! \brief Window hashes of hash.hh with every available implementation */
+static void bench_windows(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes, unsigned int n) {
+  static const char *kernels[] = { "scalar", "avx2" };
+  static const struct {
+    const char *name;
+    Hash_Windows_Function fun;
+  } hashes[] = {
+    { "jenkins", jenkins_hash_windows },
+    { "djb2", djb2_hash_windows },
+    { "djb2xor", djb2xor_hash_windows },
+    { "sbox", sbox_hash_windows },
+  };
+  std::string original(hash_windows_kernel_name());
+  double windows = 0;
+
+  for(auto &file : corpus) windows += ngram_windows(file.size(), n);
+  for(auto kernel : kernels) {
+    if(!hash_windows_select_kernel(kernel)) continue;
+    for(auto &hash : hashes) {
+      auto fun = hash.fun;
+      runner.run(std::string("windows/") + kernel + '/' + hash.name, bytes, windows, [&corpus, fun, n]() {
+	  std::vector<uint32_t> out;
+	  uint64_t sum = 0;
+	  for(auto &file : corpus) {
+	    size_t count = ngram_windows(file.size(), n);
+	    out.resize(count);
+	    fun(reinterpret_cast<const uint8_t *>(file.data()), n, count, out.data());
+	    sum += count > 0 ? out[0] : 0;
+	  }
+	  return sum;
+	});
+    }
+  }
+  hash_windows_select_kernel(original.c_str());
+}
+
+/*! \brief N-gram hashes and bitshreds of every hash */
+static void bench_shreds(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes, unsigned int m, unsigned int n) {
+  double windows = 0;
+
+  for(auto &file : corpus) windows += ngram_windows(file.size(), n);
+  for(auto &name : bitshred_hash_names()) {
+    Ngram_Hash_Function ngrams = ngram_hash_function(name);
+    Bitshred_Function shred = bitshred_function(name);
+    runner.run("ngram/" + name, bytes, windows, [&corpus, ngrams, n]() {
+	std::vector<uint32_t> hashes;
+	uint64_t sum = 0;
+	for(auto &file : corpus) {
+	  ngrams(reinterpret_cast<const uint8_t *>(file.data()), file.size(), n, hashes);
+	  sum += hashes.size();
+	}
+	return sum;
+      });
+    runner.run("bitshred/" + name, bytes, corpus.size(), [&corpus, shred, m, n]() {
+	uint64_t sum = 0;
+	for(auto &file : corpus) sum += shred(reinterpret_cast<const uint8_t *>(file.data()), file.size(), m, n).data()[0];
+	return sum;
+      });
+  }
+}
+
+/*! \brief Bit counts and Jaccard counts with every available implementation */
+static void bench_jaccard(Bench_Runner &runner, const std::vector<std::string> &corpus, unsigned int m, unsigned int n) {
+  static const char *kernels[] = { "scalar", "popcnt", "avx2", "avx512" };
+  Bitshred_Function shred = bitshred_function("djb2");
+  size_t bytes = (m + 7) / 8;
+  size_t stride = (bytes + 63) / 64 * 64;
+  std::vector<uint64_t> words(corpus.size() * stride / sizeof(uint64_t));
+  const uint8_t *rows = reinterpret_cast<const uint8_t *>(words.data());
+  std::string original(jaccard_kernel_name());
+
+  for(size_t i = 0; i < corpus.size(); ++i) {
+    BitshredType bitshred(shred(reinterpret_cast<const uint8_t *>(corpus[i].data()), corpus[i].size(), m, n));
+    std::copy(bitshred.data(), bitshred.data() + bytes, reinterpret_cast<uint8_t *>(words.data()) + i * stride);
+  }
+  runner.run("bit_count", bytes * corpus.size(), corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(size_t i = 0; i < corpus.size(); ++i) sum += bitshred_bit_count(rows + i * stride, bytes);
+      return sum;
+    });
+  for(auto kernel : kernels) {
+    if(!jaccard_select_kernel(kernel)) continue;
+    runner.run(std::string("jaccard_pair/") + kernel, 2.0 * bytes * corpus.size(), corpus.size(), [&]() {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < corpus.size(); ++i) sum += jaccard_counts(rows, rows + i * stride, bytes).intersection;
+	return sum;
+      });
+    runner.run(std::string("jaccard_many/") + kernel, 1.0 * bytes * corpus.size(), corpus.size(), [&]() {
+	std::vector<Bitshred_Counts> counts(corpus.size());
+	jaccard_counts_many(rows, rows, stride, bytes, corpus.size(), counts.data());
+	return counts.back().unio;
+      });
+  }
+  jaccard_select_kernel(original.c_str());
+}
+
+/*! \brief Bigram histograms and their distances */
+static void bench_bigrams(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes) {
+  Bigram_Counter counter, split(0);
+  std::unique_ptr<Bigram_Counts> counts(new Bigram_Counts);
+  std::unique_ptr<Bigram_Histogram> histo(new Bigram_Histogram);
+  std::vector<std::vector<float> > values(corpus.size());
+  std::vector<std::vector<uint16_t> > bins(corpus.size());
+  std::vector<Sparse_Histogram> sparse;
+
+  runner.run("bigram/counts", bytes, corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	counter.count(reinterpret_cast<const uint8_t *>(file.data()), file.size(), *counts);
+	sum += (*counts)[0];
+      }
+      return sum;
+    });
+  //Every file split, to check BIGRAM_SPLIT_MIN against bigram/counts.
+  runner.run("bigram/counts_split", bytes, corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	split.count(reinterpret_cast<const uint8_t *>(file.data()), file.size(), *counts);
+	sum += (*counts)[0];
+      }
+      return sum;
+    });
+  runner.run("bigram/histogram", bytes, corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	bigram_histogram(counter, reinterpret_cast<const uint8_t *>(file.data()), file.size(), *histo);
+	sum += (*histo)[0] > 0;
+      }
+      return sum;
+    });
+  for(size_t i = 0; i < corpus.size(); ++i) {
+    bigram_histogram(counter, reinterpret_cast<const uint8_t *>(corpus[i].data()), corpus[i].size(), *histo);
+    for(size_t bin = 0; bin < BIGRAM_BINS; ++bin) {
+      if((*histo)[bin] == 0) continue;
+      values[i].push_back((*histo)[bin]);
+      bins[i].push_back(bin);
+    }
+    Sparse_Histogram row = { values[i].data(), bins[i].data(), values[i].size() };
+    sparse.push_back(row);
+  }
+  runner.run("bigram/distance", 0, sparse.size(), [&]() {
+      double sum = 0;
+      for(auto &row : sparse) sum += sparse_distance(sparse[0], row);
+      return static_cast<uint64_t>(sum);
+    });
+}
+
+/*! \brief TLSH and ssdeep hashing and comparison */
+static void bench_fuzzy(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes) {
+  std::vector<Tlsh_Digest> digests;
+  std::vector<std::string> ssdeeps;
+  Tlsh_Index index;
+  char hbuf[FUZZY_MAX_RESULT + 1];
+
+  runner.run("tlsh/hash", bytes, corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	Tlsh tlsh;
+	tlsh.final(reinterpret_cast<const unsigned char *>(file.data()), file.size());
+	sum += std::string(tlsh.getHash()).size();
+      }
+      return sum;
+    });
+  runner.run("ssdeep/hash", bytes, corpus.size(), [&]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	if(fuzzy_hash_buf(reinterpret_cast<const unsigned char *>(file.data()), file.size(), hbuf) == 0) sum += hbuf[0];
+      }
+      return sum;
+    });
+  for(size_t i = 0; i < corpus.size(); ++i) {
+    Tlsh tlsh;
+    tlsh.final(reinterpret_cast<const unsigned char *>(corpus[i].data()), corpus[i].size());
+    std::string hash(tlsh.getHash());
+    if(!hash.empty()) {
+      std::string raw;
+      for(size_t j = 0; j + 1 < hash.size(); j += 2) raw.push_back(static_cast<char>(std::stoul(hash.substr(j, 2), nullptr, 16)));
+      digests.push_back(tlsh_decode(reinterpret_cast<const uint8_t *>(raw.data()), raw.size()));
+      index.add(i, digests.back());
+    }
+    if(fuzzy_hash_buf(reinterpret_cast<const unsigned char *>(corpus[i].data()), corpus[i].size(), hbuf) == 0) ssdeeps.push_back(hbuf);
+  }
+  index.finish();
+  if(!digests.empty()) {
+    runner.run("tlsh/distance", 0, digests.size(), [&]() {
+	uint64_t sum = 0;
+	for(auto &digest : digests) sum += tlsh_distance(digests[0], digest);
+	return sum;
+      });
+    size_t queries = std::min<size_t>(digests.size(), 64);
+    runner.run("tlsh/index_top10", 0, queries, [&]() {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < queries; ++i) {
+	  Distance_Selector selector(Distance_Selector::top(10));
+	  index.closest(digests[i * digests.size() / queries], selector, NULL);
+	  sum += selector.take().size();
+	}
+	return sum;
+      });
+  }
+  if(!ssdeeps.empty()) {
+    runner.run("ssdeep/compare", 0, ssdeeps.size(), [&]() {
+	uint64_t sum = 0;
+	for(auto &hash : ssdeeps) sum += fuzzy_compare(ssdeeps[0].c_str(), hash.c_str());
+	return sum;
+      });
+  }
+}
+
+/*! \brief Rows of files as sent by COPY, hex encoded and raw as in the binary format */
+static void bench_copy(Bench_Runner &runner, const std::vector<std::string> &corpus, double bytes, unsigned int m) {
+  std::string shred((m + 7) / 8, '\x5a');
+
+  runner.run("copy/bytea_hex", bytes, corpus.size(), [&corpus]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	Copy_Row row;
+	row << 1u;
+	row.bytea(reinterpret_cast<const uint8_t *>(file.data()), file.size());
+	sum += row.str().size();
+      }
+      return sum;
+    });
+  runner.run("copy/bytea_raw", bytes, corpus.size(), [&corpus]() {
+      uint64_t sum = 0;
+      for(auto &file : corpus) {
+	std::string row;
+	uint32_t size = file.size();
+	row.append(reinterpret_cast<const char *>(&size), sizeof(size));
+	row.append(file);
+	sum += row.size();
+      }
+      return sum;
+    });
+  runner.run("copy/bitshred_hex", shred.size() * corpus.size(), corpus.size(), [&corpus, &shred, m]() {
+      uint64_t sum = 0;
+      for(size_t i = 0; i < corpus.size(); ++i) {
+	Copy_Row row;
+	row << 1u << m << 5u << "djb2";
+	row.bytea(reinterpret_cast<const uint8_t *>(shred.data()), shred.size());
+	sum += row.str().size();
+      }
+      return sum;
+    });
+}
+
+
+int run(const gengetopt_args_info &args) {
+  Synthetic_Corpus_Config config = { static_cast<uint64_t>(args.seed_arg), static_cast<size_t>(args.files_arg), args.median_size_arg, args.size_sigma_arg, static_cast<size_t>(args.files_per_player_arg) };
+  Bench_Runner runner(args);
+  double bytes = 0;
+
+  if(args.files_arg < 1 || args.size_arg < 1 || args.ngram_arg < 1) throw std::invalid_argument("files, size, and ngram must be positive");
+  std::vector<std::string> corpus(synthetic_corpus(config));
+  for(auto &file : corpus) bytes += file.size();
+  std::cerr << boost::format("Corpus: %u files, %u bytes\n") % corpus.size() % static_cast<size_t>(bytes);
+  bench_hashes(runner, corpus, bytes);
+  bench_windows(runner, corpus, bytes, args.ngram_arg);
+  bench_shreds(runner, corpus, bytes, args.size_arg, args.ngram_arg);
+  bench_jaccard(runner, corpus, args.size_arg, args.ngram_arg);
+  bench_bigrams(runner, corpus, bytes);
+  bench_fuzzy(runner, corpus, bytes);
+  bench_copy(runner, corpus, bytes, args.size_arg);
+  if(args.output_given) {
+    std::ofstream out(args.output_arg);
+    write_json(out, args, bytes, runner.results);
+    if(!out) throw std::runtime_error(std::string("can not write ") + args.output_arg);
+  } else {
+    write_json(std::cout, args, bytes, runner.results);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int retval = -1;
+  gengetopt_args_info args;
+
+  if(cmdline_parser(argc, argv, &args) != 0) return 1;
+  try {
+    retval = run(args);
+  }
+  catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return retval;
+  }
+  return retval;
+}
@@ -0,0 +1,81 @@
+#include <sstream>
+#include "sid_cursor.hh"
+
+Sid_Cursor::Sid_Cursor(const std::vector<std::string> &tasks) : tasks(tasks), fetched(0), saved(0) {
+}
+
+unsigned long Sid_Cursor::load(pqxx::connection_base &conn) {
+  pqxx::work txn(conn, "load cursor");
+  unsigned long position = 0;
+  bool first = true;
+
+  for(auto &task : tasks) {
+    pqxx::result result(txn.exec("SELECT last_sid FROM calc_progress WHERE task = " + txn.quote(task)));
+    unsigned long last = result.empty() ? 0 : result[0][0].as<unsigned long>();
+    if(first || last < position) position = last;
+    first = false;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  fetched = saved = position;
+  return position;
+}
+
+void Sid_Cursor::reset(pqxx::connection_base &conn) {
+  pqxx::work txn(conn, "reset cursor");
+
+  for(auto &task : tasks) {
+    txn.exec("DELETE FROM calc_progress WHERE task = " + txn.quote(task));
+    txn.exec("DELETE FROM calc_failures WHERE task = " + txn.quote(task));
+  }
+  txn.commit();
+}
+
+void Sid_Cursor::issue(unsigned long sid) {
+  std::lock_guard<std::mutex> guard(lock);
+  in_work.insert(sid);
+  if(sid > fetched) fetched = sid;
+}
+
+void Sid_Cursor::done(unsigned long sid) {
+  std::lock_guard<std::mutex> guard(lock);
+  in_work.erase(sid);
+}
+
+void Sid_Cursor::failed(unsigned long sid, const std::string &task, const std::string &reason) {
+  std::lock_guard<std::mutex> guard(lock);
+  failures.push_back(std::make_pair(task, std::make_pair(sid, reason)));
+}
+
+bool Sid_Cursor::dirty() {
+  std::lock_guard<std::mutex> guard(lock);
+  unsigned long position = in_work.empty() ? fetched : *in_work.begin() - 1;
+  return !failures.empty() || position > saved;
+}
+
+void Sid_Cursor::save(pqxx::work &txn) {
+  std::lock_guard<std::mutex> guard(lock);
+  unsigned long position = in_work.empty() ? fetched : *in_work.begin() - 1;
+
+  for(auto &i : failures) {
+    txn.exec("INSERT INTO calc_failures (task, sid, reason) VALUES ("
+	     + txn.quote(i.first) + ','
+	     + txn.quote(i.second.first) + ','
+	     + txn.quote(i.second.second)
+	     + ") ON CONFLICT (task, sid) DO NOTHING");
+  }
+  failures.clear();
+  if(position <= saved) return;
+  for(auto &task : tasks) {
+    txn.exec("INSERT INTO calc_progress (task, last_sid) VALUES ("
+	     + txn.quote(task) + ',' + txn.quote(position)
+	     + ") ON CONFLICT (task) DO UPDATE SET last_sid = GREATEST(calc_progress.last_sid, EXCLUDED.last_sid)");
+  }
+  saved = position;
+}
+
+std::string Sid_Cursor::not_failed(pqxx::work &txn, const std::string &task) {
+  std::ostringstream query;
+
+  query << "NOT EXISTS (SELECT 1 FROM calc_failures f WHERE f.sid = files.sid AND f.task = " << txn.quote(task) << ")";
+  return query.str();
+}
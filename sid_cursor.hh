@@ -0,0 +1,63 @@
+#ifndef __SID_CURSOR_HH_2017__
+#define __SID_CURSOR_HH_2017__
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pqxx/pqxx>
+
+/*
+ * The calculators scan the files table by ascending sid. For each task
+ * (e.g. one bitshred configuration or a fuzzy hash) the largest sid up
+ * to which all files have been handled is kept in calc_progress, so a
+ * restarted calculator continues there instead of anti-joining the
+ * whole table again. SIDs which could not be hashed are stored in
+ * calc_failures and skipped by the scans.
+ */
+
+/*! \brief Resume position and failed SIDs of one scan over the files
+ *
+ * The fetch thread calls issue() for every SID handed out, the store
+ * thread calls done() or failed() once its rows are written. As the
+ * SIDs finish out of order, save() only advances the stored position
+ * up to the smallest SID still in work.
+ */
+class Sid_Cursor {
+  std::vector<std::string> tasks;
+  std::mutex lock;
+  std::set<unsigned long> in_work;
+  std::vector<std::pair<std::string, std::pair<unsigned long, std::string> > > failures;
+  unsigned long fetched;
+  unsigned long saved;
+
+public:
+  /*!
+   * \param tasks names of the tasks advanced together by this scan
+   */
+  explicit Sid_Cursor(const std::vector<std::string> &tasks);
+
+  /*! \brief Read the stored position
+   *
+   * \return smallest position of all tasks, 0 if a task is new
+   */
+  unsigned long load(pqxx::connection_base &conn);
+  /*! \brief Forget the stored position and failures of all tasks */
+  void reset(pqxx::connection_base &conn);
+
+  /*! \brief A SID was handed out, SIDs have to be ascending */
+  void issue(unsigned long sid);
+  /*! \brief All rows of a SID have been written */
+  void done(unsigned long sid);
+  /*! \brief A task failed for a SID, it will be skipped in future scans */
+  void failed(unsigned long sid, const std::string &task, const std::string &reason);
+  /*! \brief Something to save? */
+  bool dirty();
+  /*! \brief Store the failures and the position in the transaction */
+  void save(pqxx::work &txn);
+
+  /*! \brief Condition skipping failed SIDs of the task in a query on files */
+  static std::string not_failed(pqxx::work &txn, const std::string &task);
+};
+
+#endif
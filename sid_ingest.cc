@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <iostream>
+#include <boost/format.hpp>
+#include <pqxx/pqxx>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <tlsh.h>
+#include <fuzzy.h>
+#include "sid_ingest.cmdline.h"
+#include "psid.hh"
+#include "shred.hh"
+#include "pipeline.hh"
+#include "bulk_writer.hh"
+#include "ssdeep_ngrams.hh"
+#include "tlsh_index.hh"
+#include "mapped_file.hh"
+#include "metrics.hh"
+
+/*
+ * Replacement for sid_db.py. The collection tree is walked once, the
+ * files are parsed and fingerprinted by the pool and everything is
+ * stored with COPY: the files with the writer and the songs and
+ * fingerprints in its commit hook, so a file is committed together
+ * with all rows referencing it. The SIDs are taken from the sequence
+ * of files before the files are handed to the pool.
+ */
+
+#define RESERVE_STRIDE 1019
+#define STORE_BATCH 97
+#ifndef MIN_DATA_LENGTH
+#define MIN_DATA_LENGTH 256
+#endif
+
+typedef std::vector<Bitshred_Config> Config_List;
+
+/*! \brief A file to import with its reserved SID */
+struct Ingest_Job {
+  unsigned long sid;
+  std::string path;
+};
+
+/*! \brief Rows of an imported file, or the reason why it failed */
+struct Ingest_Result {
+  unsigned long sid;
+  std::string path;
+  size_t size;
+  std::string error;
+  Copy_Row file;
+  Copy_Row song;
+  std::vector<Copy_Row> bitshreds;
+  std::vector<Copy_Row> tlsh;
+  std::vector<Copy_Row> ssdeep;
+  std::vector<Copy_Row> ssdeep_ngrams;
+};
+
+/*! \brief Names of the files already in the database */
+std::unordered_set<std::string> get_known_files(pqxx::connection_base &conn) {
+  std::unordered_set<std::string> known;
+  pqxx::work txn(conn, "known files");
+  pqxx::result result;
+  pqxx::icursorstream cursor(txn, "SELECT filename FROM files", "known files", RESERVE_STRIDE);
+
+  while(cursor >> result) {
+    for(auto row : result) known.insert(row[0].c_str());
+  }
+  return known;
+}
+
+/*! \brief Take count SIDs from the sequence of files */
+std::vector<unsigned long> reserve_sids(pqxx::connection_base &conn, size_t count) {
+  std::vector<unsigned long> sids;
+  std::ostringstream query;
+  pqxx::work txn(conn, "reserve sids");
+
+  query << "SELECT nextval(pg_get_serial_sequence('files', 'sid')) FROM generate_series(1, " << count << ");";
+  pqxx::result result(txn.exec(query.str()));
+  for(auto row : result) sids.push_back(row[0].as<unsigned long>());
+  txn.commit();
+  return sids;
+}
+
+
+/*! \brief Parse and fingerprint a file, called in the pool */
+Ingest_Result ingest_file(const Ingest_Job &job, const Config_List &configs, const gengetopt_args_info &args) {
+  Ingest_Result result;
+
+  result.sid = job.sid;
+  result.path = job.path;
+  result.size = 0;
+  try {
+    Mapped_File file(job.path, "SID file", 0);
+    const uint8_t *data = file.data();
+    const size_t size = file.size();
+    Psid_Header header(parse_psid(data, size));
+    result.size = size;
+    result.file << job.sid << job.path;
+    if(args.no_data_flag) {
+      result.file.null();
+    } else {
+      result.file.bytea(data, size);
+    }
+    result.song << job.sid << header.name << header.author << header.released;
+    for(auto &config : configs) {
+      if(size < config.n) continue;
+      BitshredType bitshred(bitshred_function(config.hash)(data, size, config.m, config.n));
+      Copy_Row row;
+      row << job.sid << config.m << config.n << config.hash;
+      row.bytea(bitshred.data(), bitshred.byte_size());
+      result.bitshreds.push_back(row);
+    }
+    if(args.tlsh_flag && size >= MIN_DATA_LENGTH) {
+      Tlsh tlsh;
+      tlsh.final(data, size);
+      std::string hash(tlsh.getHash());
+      //Data with too little variation has no hash.
+      if(!hash.empty()) {
+	std::string bytes(tlsh_hex_bytes(hash));
+	Copy_Row row;
+	row << job.sid;
+	row.bytea(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+	result.tlsh.push_back(row);
+      }
+    }
+    if(args.ssdeep_flag) {
+      char hbuf[FUZZY_MAX_RESULT + 1];
+      if(fuzzy_hash_buf(data, size, hbuf) != 0) throw std::runtime_error("fuzzy hashing (ssdeep) failed");
+      Ssdeep_Hash hash(split_ssdeep_hash(hbuf));
+      Copy_Row row, ngrams;
+      row << job.sid << hash.blocksize << hash.signatures;
+      ngrams << job.sid << ssdeep_ngram_array(ssdeep_ngram_keys(hash.blocksize, hash.signatures));
+      result.ssdeep.push_back(row);
+      result.ssdeep_ngrams.push_back(ngrams);
+    }
+  }
+  catch(const std::exception &excp) {
+    result.error = excp.what();
+  }
+  return result;
+}
+
+
+/*! \brief Rows waiting for the commit of their files */
+struct Pending_Rows {
+  std::vector<Copy_Row> songs;
+  std::vector<Copy_Row> bitshreds;
+  std::vector<Copy_Row> tlsh;
+  std::vector<Copy_Row> ssdeep;
+  std::vector<Copy_Row> ssdeep_ngrams;
+
+  /*! \brief Store the rows in the transaction of the files, referenced tables first */
+  void copy(pqxx::work &txn) {
+    copy_rows(txn, "songs", { "sid", "name", "author", "released" }, songs);
+    copy_rows(txn, "bitshred", { "sid", "m", "n", "hash", "bitshred" }, bitshreds);
+    copy_rows(txn, "fuzzy_tlsh", { "sid", "hash" }, tlsh);
+    copy_rows(txn, "fuzzy_ssdeep", { "sid", "blocksize", "hash" }, ssdeep);
+    copy_rows(txn, "fuzzy_ssdeep_ngrams", { "sid", "ngrams" }, ssdeep_ngrams);
+    songs.clear();
+    bitshreds.clear();
+    tlsh.clear();
+    ssdeep.clear();
+    ssdeep_ngrams.clear();
+  }
+};
+
+template<typename T> static void append(std::vector<T> &to, const std::vector<T> &from) {
+  to.insert(to.end(), from.begin(), from.end());
+}
+
+
+int run(const std::string &connection_string, char **begin, char **end, const gengetopt_args_info &args) {
+  Config_List configs;
+  std::vector<std::string> files;
+  unsigned long stored, failed = 0;
+
+  try {
+    if(args.threads_arg < 0) throw std::invalid_argument("--threads must not be negative");
+    if(args.copy_batch_arg < 0) throw std::invalid_argument("--copy-batch must not be negative");
+    for(unsigned int i = 0; i < args.config_given; ++i) {
+      configs.push_back(parse_bitshred_config(args.config_arg[i]));
+      bitshred_function(configs.back().hash);
+    }
+    for(char **i = begin; i < end; ++i) find_sid_files(*i, true, files);
+    pqxx::connection store_conn(connection_string);
+    std::unordered_set<std::string> known(get_known_files(store_conn));
+    files.erase(std::remove_if(files.begin(), files.end(), [&known](const std::string &path) { return known.count(path) > 0; }), files.end());
+    std::cout << boost::format("Files to import: %u, already in the database: %u\n") % files.size() % known.size();
+    Metrics_Exporter exporter(args.metrics_given ? args.metrics_arg : "", "sid_ingest", args.metrics_interval_arg);
+    Metrics_Counter &imported(metrics().counter("imported_bytes"));
+    Pipeline_Config pipeline = { static_cast<unsigned int>(args.threads_arg), 0, STORE_BATCH };
+    pipeline.queue_size = 4 * (args.threads_arg > 0 ? args.threads_arg : std::thread::hardware_concurrency()) + 1;
+    Bulk_Writer writer(store_conn, "files", { "sid", "filename", "data" }, args.copy_batch_arg, args.flush_interval_arg);
+    Pending_Rows pending;
+    writer.on_commit([&pending](pqxx::work &txn) { pending.copy(txn); });
+    stored = run_pipeline<Ingest_Job, Ingest_Result>(pipeline,
+      [&](const std::function<bool(Ingest_Job &&)> &emit) {
+	pqxx::connection fetch_conn(connection_string);
+	Metrics_Timer &timer(metrics().timer("fetch"));
+	for(size_t first = 0; first < files.size(); first += RESERVE_STRIDE) {
+	  std::vector<unsigned long> sids;
+	  {
+	    Metrics_Scope scope(timer);
+	    sids = reserve_sids(fetch_conn, std::min<size_t>(RESERVE_STRIDE, files.size() - first));
+	  }
+	  for(size_t i = 0; i < sids.size(); ++i) {
+	    if(!emit({ sids[i], files[first + i] })) return;
+	  }
+	}
+      },
+      [&](const Ingest_Job &job) { return ingest_file(job, configs, args); },
+      [&](const std::vector<Ingest_Result> &batch) {
+	for(auto &i : batch) {
+	  //Failures are printed even if quiet, they are not stored.
+	  if(!i.error.empty()) {
+	    std::cout << boost::format("$%06lx %s failed: %s\n") % i.sid % i.path % i.error;
+	    ++failed;
+	    continue;
+	  }
+	  if(!args.quiet_flag) std::cout << boost::format("$%06lx $%04lX %s\n") % i.sid % i.size % i.path;
+	  imported.add(i.size);
+	  //The rows have to wait before the file is written, it may commit.
+	  pending.songs.push_back(i.song);
+	  append(pending.bitshreds, i.bitshreds);
+	  append(pending.tlsh, i.tlsh);
+	  append(pending.ssdeep, i.ssdeep);
+	  append(pending.ssdeep_ngrams, i.ssdeep_ngrams);
+	  writer.write(i.file);
+	}
+      });
+    writer.flush();
+    std::cout << boost::format("Done! Imported %u files, %u failed\n") % (stored - failed) % failed;
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Exception: " << excp.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char **argv) {
+  std::ostringstream connection_string;
+  int retval = -1;
+  gengetopt_args_info args;
+
+  if(cmdline_parser(argc, argv, &args) != 0) return 1;
+  try {
+    connection_string << "dbname=" << args.dbname_arg << " user=" << args.dbuser_arg;
+    if(args.dbhost_given) connection_string << " host=" << args.dbhost_arg;
+    if(args.dbpass_given) connection_string << " password=" << args.dbpass_arg;
+    retval = run(connection_string.str(), &args.inputs[0], &args.inputs[args.inputs_num], args);
+  }
+  catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return retval;
+  }
+  return retval;
+}
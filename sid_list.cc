@@ -0,0 +1,44 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include "sid_list.hh"
+
+std::vector<unsigned int> read_sid_list(std::istream &in) {
+  std::vector<unsigned int> sids;
+  std::string line;
+
+  while(std::getline(in, line)) {
+    std::istringstream words(line.substr(0, line.find('#')));
+    std::string word;
+    while(words >> word) {
+      try {
+	sids.push_back(boost::lexical_cast<unsigned int>(word));
+      }
+      catch(const boost::bad_lexical_cast &) {
+	throw std::invalid_argument("invalid SID in list: " + word);
+      }
+    }
+  }
+  if(in.bad()) throw std::runtime_error("can not read SID list");
+  return sids;
+}
+
+std::vector<unsigned int> read_sid_file(const std::string &fname) {
+  if(fname == "-") return read_sid_list(std::cin);
+  std::ifstream in(fname);
+  if(!in) throw std::runtime_error("can not open SID list: " + fname);
+  return read_sid_list(in);
+}
+
+std::vector<unsigned int> query_sids(char **begin, char **end, const char *fname) {
+  std::vector<unsigned int> sids;
+
+  for(; begin < end; ++begin) sids.push_back(boost::lexical_cast<unsigned int>(*begin));
+  if(fname) {
+    auto listed(read_sid_file(fname));
+    sids.insert(sids.end(), listed.begin(), listed.end());
+  }
+  return sids;
+}
@@ -0,0 +1,22 @@
+#ifndef __SID_LIST_HH_2017__
+#define __SID_LIST_HH_2017__
+#include <istream>
+#include <string>
+#include <vector>
+
+/*! \brief Read SIDs separated by white space
+ *
+ * Everything after a '#' up to the end of the line is a comment.
+ */
+std::vector<unsigned int> read_sid_list(std::istream &in);
+
+/*! \brief Read SIDs from a file, "-" is stdin */
+std::vector<unsigned int> read_sid_file(const std::string &fname);
+
+/*! \brief SIDs of the command line followed by the ones of the file
+ *
+ * \param fname file name or NULL
+ */
+std::vector<unsigned int> query_sids(char **begin, char **end, const char *fname);
+
+#endif
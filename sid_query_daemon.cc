@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <iostream>
+#include <boost/format.hpp>
+#include <pqxx/pqxx>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fuzzy.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sid_query_daemon.cmdline.h"
+#include "bitshred_pairs.hh"
+#include "jaccard.hh"
+#include "tlsh_index.hh"
+#include "ssdeep_ngrams.hh"
+#include "pipeline.hh"
+#include "topk.hh"
+#include "binary_copy.hh"
+#include "metrics.hh"
+#include "mapped_file.hh"
+
+/*
+ * Long running query service. All fingerprints and the song metadata
+ * are loaded into a snapshot, requests are answered from the current
+ * snapshot while a newer one is loaded in the background.
+ *
+ * The protocol is line based, every request is a single line:
+ *
+ *   SIMILAR <bitshred|tlsh|ssdeep> <sid> [k]
+ *   SONG <sid>
+ *   STATS
+ *   RELOAD
+ *   QUIT
+ *
+ * The answer is "OK <n>" followed by n lines or "ERR <reason>". The
+ * lines of SIMILAR and SONG are tab separated: sid, distance (only
+ * SIMILAR), name, author, released, filename.
+ *
+ * Every connection keeps a request thread until it is closed. So that
+ * slow or idle clients can not take all of them, connections without
+ * a complete request within the idle timeout are closed and those
+ * beyond --max-connections are refused.
+ *
+ * The fingerprint tables are read with a binary COPY on a second
+ * connection which shares the snapshot of the transaction.
+ */
+
+#define LOAD_STRIDE 1019
+#define SCAN_BLOCK 4096
+#define MAX_REQUEST 1024
+#define MAX_RESULTS 1000
+
+static std::atomic<bool> stopping(false);
+
+static void stop_handler(int) {
+  stopping = true;
+}
+
+struct Song_Info {
+  std::string name;
+  std::string author;
+  std::string released;
+  std::string filename;
+};
+
+struct Ssdeep_Entry {
+  uint32_t sid;
+  unsigned long blocksize;
+  std::string hash;
+};
+
+/*! \brief All fingerprints and songs, not changed after loading */
+struct Snapshot {
+  unsigned long generation;
+  std::string state;
+  std::unordered_map<unsigned int, Song_Info> songs;
+  std::unique_ptr<Bitshred_Table> shreds;
+  Tlsh_Index tlsh;
+  std::vector<Ssdeep_Entry> ssdeep;
+  std::unordered_map<int64_t, std::vector<uint32_t> > ssdeep_postings;
+  std::unordered_map<std::string, std::vector<uint32_t> > ssdeep_exact;
+};
+
+
+/*! \brief Database state, a changed state triggers a reload */
+std::string database_state(pqxx::work &txn, const gengetopt_args_info &args) {
+  std::ostringstream query;
+
+  query << "SELECT (SELECT count(*) || ':' || coalesce(max(sid), 0) FROM files)"
+	<< ", (SELECT count(*) || ':' || coalesce(max(sid), 0) FROM fuzzy_tlsh)"
+	<< ", (SELECT count(*) || ':' || coalesce(max(sid), 0) FROM fuzzy_ssdeep)";
+  if(args.size_given && args.ngram_given && args.hash_given) {
+    query << ", (SELECT count(*) || ':' || coalesce(max(sid), 0) FROM bitshred WHERE"
+	  << " m = " << args.size_arg
+	  << " AND n = " << args.ngram_arg
+	  << " AND hash = " << txn.quote(args.hash_arg)
+	  << ')';
+  }
+  pqxx::result result(txn.exec(query.str()));
+  std::string state;
+  for(size_t i = 0; i < result[0].size(); ++i) state += std::string(result[0][i].c_str()) + ' ';
+  return state;
+}
+
+
+/*! \brief Load a snapshot in a single transaction */
+std::shared_ptr<Snapshot> load_snapshot(const std::string &connection_string, const gengetopt_args_info &args, unsigned long generation) {
+  std::shared_ptr<Snapshot> snapshot(std::make_shared<Snapshot>());
+  pqxx::connection conn(connection_string);
+  pqxx::work txn(conn, "load snapshot");
+  Binary_Copy copy(connection_string);
+  pqxx::result result;
+  Metrics_Scope scope(metrics().timer("fetch"));
+
+  txn.exec("SET TRANSACTION ISOLATION LEVEL REPEATABLE READ READ ONLY;");
+  snapshot->generation = generation;
+  snapshot->state = database_state(txn, args);
+  copy.begin(txn.exec("SELECT pg_export_snapshot();")[0][0].c_str());
+  {
+    pqxx::icursorstream cursor(txn, "SELECT sid, name, author, released, filename FROM songs NATURAL JOIN files", "load songs", LOAD_STRIDE);
+    while(cursor >> result) {
+      for(auto row : result) {
+	Song_Info info = { row["name"].c_str(), row["author"].c_str(), row["released"].c_str(), row["filename"].c_str() };
+	snapshot->songs[row["sid"].as<unsigned int>()] = info;
+      }
+    }
+  }
+  if(args.size_given && args.ngram_given && args.hash_given) {
+    std::ostringstream condition;
+    snapshot->shreds.reset(new Bitshred_Table((args.size_arg + 7) / 8));
+    condition << " WHERE"
+	      << " m = " << args.size_arg
+	      << " AND n = " << args.ngram_arg
+	      << " AND hash = " << txn.quote(args.hash_arg);
+    snapshot->shreds->reserve(copy.count("SELECT count(*) FROM bitshred" + condition.str()));
+    copy.copy("SELECT sid, bitshred FROM bitshred" + condition.str() + " ORDER BY sid", 2, [&snapshot](const Copy_Field *fields) {
+	snapshot->shreds->add(fields[0].integer(), fields[1].data, fields[1].size);
+      });
+  }
+  snapshot->tlsh.reserve(copy.count("SELECT count(*) FROM fuzzy_tlsh"));
+  copy.copy("SELECT sid, hash FROM fuzzy_tlsh", 2, [&snapshot](const Copy_Field *fields) {
+      snapshot->tlsh.add(fields[0].integer(), tlsh_decode(fields[1].data, fields[1].size));
+    });
+  snapshot->tlsh.finish();
+  snapshot->ssdeep.reserve(copy.count("SELECT count(*) FROM fuzzy_ssdeep"));
+  copy.copy("SELECT sid, blocksize, hash FROM fuzzy_ssdeep ORDER BY sid", 3, [&snapshot](const Copy_Field *fields) {
+      Ssdeep_Entry entry = { uint32_t(fields[0].integer()), static_cast<unsigned long>(fields[1].integer()), std::string(reinterpret_cast<const char *>(fields[2].data), fields[2].size) };
+      uint32_t idx = snapshot->ssdeep.size();
+      try {
+	for(auto key : ssdeep_ngram_keys(entry.blocksize, entry.hash)) snapshot->ssdeep_postings[key].push_back(idx);
+      }
+      catch(const std::exception &excp) {
+	std::cerr << boost::format("ssdeep of SID %u not indexed: %s\n") % entry.sid % excp.what();
+      }
+      snapshot->ssdeep_exact[std::to_string(entry.blocksize) + ':' + entry.hash].push_back(idx);
+      snapshot->ssdeep.push_back(std::move(entry));
+    });
+  copy.commit();
+  return snapshot;
+}
+
+
+DistancesVector bitshred_closest(const Snapshot &snapshot, unsigned int sid, size_t k) {
+  Distance_Selector selector(Distance_Selector::top(k));
+  std::vector<Bitshred_Counts> counts(SCAN_BLOCK);
+
+  if(!snapshot.shreds) throw std::runtime_error("no bitshreds loaded");
+  Bitshred_Block block(snapshot.shreds->block());
+  const uint32_t *pos = std::lower_bound(block.sids, block.sids + block.count, sid);
+  if(pos == block.sids + block.count || *pos != sid) throw std::runtime_error("no bitshred for SID");
+  const uint8_t *fst = block.shred(pos - block.sids);
+  for(size_t begin = 0; begin < block.count; begin += SCAN_BLOCK) {
+    size_t num = std::min<size_t>(SCAN_BLOCK, block.count - begin);
+    jaccard_counts_many(fst, block.shred(begin), block.stride, block.bytes, num, counts.data());
+    for(size_t i = 0; i < num; ++i) {
+      if(block.sids[begin + i] != sid) selector.add(block.sids[begin + i], jaccard_distance(counts[i]));
+    }
+  }
+  return selector.take();
+}
+
+DistancesVector tlsh_closest(const Snapshot &snapshot, unsigned int sid, size_t k) {
+  const Tlsh_Digest *digest = snapshot.tlsh.find(sid);
+  //The query itself is among the closest, so one more is selected.
+  Distance_Selector selector(Distance_Selector::top(k + 1));
+  DistancesVector found;
+
+  if(!digest) throw std::runtime_error("no TLSH hash for SID");
+  snapshot.tlsh.closest(*digest, selector, NULL);
+  for(auto &i : selector.take()) {
+    if(i.first != sid && found.size() < k) found.push_back(i);
+  }
+  return found;
+}
+
+DistancesVector ssdeep_closest(const Snapshot &snapshot, unsigned int sid, size_t k) {
+  Distance_Selector selector(Distance_Selector::top(k));
+  auto pos = std::lower_bound(snapshot.ssdeep.begin(), snapshot.ssdeep.end(), sid, [](const Ssdeep_Entry &x, unsigned int y) { return x.sid < y; });
+  std::vector<uint32_t> candidates;
+
+  if(pos == snapshot.ssdeep.end() || pos->sid != sid) throw std::runtime_error("no ssdeep hash for SID");
+  std::string left(std::to_string(pos->blocksize) + ':' + pos->hash);
+  for(auto key : ssdeep_ngram_keys(pos->blocksize, pos->hash)) {
+    auto posting = snapshot.ssdeep_postings.find(key);
+    if(posting != snapshot.ssdeep_postings.end()) candidates.insert(candidates.end(), posting->second.begin(), posting->second.end());
+  }
+  auto exact = snapshot.ssdeep_exact.find(left);
+  if(exact != snapshot.ssdeep_exact.end()) candidates.insert(candidates.end(), exact->second.begin(), exact->second.end());
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  for(auto idx : candidates) {
+    const Ssdeep_Entry &entry(snapshot.ssdeep[idx]);
+    if(entry.sid == sid) continue;
+    std::string right(std::to_string(entry.blocksize) + ':' + entry.hash);
+    selector.add(entry.sid, 100 - fuzzy_compare(left.c_str(), right.c_str()));
+  }
+  return selector.take();
+}
+
+
+/*! \brief Tab separated song fields, unknown SIDs have empty fields */
+std::string song_fields(const Snapshot &snapshot, unsigned int sid) {
+  auto song = snapshot.songs.find(sid);
+  std::string line;
+
+  if(song != snapshot.songs.end()) {
+    line = song->second.name + '\t' + song->second.author + '\t' + song->second.released + '\t' + song->second.filename;
+  } else {
+    line = "\t\t\t";
+  }
+  std::replace(line.begin(), line.end(), '\n', ' ');
+  std::replace(line.begin(), line.end(), '\r', ' ');
+  return line;
+}
+
+
+/*! \brief The current snapshot, replaced by reload() */
+class Snapshot_Holder {
+  std::string connection_string;
+  const gengetopt_args_info &args;
+  std::mutex lock;
+  std::mutex reload_lock;
+  std::shared_ptr<const Snapshot> current;
+
+public:
+  Snapshot_Holder(const std::string &connection_string, const gengetopt_args_info &args) : connection_string(connection_string), args(args) {
+    current = load_snapshot(connection_string, args, 1);
+  }
+
+  std::shared_ptr<const Snapshot> get() {
+    std::lock_guard<std::mutex> guard(lock);
+    return current;
+  }
+
+  /*! \brief Load a new snapshot if the database changed
+   *
+   * \param force load even if the database did not change
+   * \return true if the snapshot was replaced
+   */
+  bool reload(bool force) {
+    std::lock_guard<std::mutex> reloading(reload_lock);
+    std::shared_ptr<const Snapshot> old(get());
+    if(!force) {
+      pqxx::connection conn(connection_string);
+      pqxx::work txn(conn, "check state");
+      if(database_state(txn, args) == old->state) return false;
+    }
+    std::shared_ptr<const Snapshot> fresh(load_snapshot(connection_string, args, old->generation + 1));
+    std::lock_guard<std::mutex> guard(lock);
+    current = fresh;
+    return true;
+  }
+};
+
+
+/*! \brief Answer a single request line
+ *
+ * \param close set to true if the connection should be closed
+ * \return the complete answer
+ */
+std::string answer(Snapshot_Holder &holder, const std::string &request, const gengetopt_args_info &args, bool &close) {
+  static Metrics_Timer &request_timer(metrics().timer("request"));
+  static Metrics_Timer &compare_timer(metrics().timer("compare"));
+  static Metrics_Counter &errors(metrics().counter("errors"));
+  Metrics_Scope scope(request_timer);
+  std::istringstream words(request);
+  std::string command;
+  std::ostringstream out;
+
+  words >> command;
+  std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+  try {
+    if(command == "SIMILAR") {
+      std::string method;
+      unsigned int sid;
+      int k = args.top_arg;
+      if(!(words >> method >> sid)) throw std::invalid_argument("usage: SIMILAR <bitshred|tlsh|ssdeep> <sid> [k]");
+      if(!(words >> k)) k = args.top_arg;
+      if(k < 0 || k > MAX_RESULTS) throw std::invalid_argument("k out of range");
+      std::shared_ptr<const Snapshot> snapshot(holder.get());
+      DistancesVector found;
+      //The selection of the closest is part of the scans.
+      Metrics_Scope compare_scope(compare_timer);
+      if(method == "bitshred") {
+	found = bitshred_closest(*snapshot, sid, k);
+      } else if(method == "tlsh") {
+	found = tlsh_closest(*snapshot, sid, k);
+      } else if(method == "ssdeep") {
+	found = ssdeep_closest(*snapshot, sid, k);
+      } else {
+	throw std::invalid_argument("unknown method: " + method);
+      }
+      out << "OK " << found.size() << '\n';
+      for(auto &i : found) out << i.first << '\t' << boost::format("%.6g") % i.second << '\t' << song_fields(*snapshot, i.first) << '\n';
+    } else if(command == "SONG") {
+      unsigned int sid;
+      if(!(words >> sid)) throw std::invalid_argument("usage: SONG <sid>");
+      std::shared_ptr<const Snapshot> snapshot(holder.get());
+      if(snapshot->songs.count(sid) == 0) throw std::runtime_error("unknown SID");
+      out << "OK 1\n" << sid << '\t' << song_fields(*snapshot, sid) << '\n';
+    } else if(command == "STATS") {
+      std::shared_ptr<const Snapshot> snapshot(holder.get());
+      out << "OK 1\n"
+	  << boost::format("generation %lu songs %u bitshreds %u tlsh %u ssdeep %u\n")
+	% snapshot->generation
+	% snapshot->songs.size()
+	% (snapshot->shreds ? snapshot->shreds->size() : 0)
+	% snapshot->tlsh.size()
+	% snapshot->ssdeep.size();
+    } else if(command == "RELOAD") {
+      holder.reload(true);
+      out << "OK 0\n";
+    } else if(command == "QUIT") {
+      close = true;
+      out << "OK 0\n";
+    } else {
+      throw std::invalid_argument("unknown command: " + command);
+    }
+  }
+  catch(const std::exception &excp) {
+    std::string reason(excp.what());
+    std::replace(reason.begin(), reason.end(), '\n', ' ');
+    errors.add();
+    return "ERR " + reason + '\n';
+  }
+  return out.str();
+}
+
+
+/*! \brief Connections served by the pool, shut down when stopping */
+class Connection_Set {
+  std::mutex lock;
+  std::set<int> fds;
+  size_t limit;
+
+public:
+  explicit Connection_Set(size_t limit) : limit(limit) {}
+  /*! \brief False if the limit is reached */
+  bool add(int fd) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(fds.size() >= limit) return false;
+    fds.insert(fd);
+    return true;
+  }
+  void remove(int fd) { std::lock_guard<std::mutex> guard(lock); fds.erase(fd); }
+  void shutdown_all() {
+    std::lock_guard<std::mutex> guard(lock);
+    for(int fd : fds) ::shutdown(fd, SHUT_RDWR);
+  }
+};
+
+static bool send_all(int fd, const std::string &data) {
+  size_t sent = 0;
+
+  while(sent < data.size()) {
+    ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+/*! \brief Timeouts of a single recv and send, a client trickling bytes is caught by serve() */
+static void set_timeouts(int fd, int seconds) {
+  struct timeval timeout;
+
+  timeout.tv_sec = seconds;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/*! \brief Answer all requests of a connection until it is closed or idle */
+void serve(int fd, Snapshot_Holder &holder, const gengetopt_args_info &args) {
+  std::string buffer;
+  char chunk[512];
+  bool close = false;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(args.idle_timeout_arg);
+
+  while(!close && !stopping) {
+    size_t eol = buffer.find('\n');
+    if(eol == std::string::npos) {
+      if(buffer.size() > MAX_REQUEST) {
+	send_all(fd, "ERR request too long\n");
+	break;
+      }
+      if(args.idle_timeout_arg > 0 && std::chrono::steady_clock::now() >= deadline) {
+	send_all(fd, "ERR idle timeout\n");
+	break;
+      }
+      //A recv timeout ends the connection as well.
+      ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+      if(n < 0 && errno == EINTR) continue;
+      if(n <= 0) break;
+      buffer.append(chunk, n);
+      continue;
+    }
+    std::string request(buffer.substr(0, eol));
+    buffer.erase(0, eol + 1);
+    if(!request.empty() && request.back() == '\r') request.pop_back();
+    if(request.empty()) continue;
+    if(!send_all(fd, answer(holder, request, args, close))) break;
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(args.idle_timeout_arg);
+  }
+}
+
+
+int listen_socket(const gengetopt_args_info &args) {
+  int fd;
+
+  if(args.port_given) {
+    struct sockaddr_in addr;
+    int one = 1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) throw system_error("can not create socket");
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(args.port_arg);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      throw system_error("can not bind to port " + std::to_string(args.port_arg));
+    }
+  } else {
+    struct sockaddr_un addr;
+    std::string path(args.socket_arg);
+    if(path.size() >= sizeof(addr.sun_path)) throw std::invalid_argument("socket path too long");
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) throw system_error("can not create socket");
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      throw system_error("can not bind to " + path);
+    }
+  }
+  if(listen(fd, SOMAXCONN) != 0) {
+    ::close(fd);
+    throw system_error("can not listen");
+  }
+  return fd;
+}
+
+
+int run(const std::string &connection_string, const gengetopt_args_info &args) {
+  struct sigaction action;
+  sigset_t signals;
+  std::mutex stop_lock;
+  std::condition_variable stop_signal;
+  unsigned int threads = args.threads_arg > 0 ? args.threads_arg : std::thread::hardware_concurrency();
+  unsigned int max_connections = args.max_connections_arg > 0 ? args.max_connections_arg : std::max(threads, 1u);
+
+  if(args.threads_arg < 0) throw std::invalid_argument("--threads must not be negative");
+  if(args.max_connections_arg < 0) throw std::invalid_argument("--max-connections must not be negative");
+  if(args.idle_timeout_arg < 0) throw std::invalid_argument("--idle-timeout must not be negative");
+  Connection_Set connections(max_connections);
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_handler;
+  //No SA_RESTART, accept() returns on a signal.
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  //Only the accepting thread gets the signals, the others block them.
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  Metrics_Exporter exporter(args.metrics_given ? args.metrics_arg : "", "sid_query_daemon", args.metrics_interval_arg);
+  Snapshot_Holder holder(connection_string, args);
+  {
+    auto snapshot(holder.get());
+    std::cout << boost::format("Loaded %u songs, %u bitshreds, %u TLSH, %u ssdeep\n")
+      % snapshot->songs.size()
+      % (snapshot->shreds ? snapshot->shreds->size() : 0)
+      % snapshot->tlsh.size()
+      % snapshot->ssdeep.size()
+	      << std::flush;
+  }
+  int listener = listen_socket(args);
+  std::thread reloader([&]() {
+      std::unique_lock<std::mutex> guard(stop_lock);
+      while(args.reload_arg > 0 && !stop_signal.wait_for(guard, std::chrono::seconds(args.reload_arg), [] { return stopping.load(); })) {
+	try {
+	  if(holder.reload(false)) std::cout << "Reloaded, generation " << holder.get()->generation << std::endl;
+	}
+	catch(const std::exception &excp) {
+	  std::cerr << "Reload failed: " << excp.what() << std::endl;
+	}
+      }
+    });
+  {
+    //Room for every connection and the tasks just closing theirs, submit never blocks accept.
+    Work_Stealing_Pool pool(threads, max_connections + std::max(threads, 1u));
+    Metrics_Counter &rejected(metrics().counter("rejected_connections"));
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    while(!stopping) {
+      int fd = accept(listener, NULL, NULL);
+      if(fd < 0) {
+	if(errno == EINTR || errno == ECONNABORTED) continue;
+	std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+	break;
+      }
+      if(args.idle_timeout_arg > 0) set_timeouts(fd, args.idle_timeout_arg);
+      if(!connections.add(fd)) {
+	rejected.add();
+	send_all(fd, "ERR too many connections\n");
+	::close(fd);
+	continue;
+      }
+      pool.submit([fd, &holder, &args, &connections]() {
+	  try {
+	    serve(fd, holder, args);
+	  }
+	  catch(const std::exception &excp) {
+	    std::cerr << "Connection failed: " << excp.what() << std::endl;
+	  }
+	  connections.remove(fd);
+	  ::close(fd);
+	});
+    }
+    stopping = true;
+    connections.shutdown_all();
+    pool.finish();
+  }
+  ::close(listener);
+  if(!args.port_given) unlink(args.socket_arg);
+  {
+    std::lock_guard<std::mutex> guard(stop_lock);
+    stop_signal.notify_all();
+  }
+  reloader.join();
+  return 0;
+}
+
+
+int main(int argc, char **argv) {
+  std::ostringstream connection_string;
+  int retval = -1;
+  gengetopt_args_info args;
+
+  if(cmdline_parser(argc, argv, &args) != 0) return 1;
+  try {
+    connection_string << "dbname=" << args.dbname_arg << " user=" << args.dbuser_arg;
+    if(args.dbhost_given) connection_string << " host=" << args.dbhost_arg;
+    if(args.dbpass_given) connection_string << " password=" << args.dbpass_arg;
+    retval = run(connection_string.str(), args);
+  }
+  catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return retval;
+  }
+  return retval;
+}
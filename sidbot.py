@@ -6,6 +6,8 @@ the SID database.
 
 """
 
+import os
+import socket
 import time
 import irc
 import irc.bot
@@ -140,9 +142,42 @@ def handle_similar(dbconn, conn, cmd, words):
     @param words: remaining parameters
     @return: list of results to be sent to channel or None
     """
-    #sid = int(words[0])
-    #TODO: implement
-    return ["one", "two", "three"]
+    usage = u"usage: ^similar <sid> [%s]" % "|".join(SIMILAR_METHODS)
+    if len(words) not in (1, 2) or not words[0].isdigit():
+        return usage
+    sid = int(words[0])
+    method = words[1] if len(words) > 1 else "tlsh"
+    if method not in SIMILAR_METHODS:
+        return usage
+    try:
+        reply = query_daemon("SIMILAR %s %d %d" % (method, sid, SIMILAR_COUNT))
+    except (RuntimeError, socket.error), excp:
+        return u"⚔ERROR: %s" % excp
+    ret = []
+    for line in reply:
+        fields = line.split('\t')
+        ret.append(u"%s d=%s: %s" % (fields[0], fields[1], ", ".join(i.decode("utf-8") for i in fields[2:5])))
+    return ret
+
+def query_daemon(request):
+    """
+    Send a request to the sid_query_daemon.
+
+    @param request: request line without the newline
+    @return: list of the answer lines
+    """
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.settimeout(5)
+        sock.connect(QUERY_SOCKET)
+        sock.sendall(request + "\n")
+        answer = sock.makefile("r")
+        status = answer.readline().rstrip("\n")
+        if not status.startswith("OK "):
+            raise RuntimeError("query daemon: " + status)
+        return [answer.readline().rstrip("\n") for i in range(int(status[3:]))]
+    finally:
+        sock.close()
 
 def develop(args):
     """
@@ -153,6 +188,10 @@ def develop(args):
     conn = psycopg2.connect(constr)
     print handle_song(conn, None, "song", args[5:])
 
+QUERY_SOCKET = os.environ.get("SIDQUERY_SOCKET", "/tmp/sidabaeus.sock")
+SIMILAR_COUNT = 3
+SIMILAR_METHODS = ("bitshred", "tlsh", "ssdeep")
+
 FUNCTIONS = {
     "code" : handle_code,
     "song" : handle_song,
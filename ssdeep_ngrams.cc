@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <stdexcept>
+#include "ssdeep_ngrams.hh"
+
+static int base64_value(char c) {
+  if(c >= 'A' && c <= 'Z') return c - 'A';
+  if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if(c >= '0' && c <= '9') return c - '0' + 52;
+  if(c == '+') return 62;
+  if(c == '/') return 63;
+  throw std::invalid_argument(std::string("invalid character in ssdeep signature: ") + c);
+}
+
+/*! \brief Shorten runs of equal characters to three, like eliminate_sequences() */
+static std::string eliminate_sequences(const std::string &signature) {
+  std::string result;
+
+  for(size_t i = 0; i < signature.size(); ++i) {
+    if(i >= 3 && signature[i] == signature[i - 1] && signature[i] == signature[i - 2] && signature[i] == signature[i - 3]) continue;
+    result += signature[i];
+  }
+  return result;
+}
+
+static void add_keys(unsigned long blocksize, const std::string &signature, std::vector<int64_t> &keys) {
+  int64_t level = 0;
+  std::string sig(eliminate_sequences(signature));
+
+  while((static_cast<unsigned long>(SSDEEP_MIN_BLOCKSIZE) << level) < blocksize) ++level;
+  if((static_cast<unsigned long>(SSDEEP_MIN_BLOCKSIZE) << level) != blocksize) throw std::invalid_argument("invalid ssdeep blocksize " + std::to_string(blocksize));
+  if(sig.size() < SSDEEP_NGRAM) {
+    //No n-gram, but an equal signature still makes equal hashes.
+    int64_t key = level << 3 | sig.size();
+    for(char c : sig) key = key << 6 | base64_value(c);
+    keys.push_back(SSDEEP_SHORT_KEY | key << 6 * (SSDEEP_NGRAM - 1 - sig.size()));
+  }
+  for(size_t i = 0; i + SSDEEP_NGRAM <= sig.size(); ++i) {
+    int64_t key = level;
+    for(size_t j = 0; j < SSDEEP_NGRAM; ++j) key = key << 6 | base64_value(sig[i + j]);
+    keys.push_back(key);
+  }
+}
+
+Ssdeep_Hash split_ssdeep_hash(const std::string &hash) {
+  Ssdeep_Hash result = { 0, std::string() };
+  size_t colon = hash.find(':');
+
+  if(colon == 0 || colon == std::string::npos || colon > 10 || hash.find_first_not_of("0123456789") != colon || hash.find(':', colon + 1) == std::string::npos) {
+    throw std::invalid_argument("ssdeep hash must be blocksize:signature:signature: " + hash);
+  }
+  result.blocksize = std::stoul(hash.substr(0, colon));
+  result.signatures = hash.substr(colon + 1);
+  return result;
+}
+
+std::vector<int64_t> ssdeep_ngram_keys(unsigned long blocksize, const std::string &signatures) {
+  std::vector<int64_t> keys;
+  size_t colon = signatures.find(':');
+
+  if(colon == std::string::npos) throw std::invalid_argument("ssdeep hash without second signature");
+  add_keys(blocksize, signatures.substr(0, colon), keys);
+  add_keys(2 * blocksize, signatures.substr(colon + 1), keys);
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+std::string ssdeep_ngram_array(const std::vector<int64_t> &keys) {
+  std::string result("{");
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    if(i > 0) result += ',';
+    result += std::to_string(keys[i]);
+  }
+  return result + '}';
+}
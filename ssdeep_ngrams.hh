@@ -0,0 +1,54 @@
+#ifndef __SSDEEP_NGRAMS_HH_2017__
+#define __SSDEEP_NGRAMS_HH_2017__
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * fuzzy_compare() scores two ssdeep hashes only if they have a
+ * signature for the same blocksize, the first signature is for the
+ * blocksize and the second for twice the blocksize, and these
+ * signatures share a substring of SSDEEP_NGRAM characters after runs of
+ * more than three equal characters were shortened. Otherwise the
+ * score is 0, except for identical hashes.
+ *
+ * Each such substring is packed with its blocksize into a key, two
+ * hashes sharing a key are the candidates for a non-zero score. The
+ * base64 characters take 6 bits each, the blocksize 3 * 2^i is stored
+ * as i above them.
+ *
+ * A signature shorter than SSDEEP_NGRAM after shortening the runs has
+ * no n-gram, it gets a single key of its length and characters with
+ * SSDEEP_SHORT_KEY set instead. Identical hashes share it, so the keys
+ * still find every hash with a non-zero score.
+ */
+
+#define SSDEEP_NGRAM 7
+#define SSDEEP_MIN_BLOCKSIZE 3
+#define SSDEEP_SHORT_KEY (INT64_C(1) << 62)
+
+/*! \brief An ssdeep hash split into its blocksize and its signatures */
+struct Ssdeep_Hash {
+  unsigned long blocksize;
+  std::string signatures;
+};
+
+/*! \brief Split blocksize:signature:signature as from fuzzy_hash_buf()
+ *
+ * The signatures are kept together, as in the hash column of
+ * fuzzy_ssdeep.
+ */
+Ssdeep_Hash split_ssdeep_hash(const std::string &hash);
+
+/*! \brief Keys of the n-grams of an ssdeep hash
+ *
+ * \param blocksize blocksize of the hash
+ * \param signatures both signatures separated by ':', as in fuzzy_ssdeep
+ * \return ascending unique keys
+ */
+std::vector<int64_t> ssdeep_ngram_keys(unsigned long blocksize, const std::string &signatures);
+
+/*! \brief Keys as PostgreSQL array literal */
+std::string ssdeep_ngram_array(const std::vector<int64_t> &keys);
+
+#endif
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include "storage.hh"
+#include "pg_storage.hh"
+#include "local_storage.hh"
+#include "ssdeep_ngrams.hh"
+
+std::string bitshred_kind(unsigned int m, unsigned int n, const std::string &hash) {
+  std::ostringstream name;
+
+  name << "bitshred " << m << ':' << n << ':' << hash;
+  return name.str();
+}
+
+bool parse_bitshred_kind(const std::string &kind, unsigned int &m, unsigned int &n, std::string &hash) {
+  std::istringstream in(kind);
+  std::string prefix;
+  char sep1, sep2;
+
+  if(!(in >> prefix) || prefix != "bitshred") return false;
+  if(!(in >> m >> sep1 >> n >> sep2) || sep1 != ':' || sep2 != ':') return false;
+  if(!std::getline(in, hash) || hash.empty()) return false;
+  return true;
+}
+
+
+void Sid_Storage::scan_ssdeep_candidates(const std::string &hash, const std::vector<int64_t> &keys, const Fingerprint_Callback &fn) {
+  std::vector<int64_t> common;
+
+  scan(SSDEEP_KIND, [&](unsigned int sid, const uint8_t *data, size_t size) {
+      std::string other(reinterpret_cast<const char *>(data), size);
+      if(other != hash) {
+	std::vector<int64_t> other_keys;
+	try {
+	  Ssdeep_Hash split(split_ssdeep_hash(other));
+	  other_keys = ssdeep_ngram_keys(split.blocksize, split.signatures);
+	}
+	catch(const std::exception &) {
+	  return;
+	}
+	common.clear();
+	std::set_intersection(keys.begin(), keys.end(), other_keys.begin(), other_keys.end(), std::back_inserter(common));
+	if(common.empty()) return;
+      }
+      fn(sid, data, size);
+    });
+}
+
+
+std::unique_ptr<Sid_Storage> open_storage(const std::string &connection_string, const char *local_dir) {
+  if(local_dir) return std::unique_ptr<Sid_Storage>(new Local_Storage(local_dir));
+  return std::unique_ptr<Sid_Storage>(new Pg_Storage(connection_string));
+}
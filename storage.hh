@@ -0,0 +1,133 @@
+#ifndef __STORAGE_HH_2017__
+#define __STORAGE_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * The calculators and the queries only see this interface, so they
+ * either work on the PostgreSQL database (Pg_Storage) or on a directory
+ * of SID files with the fingerprints in local files (Local_Storage).
+ *
+ * A fingerprint kind is named like its task in calc_progress, e.g.
+ * 'bitshred 8192:5:djb2', 'fuzzy_tlsh', or 'fuzzy_ssdeep'. The values
+ * are the raw bitshred, the 35 bytes of the TLSH digest, and the ssdeep
+ * hash as blocksize:hash.
+ */
+
+#define TLSH_KIND "fuzzy_tlsh"
+#define SSDEEP_KIND "fuzzy_ssdeep"
+
+/*! \brief Name of the fingerprint kind of a bitshred configuration */
+std::string bitshred_kind(unsigned int m, unsigned int n, const std::string &hash);
+/*! \brief Configuration of a bitshred kind
+ *
+ * \return false if the kind is not a bitshred
+ */
+bool parse_bitshred_kind(const std::string &kind, unsigned int &m, unsigned int &n, std::string &hash);
+
+/*! \brief Data of a file and the fingerprint kinds it lacks
+ *
+ * The data is either copied into data or, if the storage maps the
+ * files, mapped points into the storage which outlives the job.
+ */
+struct Sid_Data {
+  unsigned long sid;
+  std::string data;
+  std::vector<bool> missing;
+  const uint8_t *mapped;
+  size_t mapped_size;
+
+  const uint8_t *bytes() const { return mapped ? mapped : reinterpret_cast<const uint8_t *>(data.data()); }
+  size_t size() const { return mapped ? mapped_size : data.size(); }
+};
+
+/*! \brief Song information of a SID for listings */
+struct Sid_Entry {
+  unsigned int sid;
+  std::string name;
+  std::string author;
+  std::string released;
+  std::string filename;
+  size_t size;
+};
+
+/*! \brief Called for every fingerprint of a scan, must not use the storage */
+typedef std::function<void(unsigned int sid, const uint8_t *data, size_t size)> Fingerprint_Callback;
+
+/*! \brief Files without fingerprints, used by the fetch thread */
+class File_Source {
+public:
+  virtual ~File_Source() {}
+  /*! \brief Up to maxs files larger than after lacking one of the kinds
+   *
+   * The SIDs are ascending, SIDs which failed before are skipped.
+   */
+  virtual std::vector<Sid_Data> next(unsigned long after, size_t maxs) = 0;
+};
+
+/*! \brief Destination of the fingerprints, used by the store stage
+ *
+ * The kinds are given by their index in the list the writer was
+ * created with. The fetch thread calls issue(), everything else is
+ * called by the store stage.
+ */
+class Fingerprint_Writer {
+public:
+  virtual ~Fingerprint_Writer() {}
+  /*! \brief SID after which the scan starts */
+  virtual unsigned long start() const = 0;
+  /*! \brief A SID was handed out, SIDs have to be ascending */
+  virtual void issue(unsigned long sid) = 0;
+  virtual void write(unsigned long sid, size_t kind, const uint8_t *data, size_t size) = 0;
+  /*! \brief A kind failed for a SID, it will be skipped in future scans */
+  virtual void failed(unsigned long sid, size_t kind, const std::string &reason) = 0;
+  /*! \brief All fingerprints of a SID have been written */
+  virtual void done(unsigned long sid) = 0;
+  /*! \brief Called after a batch, saves the progress if nothing is pending */
+  virtual void checkpoint() = 0;
+  /*! \brief Store everything written, has to be called at the end */
+  virtual void flush() = 0;
+};
+
+/*! \brief Files and fingerprints of the SID collection */
+class Sid_Storage {
+public:
+  virtual ~Sid_Storage() {}
+
+  /*! \brief Source of the files lacking one of the kinds
+   *
+   * \param min_size only files with at least this many bytes
+   */
+  virtual std::unique_ptr<File_Source> files_without(const std::vector<std::string> &kinds, size_t min_size) = 0;
+  /*!
+   * \param batch_size fingerprints per commit
+   * \param flush_interval seconds after which the fingerprints are committed
+   * \param rescan start at the first SID and retry failed SIDs
+   */
+  virtual std::unique_ptr<Fingerprint_Writer> writer(const std::vector<std::string> &kinds, size_t batch_size, double flush_interval, bool rescan) = 0;
+  /*! \brief Bring an index of the kind up to date after calculating */
+  virtual void update_index(const std::string &, size_t, double) {}
+
+  /*! \brief All fingerprints of a kind in ascending SID order */
+  virtual void scan(const std::string &kind, const Fingerprint_Callback &fn) = 0;
+  /*! \brief Fingerprints of the SIDs, missing ones are left out */
+  virtual std::vector<std::pair<unsigned int, std::string> > get(const std::string &kind, const std::vector<unsigned int> &sids) = 0;
+  /*! \brief Song information of the SIDs ordered by SID */
+  virtual std::vector<Sid_Entry> entries(const std::vector<unsigned int> &sids) = 0;
+  /*! \brief ssdeep hashes which may be similar to hash
+   *
+   * These are the equal hashes and those sharing one of the n-gram
+   * keys. The default scans all hashes.
+   */
+  virtual void scan_ssdeep_candidates(const std::string &hash, const std::vector<int64_t> &keys, const Fingerprint_Callback &fn);
+};
+
+/*! \brief Open the local directory or, if none is given, the database */
+std::unique_ptr<Sid_Storage> open_storage(const std::string &connection_string, const char *local_dir);
+
+#endif
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include "synthetic_sid.hh"
+#include "psid.hh"
+
+#define SYNTHETIC_DATA_OFFSET 0x7c
+#define SYNTHETIC_MIN_PAYLOAD 256
+#define SYNTHETIC_MAX_PAYLOAD 0xFFFF
+
+namespace {
+
+/*! \brief splitmix64, portable and good enough for test data */
+class Synthetic_Random {
+  uint64_t state;
+
+public:
+  explicit Synthetic_Random(uint64_t seed) : state(seed) {}
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  /*! \brief Uniform in [0, n) */
+  size_t below(size_t n) { return next() % n; }
+  /*! \brief Uniform in (0, 1) */
+  double uniform() { return (static_cast<double>(next() >> 11) + 0.5) / 9007199254740992.0; }
+  /*! \brief Standard normal with Box-Muller */
+  double normal() { return std::sqrt(-2.0 * std::log(uniform())) * std::cos(6.283185307179586 * uniform()); }
+};
+
+struct Player {
+  std::string code;
+  uint16_t base;
+};
+
+}
+
+static void put_be16(std::string &out, size_t pos, uint16_t value) {
+  out[pos] = static_cast<char>(value >> 8);
+  out[pos + 1] = static_cast<char>(value);
+}
+
+static void put_le16(std::string &out, uint16_t value) {
+  out += static_cast<char>(value);
+  out += static_cast<char>(value >> 8);
+}
+
+/*! \brief Player routine: 6502 code writing to the SID registers */
+static Player make_player(Synthetic_Random &random) {
+  static const uint8_t immediate[] = { 0xA9, 0xA2, 0xA0, 0xC9, 0x29, 0x09, 0x69, 0xE9 };
+  static const uint8_t absolute[] = { 0xAD, 0xBD, 0xB9, 0xEE, 0xCE, 0x20, 0x4C };
+  static const uint8_t implied[] = { 0xE8, 0xCA, 0xC8, 0x88, 0x0A, 0x4A, 0x18, 0x38, 0xAA, 0xA8, 0x48, 0x68 };
+  static const uint8_t branch[] = { 0xD0, 0xF0, 0x10, 0x30, 0x90, 0xB0 };
+  Player player;
+  size_t size = 800 + random.below(1600);
+
+  player.base = 0x1000 + 0x100 * random.below(0x20);
+  while(player.code.size() < size) {
+    size_t kind = random.below(16);
+    uint16_t address = player.base + random.below(size + 0x400);
+    if(kind < 5) {
+      //STA/STX $D4xx, the most common instructions of a player
+      player.code += static_cast<char>(random.below(3) == 0 ? 0x9D : 0x8D);
+      put_le16(player.code, 0xD400 + random.below(0x19));
+    } else if(kind < 8) {
+      player.code += static_cast<char>(immediate[random.below(sizeof(immediate))]);
+      player.code += static_cast<char>(random.below(4) == 0 ? random.below(256) : random.below(16));
+    } else if(kind < 11) {
+      player.code += static_cast<char>(absolute[random.below(sizeof(absolute))]);
+      put_le16(player.code, address);
+    } else if(kind < 14) {
+      player.code += static_cast<char>(implied[random.below(sizeof(implied))]);
+    } else if(kind < 15) {
+      player.code += static_cast<char>(branch[random.below(sizeof(branch))]);
+      player.code += static_cast<char>(0x100 - 2 - random.below(64));
+    } else {
+      player.code += static_cast<char>(0x60);
+    }
+  }
+  return player;
+}
+
+/*! \brief Copy of a player moved to another page, the addresses follow */
+static std::string relocate(const Player &player, uint16_t base) {
+  std::string code(player.code);
+  int delta = (base - player.base) >> 8;
+
+  for(size_t i = 2; i < code.size(); ++i) {
+    uint8_t high = code[i];
+    if(high >= player.base >> 8 && high < (player.base >> 8) + 0x10) code[i] = static_cast<char>(high + delta);
+  }
+  return code;
+}
+
+/*! \brief Music data: instrument table and patterns repeated with changes */
+static void make_music(Synthetic_Random &random, size_t size, std::string &out) {
+  size_t end = out.size() + size;
+  size_t instruments = 4 + random.below(12);
+  std::vector<std::string> patterns;
+
+  for(size_t i = 0; i < instruments * 8 && out.size() < end; ++i) out += static_cast<char>(random.below(256));
+  while(out.size() < end) {
+    if(patterns.empty() || random.below(3) == 0) {
+      std::string pattern;
+      size_t length = 16 + random.below(48);
+      uint8_t note = 24 + random.below(48);
+      while(pattern.size() < length) {
+	note = std::min<int>(0x5F, std::max<int>(0, note + static_cast<int>(random.below(13)) - 6));
+	if(random.below(4) == 0) pattern += static_cast<char>(0x80 | random.below(32));
+	if(random.below(8) == 0) pattern += static_cast<char>(0xA0 | random.below(instruments));
+	pattern += static_cast<char>(note);
+      }
+      pattern += static_cast<char>(0xFF);
+      patterns.push_back(pattern);
+    }
+    std::string pattern(patterns[random.below(patterns.size())]);
+    if(random.below(2) == 0) pattern[random.below(pattern.size() - 1)] = static_cast<char>(random.below(0x60));
+    out.append(pattern, 0, std::min(pattern.size(), end - out.size()));
+    //Runs of equal bytes, e.g. empty tables, are common.
+    if(random.below(6) == 0) out.append(std::min<size_t>(random.below(64), end - out.size()), static_cast<char>(random.below(2) ? 0x00 : 0xFF));
+  }
+}
+
+/*! \brief Header fields and strings of a file */
+static void make_header(Synthetic_Random &random, size_t idx, uint16_t load, std::string &out) {
+  static const char *names[] = { "Commando", "Delta", "Cybernoid", "Last Ninja", "Monty", "Lightforce", "Wizball", "Ghosts", "Arkanoid", "Comic Bakery" };
+  static const char *authors[] = { "Rob Hubbard", "Martin Galway", "Ben Daglish", "Chris Huelsbeck", "Jeroen Tel", "Matt Gray", "David Whittaker", "Tim Follin" };
+  char buf[PSID_STRING_SIZE];
+
+  out.assign(SYNTHETIC_DATA_OFFSET, '\0');
+  put_be16(out, 0, PSID_MAGIC >> 16);
+  put_be16(out, 2, PSID_MAGIC & 0xFFFF);
+  put_be16(out, 4, 2);
+  put_be16(out, 6, SYNTHETIC_DATA_OFFSET);
+  put_be16(out, 10, load);
+  put_be16(out, 12, load + 3);
+  put_be16(out, 14, 1 + random.below(8));
+  put_be16(out, 16, 1);
+  std::snprintf(buf, sizeof(buf), "%s %zu", names[random.below(sizeof(names) / sizeof(names[0]))], idx);
+  out.replace(22, std::string(buf).size(), buf);
+  std::snprintf(buf, sizeof(buf), "%s", authors[random.below(sizeof(authors) / sizeof(authors[0]))]);
+  out.replace(22 + PSID_STRING_SIZE, std::string(buf).size(), buf);
+  std::snprintf(buf, sizeof(buf), "%u Synthetic", static_cast<unsigned int>(1982 + random.below(36)));
+  out.replace(22 + 2 * PSID_STRING_SIZE, std::string(buf).size(), buf);
+  //The load address is taken from the data (load_address == 0).
+  put_le16(out, load);
+}
+
+std::vector<std::string> synthetic_corpus(const Synthetic_Corpus_Config &config) {
+  Synthetic_Random random(config.seed);
+  std::vector<Player> players;
+  std::vector<std::string> files;
+
+  if(config.median_size <= 0 || config.size_sigma < 0) throw std::invalid_argument("invalid size distribution");
+  for(size_t i = 0; i < config.files / std::max<size_t>(config.files_per_player, 1) + 1; ++i) players.push_back(make_player(random));
+  files.reserve(config.files);
+  for(size_t i = 0; i < config.files; ++i) {
+    const Player &player(players[random.below(players.size())]);
+    uint16_t load = 0x0800 + 0x100 * random.below(0x80);
+    double size = config.median_size * std::exp(config.size_sigma * random.normal());
+    size_t payload = std::min<size_t>(SYNTHETIC_MAX_PAYLOAD, std::max<size_t>(SYNTHETIC_MIN_PAYLOAD, size > SYNTHETIC_DATA_OFFSET + 2 ? size - SYNTHETIC_DATA_OFFSET - 2 : 0));
+    std::string file;
+    make_header(random, i, load, file);
+    std::string code(relocate(player, load));
+    file.append(code, 0, std::min(code.size(), payload / 2));
+    make_music(random, payload - std::min(code.size(), payload / 2), file);
+    files.push_back(file);
+  }
+  return files;
+}
@@ -0,0 +1,35 @@
+#ifndef __SYNTHETIC_SID_HH_2017__
+#define __SYNTHETIC_SID_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Deterministic corpus of PSID-like files for benchmarks without the
+ * database. A file is a version 2 header followed by a player routine
+ * and music data. The players are shared by several files and
+ * relocated, like a composer reusing his player, so the fingerprints
+ * have close neighbours as in the real collection. The sizes follow a
+ * log-normal distribution; set the median and the spread to the values
+ * printed by data/length_histogram.py for the collection at hand.
+ *
+ * Only a splitmix64 generator is used, not the distributions of the
+ * standard library, so the corpus is the same for every compiler.
+ */
+
+struct Synthetic_Corpus_Config {
+  uint64_t seed;
+  size_t files;
+  /*! \brief Median file size in bytes */
+  double median_size;
+  /*! \brief Standard deviation of the logarithm of the size */
+  double size_sigma;
+  /*! \brief Number of files sharing one player on average */
+  size_t files_per_player;
+};
+
+/*! \brief Generate the files of a corpus, same config gives same files */
+std::vector<std::string> synthetic_corpus(const Synthetic_Corpus_Config &config);
+
+#endif
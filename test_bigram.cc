@@ -0,0 +1,59 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bigram.hh"
+#include "unit_test.hh"
+
+/*
+ * The split counting (four interleaved sub-histograms) has to give the
+ * same counts as the plain loop, for every tail length and for data
+ * with runs, which is what the split is for.
+ */
+
+/*! \brief Reference count, one bin after the other */
+static void plain_count(const std::string &data, Bigram_Counts &counts) {
+  counts.fill(0);
+  for(size_t i = 0; i + 1 < data.size(); ++i) ++counts[static_cast<uint8_t>(data[i]) << 8 | static_cast<uint8_t>(data[i + 1])];
+}
+
+static std::string test_data(size_t size, uint32_t seed, bool runs) {
+  std::string data(size, '\0');
+  uint32_t x = seed;
+
+  for(size_t i = 0; i < size; ++i) {
+    x = x * 1103515245u + 12345u;
+    //Every other 64 byte block is a run of one byte.
+    data[i] = runs && (i / 64) % 2 == 0 ? static_cast<char>(seed) : static_cast<char>(x >> 16);
+  }
+  return data;
+}
+
+int main() {
+  Bigram_Counter split(0), unsplit(SIZE_MAX), standard;
+  std::unique_ptr<Bigram_Counts> expected(new Bigram_Counts), counts(new Bigram_Counts);
+  std::vector<size_t> sizes;
+
+  for(size_t size = 0; size < 24; ++size) sizes.push_back(size);
+  sizes.push_back(4099);
+  sizes.push_back(BIGRAM_SPLIT_MIN - 1);
+  sizes.push_back(BIGRAM_SPLIT_MIN);
+  sizes.push_back(BIGRAM_SPLIT_MIN + 3);
+  for(size_t size : sizes) {
+    for(bool runs : { false, true }) {
+      std::string data(test_data(size, size + 1, runs));
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+      plain_count(data, *expected);
+      //Twice, the sub-histograms of the first count must not leak into the second.
+      for(int round = 0; round < 2; ++round) {
+	split.count(bytes, data.size(), *counts);
+	CHECK(*counts == *expected);
+	unsplit.count(bytes, data.size(), *counts);
+	CHECK(*counts == *expected);
+	standard.count(bytes, data.size(), *counts);
+	CHECK(*counts == *expected);
+      }
+    }
+  }
+  return test_result("test_bigram");
+}
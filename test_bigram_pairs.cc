@@ -0,0 +1,78 @@
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "bigram_pairs.hh"
+#include "unit_test.hh"
+
+/*
+ * The blocked engine has to emit exactly the pairs (i, j), i < j,
+ * j >= first[i], in row order, with the distance sparse_distance()
+ * gives for the pair. The counts are not multiples of the block size,
+ * so the last block is partial.
+ */
+
+struct Test_Histogram {
+  std::vector<float> values;
+  std::vector<uint16_t> bins;
+};
+
+static uint32_t next_random(uint32_t &state) {
+  state = state * 1103515245u + 12345u;
+  return state >> 16;
+}
+
+/*! \brief Random normalised histogram, few bins so that they overlap */
+static Test_Histogram random_histogram(uint32_t &state) {
+  Test_Histogram histo;
+  double sum = 0;
+  size_t size = next_random(state) % 40;
+
+  for(size_t bin = next_random(state) % 16; histo.bins.size() < size && bin < BIGRAM_BINS; bin += 1 + next_random(state) % 64) {
+    histo.bins.push_back(bin);
+    histo.values.push_back(1 + next_random(state) % 100);
+    sum += histo.values.back();
+  }
+  for(auto &value : histo.values) value /= sum;
+  return histo;
+}
+
+static void check_pairs(const std::vector<Sparse_Histogram> &histos, const std::vector<size_t> &first, unsigned int threads) {
+  std::vector<std::pair<size_t, size_t> > expected, emitted;
+
+  for(size_t i = 0; i < histos.size(); ++i) {
+    for(size_t j = i + 1; j < histos.size(); ++j) {
+      if(first.empty() || j >= first[i]) expected.push_back(std::make_pair(i, j));
+    }
+  }
+  unsigned long count = bigram_all_pairs(histos, first, threads, [&](size_t i, size_t j, double distance) {
+      emitted.push_back(std::make_pair(i, j));
+      CHECK(std::fabs(distance - sparse_distance(histos[i], histos[j])) < 1e-6);
+    });
+  CHECK(count == emitted.size());
+  CHECK(emitted == expected);
+}
+
+int main() {
+  uint32_t state = 7;
+
+  for(size_t count : { 0, 1, 2, 7, 9, 16, 17, 23, 41 }) {
+    std::vector<Test_Histogram> data;
+    std::vector<Sparse_Histogram> histos;
+    std::vector<size_t> first;
+    for(size_t i = 0; i < count; ++i) {
+      //A repeated histogram has the distance 0.
+      data.push_back(i % 5 == 4 ? data[i - 1] : random_histogram(state));
+    }
+    for(auto &histo : data) {
+      Sparse_Histogram sparse = { histo.values.data(), histo.bins.data(), histo.values.size() };
+      histos.push_back(sparse);
+      first.push_back(next_random(state) % (count + 1));
+    }
+    for(unsigned int threads : { 1, 3 }) {
+      check_pairs(histos, std::vector<size_t>(), threads);
+      check_pairs(histos, first, threads);
+    }
+  }
+  return test_result("test_bigram_pairs");
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bitshred.hh"
+#include "unit_test.hh"
+
+/*
+ * The bitshred classes keep the bytea layout of the database: the
+ * bytes have to come back unchanged, bit i is the mask 0x80 >> (i%8)
+ * of byte i/8, a runtime size needs not be a multiple of eight bits,
+ * and the unrolled counts have to agree with the generic loop.
+ */
+
+static std::vector<uint8_t> random_bytes(size_t size, uint32_t &state) {
+  std::vector<uint8_t> data(size);
+
+  for(auto &byte : data) {
+    state = state * 1103515245u + 12345u;
+    byte = state >> 16;
+  }
+  return data;
+}
+
+static bool operator==(const Bitshred_Counts &x, const Bitshred_Counts &y) {
+  return x.intersection == y.intersection && x.unio == y.unio;
+}
+
+static bool same_bytes(const uint8_t *data, const std::vector<uint8_t> &bytes) {
+  return std::equal(bytes.begin(), bytes.end(), data);
+}
+
+template<size_t BYTES> static void check_fixed(uint32_t &state) {
+  std::vector<uint8_t> fst(random_bytes(BYTES, state)), snd(random_bytes(BYTES, state));
+  Bitshred<BYTES * 8> x(fst.data(), BYTES), y(snd.data(), BYTES);
+
+  CHECK(bitshred_counts_fixed<BYTES>(fst.data(), snd.data()) == bitshred_counts_any(fst.data(), snd.data(), BYTES));
+  CHECK(bitshred_counts_any(fst.data(), snd.data(), BYTES) == bitshred_counts(fst.data(), snd.data(), BYTES));
+  CHECK(x.counts(y) == bitshred_counts(fst.data(), snd.data(), BYTES));
+  CHECK(same_bytes(x.data(), fst));
+  CHECK(x.size() == BYTES * 8 && x.byte_size() == BYTES);
+}
+
+int main() {
+  uint32_t state = 13;
+
+  //Fixed size: round trip, layout and a wrong size.
+  std::vector<uint8_t> bytes(random_bytes(1024, state));
+  Bitshred8192 fixed(bytes.data(), bytes.size());
+  CHECK(same_bytes(fixed.data(), bytes));
+  CHECK(fixed.count() == bitshred_bit_count(bytes.data(), bytes.size()));
+  Bitshred<64> small;
+  small.set(0);
+  small.set(9);
+  small.set(63);
+  CHECK(small.data()[0] == 0x80 && small.data()[1] == 0x40 && small.data()[7] == 0x01);
+  CHECK(small.test(9) && !small.test(8) && small.count() == 3);
+  std::ostringstream out;
+  out << small;
+  CHECK(out.str() == "1000000001" + std::string(53, '0') + "1");
+  bool thrown = false;
+  try {
+    Bitshred8192(bytes.data(), bytes.size() - 1);
+  }
+  catch(const std::invalid_argument &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+
+  //Runtime size, also not a multiple of eight bits.
+  for(size_t m : { 0, 1, 12, 64, 65, 1001 }) {
+    BitshredType shred(m);
+    CHECK(shred.size() == m && shred.byte_size() == (m + 7) / 8);
+    if(m == 0) continue;
+    shred.set(m - 1);
+    CHECK(shred.test(m - 1) && shred.count() == 1);
+    CHECK(shred.data()[(m - 1) / 8] == (0x80 >> ((m - 1) % 8)));
+  }
+  for(size_t size : { 1, 2, 7, 13, 126, 1024 }) {
+    std::vector<uint8_t> fst(random_bytes(size, state)), snd(random_bytes(size, state));
+    BitshredType x(fst.data(), size), y(snd.data(), size);
+    CHECK(x.size() == size * 8 && x.byte_size() == size);
+    CHECK(same_bytes(x.data(), fst));
+    CHECK(x.counts(y) == bitshred_counts(fst.data(), snd.data(), size));
+    CHECK(bitshred_counts_any(fst.data(), snd.data(), size) == bitshred_counts(fst.data(), snd.data(), size));
+  }
+  thrown = false;
+  try {
+    BitshredType(12).counts(BitshredType(16));
+  }
+  catch(const std::invalid_argument &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+
+  //Every size bitshred_counts_any() dispatches to an unrolled loop.
+  check_fixed<1024 / 8>(state);
+  check_fixed<2048 / 8>(state);
+  check_fixed<4096 / 8>(state);
+  check_fixed<8192 / 8>(state);
+  check_fixed<16384 / 8>(state);
+
+  //A block is a view with padded rows.
+  const size_t stride = 24, size = 13, count = 5;
+  std::vector<uint8_t> rows(random_bytes(count * stride, state));
+  std::vector<uint32_t> sids = { 3, 5, 8, 13, 21 };
+  Bitshred_Block block = { rows.data(), stride, size, count, sids.data() };
+  for(size_t i = 0; i < count; ++i) {
+    BitshredType shred(block.shred(i), block.bytes);
+    CHECK(block.shred(i) == rows.data() + i * stride);
+    CHECK(same_bytes(shred.data(), std::vector<uint8_t>(rows.begin() + i * stride, rows.begin() + i * stride + size)));
+  }
+  return test_result("test_bitshred");
+}
@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "hash.hh"
+#include "unit_test.hh"
+
+/*
+ * Every window implementation has to give the hashes of the plain
+ * functions, for every window size and every tail the sixteen and
+ * eight lane blocks leave. The rolling hashers are checked against
+ * the plain functions as well.
+ */
+
+typedef uint32_t (*Hash_Function)(const uint8_t *data, size_t length);
+
+static const struct {
+  const char *name;
+  Hash_Windows_Function windows;
+  Hash_Function hash;
+} batch_hashes[] = {
+  { "jenkins", &jenkins_hash_windows, &jenkins_one_at_a_time_hash },
+  { "djb2", &djb2_hash_windows, &djb2_hash },
+  { "djb2xor", &djb2xor_hash_windows, &djb2xor_hash },
+  { "sbox", &sbox_hash_windows, &sbox_hash },
+};
+
+static std::vector<uint8_t> random_bytes(size_t size, uint32_t &state) {
+  std::vector<uint8_t> data(size);
+
+  for(auto &byte : data) {
+    state = state * 1103515245u + 12345u;
+    byte = state >> 16;
+  }
+  return data;
+}
+
+template<typename HASHER> static bool rolling_equal(const std::vector<uint8_t> &data, size_t n, Hash_Function hash) {
+  HASHER hasher(n);
+  bool equal = true;
+
+  if(data.size() < n) return true;
+  for(size_t i = 0; i + n <= data.size(); ++i) equal = equal && (i == 0 ? hasher.first(&data[0]) : hasher.next(&data[i])) == hash(&data[i], n);
+  return equal;
+}
+
+int main() {
+  uint32_t state = 2017;
+
+  for(const char *kernel : { "scalar", "avx2" }) {
+    if(!hash_windows_select_kernel(kernel)) {
+      std::cout << "test_hash: " << kernel << " not available, skipped" << std::endl;
+      continue;
+    }
+    for(size_t n = 1; n <= 24; ++n) {
+      for(size_t count = 0; count <= 40; ++count) {
+	//Exactly the bytes read, so that the sanitizers see reads beyond.
+	std::vector<uint8_t> data(random_bytes(count + n - 1, state));
+	std::vector<uint32_t> out(count + 1, 0xDEADBEEFu);
+	for(auto &batch : batch_hashes) {
+	  bool equal = true;
+	  batch.windows(data.data(), n, count, out.data());
+	  for(size_t i = 0; i < count; ++i) equal = equal && out[i] == batch.hash(&data[i], n);
+	  if(!equal) std::cerr << kernel << ' ' << batch.name << " n=" << n << " count=" << count << std::endl;
+	  CHECK(equal);
+	  CHECK(out[count] == 0xDEADBEEFu);
+	}
+      }
+    }
+  }
+  for(size_t n = 1; n <= 24; ++n) {
+    std::vector<uint8_t> data(random_bytes(300, state));
+    CHECK(rolling_equal<Djb2_Rolling>(data, n, &djb2_hash));
+    CHECK(rolling_equal<Rabinkarp_Rolling>(data, n, &rabinkarp_hash));
+    CHECK(rolling_equal<Buzhash_Rolling>(data, n, &buzhash_hash));
+  }
+  return test_result("test_hash");
+}
@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "bigram.hh"
+#include "histogram_cache.hh"
+#include "md5.hh"
+#include "unit_test.hh"
+
+/*
+ * A cached histogram is only current for the data it was calculated
+ * from: a changed byte or a changed length has to be noticed by
+ * comparing with the length and md5() the database reports.
+ */
+
+static std::string md5_of(const std::string &data) {
+  uint8_t digest[MD5_DIGEST_SIZE];
+
+  md5(reinterpret_cast<const uint8_t *>(data.data()), data.size(), digest);
+  return md5_hex(digest);
+}
+
+int main() {
+  std::string dir(test_directory());
+  std::string fname(dir + "/histograms.cache");
+  std::string first(1000, 'a'), second("PSID with some other bytes");
+  Bigram_Counter counter;
+  std::unique_ptr<Bigram_Histogram> histo(new Bigram_Histogram);
+
+  //Known digests, as from PostgreSQL md5().
+  CHECK(md5_of("") == "d41d8cd98f00b204e9800998ecf8427e");
+  CHECK(md5_of("abc") == "900150983cd24fb0d6963f7d28e17f72");
+  CHECK(md5_of("12345678901234567890123456789012345678901234567890123456789012345678901234567890") == "57edf4a22be3c955ac49da2e2107b67a");
+
+  try {
+    {
+      Histogram_Cache_Writer writer(fname);
+      bigram_histogram(counter, reinterpret_cast<const uint8_t *>(first.data()), first.size(), *histo);
+      writer.add(3, *histo, reinterpret_cast<const uint8_t *>(first.data()), first.size());
+      bigram_histogram(counter, reinterpret_cast<const uint8_t *>(second.data()), second.size(), *histo);
+      writer.add(7, *histo, reinterpret_cast<const uint8_t *>(second.data()), second.size());
+      writer.close();
+    }
+    Histogram_Cache cache(fname);
+    CHECK(cache.size() == 2);
+    CHECK(cache.find(3) == 0 && cache.find(7) == 1 && cache.find(5) == 2);
+    CHECK(cache.is_current(0, first.size(), md5_of(first)));
+    CHECK(cache.is_current(1, second.size(), md5_of(second)));
+    //Same length, one byte changed.
+    std::string changed(first);
+    changed[500] = 'b';
+    CHECK(!cache.is_current(0, changed.size(), md5_of(changed)));
+    //Longer, or the digest of another file.
+    CHECK(!cache.is_current(0, first.size() + 1, md5_of(first)));
+    CHECK(!cache.is_current(1, second.size(), md5_of(first)));
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Exception: " << excp.what() << std::endl;
+    ++test_failures;
+  }
+  std::string cleanup("rm -rf '" + dir + "'");
+  if(std::system(cleanup.c_str()) != 0) std::cerr << "can not remove " << dir << std::endl;
+  return test_result("test_histogram_cache");
+}
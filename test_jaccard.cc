@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "jaccard.hh"
+#include "unit_test.hh"
+
+/*
+ * Every Jaccard implementation has to count the bits of a plain loop,
+ * for odd sizes and every tail the 32 and 64 byte vectors and the 512
+ * byte Harley-Seal blocks leave, and jaccard_counts_many() has to give
+ * the pairwise counts for any number of rows.
+ */
+
+static std::vector<uint8_t> random_bytes(size_t size, uint32_t &state) {
+  std::vector<uint8_t> data(size);
+
+  for(auto &byte : data) {
+    state = state * 1103515245u + 12345u;
+    byte = state >> 16;
+    //Sparse, dense, and mixed bitshreds.
+    if(state % 7 == 0) byte &= state >> 24;
+    if(state % 11 == 0) byte = 0xFF;
+  }
+  return data;
+}
+
+/*! \brief Reference, one bit after the other */
+static Bitshred_Counts plain_counts(const uint8_t *fst, const uint8_t *snd, size_t bytes) {
+  Bitshred_Counts counts = { 0, 0 };
+
+  for(size_t i = 0; i < bytes; ++i) {
+    for(int bit = 0; bit < 8; ++bit) {
+      counts.intersection += (fst[i] & snd[i]) >> bit & 1;
+      counts.unio += (fst[i] | snd[i]) >> bit & 1;
+    }
+  }
+  return counts;
+}
+
+static bool operator==(const Bitshred_Counts &x, const Bitshred_Counts &y) {
+  return x.intersection == y.intersection && x.unio == y.unio;
+}
+
+int main() {
+  uint32_t state = 2017;
+  std::vector<size_t> sizes;
+
+  for(size_t bytes = 0; bytes <= 130; ++bytes) sizes.push_back(bytes);
+  for(size_t bytes : { 511, 512, 513, 1024, 1024 + 33, 3 * 512 + 64 + 31, 4096 + 7 }) sizes.push_back(bytes);
+  for(const char *kernel : { "scalar", "popcnt", "avx2", "avx512" }) {
+    if(!jaccard_select_kernel(kernel)) {
+      std::cout << "test_jaccard: " << kernel << " not available, skipped" << std::endl;
+      continue;
+    }
+    for(size_t bytes : sizes) {
+      //Exactly the bytes read, so that the sanitizers see reads beyond.
+      std::vector<uint8_t> fst(random_bytes(bytes, state)), snd(random_bytes(bytes, state));
+      bool equal = jaccard_counts(fst.data(), snd.data(), bytes) == plain_counts(fst.data(), snd.data(), bytes);
+      if(!equal) std::cerr << kernel << " bytes=" << bytes << std::endl;
+      CHECK(equal);
+    }
+    for(size_t bytes : { 0, 1, 33, 100, 1024 + 33 }) {
+      for(size_t count : { 0, 1, 5 }) {
+	const size_t stride = bytes + 3;
+	std::vector<uint8_t> query(random_bytes(bytes, state)), rows(random_bytes(count * stride, state));
+	std::vector<Bitshred_Counts> out(count + 1);
+	out[count].intersection = out[count].unio = 0xDEADBEEFu;
+	jaccard_counts_many(query.data(), rows.data(), stride, bytes, count, out.data());
+	for(size_t i = 0; i < count; ++i) CHECK(out[i] == plain_counts(query.data(), rows.data() + i * stride, bytes));
+	CHECK(out[count].intersection == 0xDEADBEEFu && out[count].unio == 0xDEADBEEFu);
+      }
+    }
+  }
+  return test_result("test_jaccard");
+}
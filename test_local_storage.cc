@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "local_storage.hh"
+#include "unit_test.hh"
+
+/*
+ * Appending to a fingerprint file after a run died in the middle of a
+ * record, or even of the header.
+ */
+
+static void write_fingerprints(Local_Storage &storage, const std::string &kind, const std::vector<std::pair<unsigned int, std::string> > &values) {
+  std::unique_ptr<Fingerprint_Writer> writer(storage.writer({ kind }, 100, 1000.0, false));
+
+  for(auto &value : values) {
+    writer->issue(value.first);
+    writer->write(value.first, 0, reinterpret_cast<const uint8_t *>(value.second.data()), value.second.size());
+    writer->done(value.first);
+  }
+  writer->flush();
+}
+
+static void append_raw(const std::string &fname, const std::string &bytes) {
+  std::ofstream out(fname, std::ios::binary | std::ios::app);
+
+  out.write(bytes.data(), bytes.size());
+}
+
+static std::string raw_record(uint32_t sid, uint32_t size, const std::string &value) {
+  std::string bytes(reinterpret_cast<const char *>(&sid), sizeof(sid));
+
+  bytes.append(reinterpret_cast<const char *>(&size), sizeof(size));
+  return bytes + value;
+}
+
+static off_t file_size(const std::string &fname) {
+  struct stat st;
+
+  return stat(fname.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static void test_truncated_record(const std::string &dir) {
+  Local_Storage storage(dir);
+  std::string fname(storage.fingerprint_file("test"));
+  std::vector<std::pair<unsigned int, std::string> > got;
+
+  write_fingerprints(storage, "test", { { 1, "one" }, { 2, "two" } });
+  off_t complete = file_size(fname);
+  //Record of SID 3 announcing 100 bytes, only 5 made it.
+  append_raw(fname, raw_record(3, 100, "three"));
+  got = storage.get("test", { 1, 2, 3 });
+  CHECK(got.size() == 2);
+  write_fingerprints(storage, "test", { { 4, "four" } });
+  CHECK(file_size(fname) == complete + static_cast<off_t>(raw_record(4, 4, "four").size()));
+  got = storage.get("test", { 1, 2, 3, 4 });
+  CHECK(got.size() == 3);
+  CHECK(got.size() == 3 && got[0].second == "one" && got[1].second == "two" && got[2].first == 4 && got[2].second == "four");
+  //Only the size field of the record header was cut.
+  append_raw(fname, std::string("\x05\0\0\0\x02", 5));
+  write_fingerprints(storage, "test", { { 5, "five" }, { 2, "TWO" } });
+  got = storage.get("test", { 2, 5 });
+  CHECK(got.size() == 2 && got[0].second == "TWO" && got[1].second == "five");
+  unsigned int scanned = 0;
+  storage.scan("test", [&scanned](unsigned int, const uint8_t *, size_t) { ++scanned; });
+  CHECK(scanned == 4);
+}
+
+static void test_truncated_header(const std::string &dir) {
+  Local_Storage storage(dir);
+  std::string fname(storage.fingerprint_file("header"));
+
+  append_raw(fname, LOCAL_FINGERPRINT_MAGIC);
+  CHECK(storage.get("header", { 1 }).empty());
+  write_fingerprints(storage, "header", { { 1, "one" } });
+  auto got = storage.get("header", { 1 });
+  CHECK(got.size() == 1 && got[0].second == "one");
+}
+
+static void test_foreign_file(const std::string &dir) {
+  Local_Storage storage(dir);
+  bool thrown = false;
+
+  append_raw(storage.fingerprint_file("foreign"), "not a fingerprint file");
+  try {
+    write_fingerprints(storage, "foreign", { { 1, "one" } });
+  }
+  catch(const std::runtime_error &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+int main() {
+  std::string dir(test_directory());
+
+  try {
+    test_truncated_record(dir);
+    test_truncated_header(dir);
+    test_foreign_file(dir);
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Exception: " << excp.what() << std::endl;
+    ++test_failures;
+  }
+  std::string cleanup("rm -rf '" + dir + "'");
+  if(std::system(cleanup.c_str()) != 0) std::cerr << "can not remove " << dir << std::endl;
+  return test_result("test_local_storage");
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fuzzy.h>
+#include "ssdeep_ngrams.hh"
+#include "unit_test.hh"
+
+/*
+ * The keys have to find every pair fuzzy_compare() scores above zero:
+ * pairs at equal and doubled blocksizes, signatures shorter than an
+ * n-gram and equal hashes which differ only in the length of runs. A
+ * small alphabet makes shared n-grams likely.
+ */
+
+struct Test_Hash {
+  unsigned long blocksize;
+  std::string signatures;
+
+  std::string text() const { return std::to_string(blocksize) + ':' + signatures; }
+};
+
+static uint32_t next_random(uint32_t &state) {
+  state = state * 1103515245u + 12345u;
+  return state >> 16;
+}
+
+static std::string random_signature(uint32_t &state) {
+  static const char alphabet[] = "ABCa";
+  std::string signature(next_random(state) % 14, 'A');
+
+  for(auto &c : signature) c = alphabet[next_random(state) % 4];
+  return signature;
+}
+
+/*! \brief A similar signature: a character changed or a run lengthened */
+static std::string mutate(const std::string &signature, uint32_t &state) {
+  std::string result(signature);
+
+  if(result.empty()) return result;
+  size_t pos = next_random(state) % result.size();
+  if(next_random(state) % 2) {
+    result[pos] = "ABCa"[next_random(state) % 4];
+  } else {
+    result.insert(pos, 1 + next_random(state) % 3, result[pos]);
+  }
+  return result;
+}
+
+static bool share_key(const Test_Hash &x, const Test_Hash &y) {
+  std::vector<int64_t> x_keys(ssdeep_ngram_keys(x.blocksize, x.signatures)), y_keys(ssdeep_ngram_keys(y.blocksize, y.signatures)), common;
+
+  std::set_intersection(x_keys.begin(), x_keys.end(), y_keys.begin(), y_keys.end(), std::back_inserter(common));
+  return !common.empty();
+}
+
+int main() {
+  std::vector<Test_Hash> hashes;
+  uint32_t state = 1;
+  unsigned int scored = 0;
+
+  for(int i = 0; i < 400; ++i) {
+    Test_Hash hash = { static_cast<unsigned long>(SSDEEP_MIN_BLOCKSIZE) << next_random(state) % 3, random_signature(state) + ':' + random_signature(state) };
+    hashes.push_back(hash);
+    //The same, a similar and a shifted hash of the same file.
+    hashes.push_back(hash);
+    size_t colon = hash.signatures.find(':');
+    Test_Hash similar = { hash.blocksize, mutate(hash.signatures.substr(0, colon), state) + ':' + mutate(hash.signatures.substr(colon + 1), state) };
+    hashes.push_back(similar);
+    Test_Hash doubled = { 2 * hash.blocksize, hash.signatures.substr(colon + 1) + ':' + random_signature(state) };
+    hashes.push_back(doubled);
+  }
+  for(size_t i = 0; i < hashes.size(); ++i) {
+    for(size_t j = i; j < hashes.size(); ++j) {
+      if(fuzzy_compare(hashes[i].text().c_str(), hashes[j].text().c_str()) <= 0) continue;
+      ++scored;
+      CHECK(share_key(hashes[i], hashes[j]));
+    }
+  }
+  //Mostly pairs of the same file, but not only.
+  CHECK(scored > hashes.size());
+
+  Test_Hash short_runs = { 3, "AAAAB:AB" }, long_runs = { 3, "AAAAAAAB:AB" }, other = { 3, "AAAC:AC" };
+  CHECK(fuzzy_compare(short_runs.text().c_str(), long_runs.text().c_str()) == 100);
+  CHECK(share_key(short_runs, long_runs));
+  CHECK(!share_key(short_runs, other));
+
+  Ssdeep_Hash split(split_ssdeep_hash("96:AbC+/:De"));
+  CHECK(split.blocksize == 96 && split.signatures == "AbC+/:De");
+  for(const char *bad : { "", "96", "96:AbC", ":AbC:De", "9a:AbC:De", "-3:AbC:De", "99999999999:AbC:De" }) {
+    bool thrown = false;
+    try {
+      split_ssdeep_hash(bad);
+    }
+    catch(const std::invalid_argument &) {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+  return test_result("test_ssdeep_ngrams");
+}
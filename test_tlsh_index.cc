@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tlsh_index.hh"
+#include "unit_test.hh"
+
+/*
+ * The header distance plus the distance of the first body byte is a
+ * lower bound of the TLSH distance, and the index, which prunes with
+ * it, has to select the same distances as comparing every digest.
+ */
+
+static uint32_t next_random(uint32_t &state) {
+  state = state * 1103515245u + 12345u;
+  return state >> 8;
+}
+
+static Tlsh_Digest random_digest(uint32_t &state) {
+  Tlsh_Digest digest;
+
+  digest.checksum = next_random(state);
+  //Few Lvalues and ratios, so that the partitions have several digests.
+  digest.lvalue = 100 + next_random(state) % 6;
+  digest.q1ratio = next_random(state) % 4;
+  digest.q2ratio = next_random(state) % 16;
+  for(size_t i = 0; i < TLSH_BODY_BYTES; ++i) digest.body[i] = next_random(state);
+  return digest;
+}
+
+/*! \brief A digest close to x, some buckets and maybe the header changed */
+static Tlsh_Digest near_digest(const Tlsh_Digest &x, uint32_t &state) {
+  Tlsh_Digest digest(x);
+
+  for(unsigned int i = next_random(state) % 8; i > 0; --i) digest.body[next_random(state) % TLSH_BODY_BYTES] ^= 1 << (next_random(state) % 8);
+  if(next_random(state) % 4 == 0) digest.lvalue += 1;
+  if(next_random(state) % 4 == 0) digest.q2ratio = (digest.q2ratio + 1) % 16;
+  if(next_random(state) % 2 == 0) digest.checksum ^= 1;
+  return digest;
+}
+
+static std::vector<double> distances_of(Distance_Selector &selector) {
+  std::vector<double> distances;
+
+  for(auto &entry : selector.take()) distances.push_back(entry.second);
+  return distances;
+}
+
+int main() {
+  uint32_t state = 2017;
+  std::vector<Tlsh_Digest> digests;
+  Tlsh_Index index;
+  size_t visited;
+
+  for(unsigned int i = 0; i < 3000; ++i) {
+    if(i > 0 && next_random(state) % 2 == 0) {
+      digests.push_back(near_digest(digests[next_random(state) % digests.size()], state));
+    } else {
+      digests.push_back(random_digest(state));
+    }
+    index.add(i + 1, digests.back());
+  }
+  index.finish();
+  CHECK(index.size() == digests.size());
+  CHECK(index.partition_count() < digests.size() / 4);
+  for(size_t i = 0; i < digests.size(); i += 7) {
+    for(size_t j = 0; j < digests.size(); j += 11) {
+      int bound = tlsh_header_distance(digests[i], digests[j]) + tlsh_byte_distance(digests[i].body[0], digests[j].body[0]);
+      CHECK(bound <= tlsh_distance(digests[i], digests[j]));
+    }
+  }
+  for(size_t i = 0; i < digests.size(); i += 97) {
+    const Tlsh_Digest *found = index.find(i + 1);
+    CHECK(found && tlsh_distance(*found, digests[i]) == 0 && found->checksum == digests[i].checksum);
+    for(size_t k : { 1, 5, 20 }) {
+      Distance_Selector expected(Distance_Selector::top(k)), selector(Distance_Selector::top(k));
+      for(size_t j = 0; j < digests.size(); ++j) expected.add(j + 1, tlsh_distance(digests[i], digests[j]));
+      index.closest(digests[i], selector, &visited);
+      CHECK(distances_of(selector) == distances_of(expected));
+      if(k == 1) CHECK(visited < digests.size() / 10);
+    }
+    Distance_Selector expected(Distance_Selector::closer(60)), selector(Distance_Selector::closer(60));
+    for(size_t j = 0; j < digests.size(); ++j) expected.add(j + 1, tlsh_distance(digests[i], digests[j]));
+    index.closest(digests[i], selector, NULL);
+    std::vector<Distance_Selector::Entry> all(selector.take()), all_expected(expected.take());
+    std::sort(all.begin(), all.end());
+    std::sort(all_expected.begin(), all_expected.end());
+    CHECK(all == all_expected);
+  }
+  CHECK(index.find(0) == NULL);
+  CHECK(index.find(digests.size() + 1) == NULL);
+
+  //The hex string of Tlsh::getHash() as stored in fuzzy_tlsh.
+  std::string hex("0A1B2c3d4e5f60718293A4B5C6D7E8F90A1B2C3D4E5F60718293A4B5C6D7E8F9aabbcc");
+  std::string bytes(tlsh_hex_bytes(hex));
+  CHECK(bytes.size() == TLSH_DIGEST_BYTES && bytes[0] == 0x0A && bytes[1] == 0x1B && bytes[2] == 0x2C && static_cast<uint8_t>(bytes[34]) == 0xCC);
+  for(const std::string &bad : { hex.substr(1), hex.substr(2), "T1" + hex.substr(2), hex.substr(0, 68) + "0g" }) {
+    bool thrown = false;
+    try {
+      tlsh_hex_bytes(bad);
+    }
+    catch(const std::invalid_argument &) {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+  return test_result("test_tlsh_index");
+}
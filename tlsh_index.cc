@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <stdexcept>
+#include "tlsh_index.hh"
+
+#define TLSH_RANGE_LVALUE 256
+#define TLSH_RANGE_QRATIO 16
+
+static uint8_t swap_nibbles(uint8_t x) {
+  return static_cast<uint8_t>((x << 4) | (x >> 4));
+}
+
+static int mod_diff(int x, int y, int range) {
+  int dl = y > x ? y - x : x - y;
+  int dr = range - dl;
+  return std::min(dl, dr);
+}
+
+/*! \brief Distances of all pairs of body bytes, like bit_pairs_diff_table */
+static const std::array<uint8_t, 65536> &byte_table() {
+  static const std::array<uint8_t, 65536> table = []() {
+    std::array<uint8_t, 65536> t;
+    for(int x = 0; x < 256; ++x) {
+      for(int y = 0; y < 256; ++y) {
+	int diff = 0;
+	for(int shift = 0; shift < 8; shift += 2) {
+	  int d = std::abs(((x >> shift) & 3) - ((y >> shift) & 3));
+	  diff += d == 3 ? 6 : d;
+	}
+	t[x << 8 | y] = diff;
+      }
+    }
+    return t;
+  }();
+  return table;
+}
+
+static int hex_value(char c) {
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+std::string tlsh_hex_bytes(const std::string &hash) {
+  std::string bytes;
+
+  if(hash.size() != 2 * TLSH_DIGEST_BYTES) throw std::invalid_argument("TLSH hash must have 70 hex digits: " + hash);
+  for(size_t i = 0; i < hash.size(); i += 2) {
+    int high = hex_value(hash[i]), low = hex_value(hash[i + 1]);
+    if(high < 0 || low < 0) throw std::invalid_argument("TLSH hash must have 70 hex digits: " + hash);
+    bytes.push_back(static_cast<char>(high << 4 | low));
+  }
+  return bytes;
+}
+
+Tlsh_Digest tlsh_decode(const uint8_t *data, size_t size) {
+  Tlsh_Digest digest;
+
+  if(size != TLSH_DIGEST_BYTES) throw std::invalid_argument("TLSH digest must have 35 bytes");
+  digest.checksum = swap_nibbles(data[0]);
+  digest.lvalue = swap_nibbles(data[1]);
+  //Q1 is the low nibble of the Q byte.
+  uint8_t q = swap_nibbles(data[2]);
+  digest.q1ratio = q & 15;
+  digest.q2ratio = q >> 4;
+  //Only the sum over the body matters, so the order is kept.
+  std::copy(data + 3, data + 3 + TLSH_BODY_BYTES, digest.body);
+  return digest;
+}
+
+int tlsh_header_distance(const Tlsh_Digest &x, const Tlsh_Digest &y) {
+  int diff = 0;
+  int ldiff = mod_diff(x.lvalue, y.lvalue, TLSH_RANGE_LVALUE);
+  int q1diff = mod_diff(x.q1ratio, y.q1ratio, TLSH_RANGE_QRATIO);
+  int q2diff = mod_diff(x.q2ratio, y.q2ratio, TLSH_RANGE_QRATIO);
+
+  diff += ldiff <= 1 ? ldiff : ldiff * 12;
+  diff += q1diff <= 1 ? q1diff : (q1diff - 1) * 12;
+  diff += q2diff <= 1 ? q2diff : (q2diff - 1) * 12;
+  return diff;
+}
+
+int tlsh_byte_distance(uint8_t x, uint8_t y) {
+  return byte_table()[x << 8 | y];
+}
+
+int tlsh_distance(const Tlsh_Digest &x, const Tlsh_Digest &y) {
+  const std::array<uint8_t, 65536> &table(byte_table());
+  int diff = tlsh_header_distance(x, y);
+
+  if(x.checksum != y.checksum) ++diff;
+  for(size_t i = 0; i < TLSH_BODY_BYTES; ++i) diff += table[x.body[i] << 8 | y.body[i]];
+  return diff;
+}
+
+
+void Tlsh_Index::add(unsigned int sid, const Tlsh_Digest &digest) {
+  digests.push_back(digest);
+  sids.push_back(sid);
+}
+
+void Tlsh_Index::reserve(size_t count) {
+  digests.reserve(count);
+  sids.reserve(count);
+}
+
+void Tlsh_Index::finish() {
+  std::vector<size_t> order(digests.size());
+  auto key = [](const Tlsh_Digest &x) { return x.lvalue << 16 | x.q1ratio << 12 | x.q2ratio << 8; };
+
+  for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return (key(digests[x]) | digests[x].body[0]) < (key(digests[y]) | digests[y].body[0]); });
+  std::vector<Tlsh_Digest> sorted_digests;
+  std::vector<uint32_t> sorted_sids;
+  for(size_t i : order) {
+    sorted_digests.push_back(digests[i]);
+    sorted_sids.push_back(sids[i]);
+  }
+  digests.swap(sorted_digests);
+  sids.swap(sorted_sids);
+  groups.clear();
+  partitions.clear();
+  by_sid.clear();
+  for(size_t i = 0; i < digests.size(); ++i) {
+    bool new_partition = partitions.empty() || key(partitions.back().key) != key(digests[i]);
+    if(new_partition) {
+      Partition partition = { digests[i], groups.size(), groups.size() };
+      partitions.push_back(partition);
+    }
+    if(new_partition || groups.back().first != digests[i].body[0]) {
+      Group group = { digests[i].body[0], static_cast<uint32_t>(i), static_cast<uint32_t>(i) };
+      groups.push_back(group);
+      partitions.back().end = groups.size();
+    }
+    groups.back().end = i + 1;
+    by_sid.push_back(std::make_pair(sids[i], static_cast<uint32_t>(i)));
+  }
+  std::sort(by_sid.begin(), by_sid.end());
+}
+
+const Tlsh_Digest *Tlsh_Index::find(unsigned int sid) const {
+  auto pos = std::lower_bound(by_sid.begin(), by_sid.end(), std::make_pair(static_cast<uint32_t>(sid), static_cast<uint32_t>(0)));
+
+  if(pos == by_sid.end() || pos->first != sid) return NULL;
+  return &digests[pos->second];
+}
+
+/*! \brief tlsh_distance(), stops early once the distance exceeds limit
+ *
+ * \param header distance of the headers
+ * \return the distance or a value above limit
+ */
+static int limited_distance(const Tlsh_Digest &x, const Tlsh_Digest &y, int header, double limit) {
+  const std::array<uint8_t, 65536> &table(byte_table());
+  int diff = header + (x.checksum != y.checksum);
+
+  for(size_t i = 0; i < TLSH_BODY_BYTES; i += 8) {
+    for(size_t j = i; j < i + 8; ++j) diff += table[x.body[j] << 8 | y.body[j]];
+    if(diff > limit) break;
+  }
+  return diff;
+}
+
+void Tlsh_Index::closest(const Tlsh_Digest &query, Distance_Selector &selector, size_t *visited) const {
+  std::vector<std::pair<int, size_t> > bounds;
+  size_t count = 0;
+
+  bounds.reserve(partitions.size());
+  for(size_t i = 0; i < partitions.size(); ++i) bounds.push_back(std::make_pair(tlsh_header_distance(query, partitions[i].key), i));
+  std::sort(bounds.begin(), bounds.end());
+  for(auto &bound : bounds) {
+    if(bound.first > selector.threshold()) break;
+    const Partition &partition(partitions[bound.second]);
+    for(size_t g = partition.begin; g < partition.end; ++g) {
+      const Group &group(groups[g]);
+      if(bound.first + tlsh_byte_distance(query.body[0], group.first) > selector.threshold()) continue;
+      for(size_t i = group.begin; i < group.end; ++i) {
+	int distance = limited_distance(query, digests[i], bound.first, selector.threshold());
+	if(distance <= selector.threshold()) selector.add(sids[i], distance);
+      }
+      count += group.end - group.begin;
+    }
+  }
+  if(visited) *visited = count;
+}
@@ -0,0 +1,100 @@
+#ifndef __TLSH_INDEX_HH_2017__
+#define __TLSH_INDEX_HH_2017__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "topk.hh"
+
+/*
+ * fuzzy_tlsh stores the hex string of Tlsh::getHash() decoded to 35
+ * bytes: checksum, Lvalue, and the Q ratios with swapped nibbles,
+ * followed by the 32 body bytes in reverse order. The digests are kept
+ * in this form with only the header decoded; the distance is the one
+ * of Tlsh::totalDiff() with the length difference.
+ */
+
+#define TLSH_DIGEST_BYTES 35
+#define TLSH_BODY_BYTES 32
+
+/*! \brief Decoded TLSH digest */
+struct Tlsh_Digest {
+  uint8_t checksum;
+  uint8_t lvalue;
+  uint8_t q1ratio;
+  uint8_t q2ratio;
+  uint8_t body[TLSH_BODY_BYTES];
+};
+
+/*! \brief The bytes stored in fuzzy_tlsh for the hex string of Tlsh::getHash() */
+std::string tlsh_hex_bytes(const std::string &hash);
+
+/*! \brief Decode a digest as stored in fuzzy_tlsh */
+Tlsh_Digest tlsh_decode(const uint8_t *data, size_t size);
+
+/*! \brief Distance of the Lvalues and Q ratios
+ *
+ * This is a lower bound of tlsh_distance().
+ */
+int tlsh_header_distance(const Tlsh_Digest &x, const Tlsh_Digest &y);
+
+/*! \brief Distance of two body bytes, four buckets of two bits each */
+int tlsh_byte_distance(uint8_t x, uint8_t y);
+
+/*! \brief Distance as calculated by Tlsh::totalDiff() */
+int tlsh_distance(const Tlsh_Digest &x, const Tlsh_Digest &y);
+
+/*! \brief In-memory index of TLSH digests
+ *
+ * The digests are grouped into partitions of equal Lvalue and Q ratios,
+ * so the header distance is the same for all digests of a partition,
+ * and within a partition into groups of equal first body byte. A query
+ * visits the partitions by ascending header distance and stops at the
+ * first one beyond the threshold of the selector. Of a partition only
+ * the groups are compared whose header distance plus the distance of
+ * the first body byte is within the threshold.
+ */
+class Tlsh_Index {
+  struct Group {
+    uint8_t first;
+    uint32_t begin;
+    uint32_t end;
+  };
+  struct Partition {
+    Tlsh_Digest key;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Tlsh_Digest> digests;
+  std::vector<uint32_t> sids;
+  std::vector<Group> groups;
+  /*! \brief Ranges of groups */
+  std::vector<Partition> partitions;
+  std::vector<std::pair<uint32_t, uint32_t> > by_sid;
+
+public:
+  Tlsh_Index() {}
+  /*! \brief Add a digest, finish() has to be called before queries */
+  void add(unsigned int sid, const Tlsh_Digest &digest);
+  /*! \brief Allocate room for count digests in advance */
+  void reserve(size_t count);
+  /*! \brief Sort the digests into the partitions */
+  void finish();
+  size_t size() const { return digests.size(); }
+  size_t partition_count() const { return partitions.size(); }
+  /*! \brief Find the digest of a SID
+   *
+   * \return pointer to the digest or NULL
+   */
+  const Tlsh_Digest *find(unsigned int sid) const;
+  /*! \brief Offer the closest digests to the selector
+   *
+   * \param query digest to compare with
+   * \param selector receives at least all digests it may select
+   * \param visited number of digests compared, may be NULL
+   */
+  void closest(const Tlsh_Digest &query, Distance_Selector &selector, size_t *visited) const;
+};
+
+#endif
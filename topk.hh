@@ -0,0 +1,82 @@
+#ifndef __TOPK_HH_2017__
+#define __TOPK_HH_2017__
+#include <stddef.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/*! \brief Streaming selection of the closest SIDs
+ *
+ * Either the k lowest distances are kept in a max heap, so the memory
+ * stays O(k) however many distances are added, or all distances up to
+ * delta. A scan can skip everything whose lower bound exceeds
+ * threshold().
+ */
+class Distance_Selector {
+public:
+  typedef std::pair<unsigned int, double> Entry;
+
+private:
+  size_t k;
+  double delta;
+  bool lowest;
+  std::vector<Entry> entries;
+
+  static bool closer_distance(const Entry &x, const Entry &y) { return x.second < y.second; }
+  Distance_Selector(size_t k, double delta, bool lowest) : k(k), delta(delta), lowest(lowest) {}
+
+public:
+  /*! \brief Keep the k lowest distances */
+  static Distance_Selector top(size_t k) { return Distance_Selector(k, 0, true); }
+  /*! \brief Keep all distances up to delta */
+  static Distance_Selector closer(double delta) { return Distance_Selector(0, delta, false); }
+
+  /*! \brief Largest distance which may still be selected
+   *
+   * It only decreases while distances are added.
+   */
+  double threshold() const {
+    if(!lowest) return delta;
+    if(k == 0) return -std::numeric_limits<double>::infinity();
+    if(entries.size() < k) return std::numeric_limits<double>::infinity();
+    return entries.front().second;
+  }
+
+  /*! \brief Offer a distance
+   *
+   * \return true if it was selected
+   */
+  bool add(unsigned int sid, double distance) {
+    if(!lowest) {
+      if(distance > delta) return false;
+      entries.push_back(std::make_pair(sid, distance));
+    } else if(entries.size() < k) {
+      entries.push_back(std::make_pair(sid, distance));
+      std::push_heap(entries.begin(), entries.end(), closer_distance);
+    } else if(k > 0 && distance < entries.front().second) {
+      std::pop_heap(entries.begin(), entries.end(), closer_distance);
+      entries.back() = std::make_pair(sid, distance);
+      std::push_heap(entries.begin(), entries.end(), closer_distance);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  size_t size() const { return entries.size(); }
+
+  /*! \brief The selected distances sorted ascending, the selector is emptied */
+  std::vector<Entry> take() {
+    std::vector<Entry> result;
+    if(lowest) {
+      std::sort_heap(entries.begin(), entries.end(), closer_distance);
+    } else {
+      std::sort(entries.begin(), entries.end(), closer_distance);
+    }
+    result.swap(entries);
+    return result;
+  }
+};
+
+#endif
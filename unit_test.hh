@@ -0,0 +1,38 @@
+#ifndef __UNIT_TEST_HH_2017__
+#define __UNIT_TEST_HH_2017__
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/*
+ * Checks for the test programs run by make check. They need no
+ * database; assert can not be used as NDEBUG is defined. A failed
+ * check is reported and counted, main returns test_result().
+ */
+
+static unsigned int test_failures = 0;
+
+#define CHECK(cond) do {						\
+    if(!(cond)) {							\
+      std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #cond << std::endl; \
+      ++test_failures;							\
+    }									\
+  } while(0)
+
+/*! \brief Report the result of the test program, the exit code of main */
+inline int test_result(const char *name) {
+  std::cout << name << (test_failures ? ": FAILED" : ": ok") << std::endl;
+  return test_failures ? 1 : 0;
+}
+
+/*! \brief A new empty directory below TMPDIR or /tmp */
+inline std::string test_directory() {
+  const char *tmp = std::getenv("TMPDIR");
+  std::string dir(std::string(tmp ? tmp : "/tmp") + "/sidabaeus-test-XXXXXX");
+
+  if(!mkdtemp(&dir[0])) throw std::runtime_error("can not create test directory " + dir);
+  return dir;
+}
+
+#endif